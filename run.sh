@@ -1,18 +1,89 @@
-make clean
-make
+#!/bin/bash
+# Reference runs: every benchmark of correctOutput/ through the MIPS R10K and
+# Alpha 21264 configurations, without and with the next-line prefetcher, and
+# the simple traces through 'simple'. Each run is timed; its statistics must
+# match correctOutput*/ (for 'simple', the scalar serial run) or the script
+# fails. Traces are looked up in traces/ and skipped when missing, except
+# for the checked-in traces/sample.bz2, which always has to match.
+#
+# make cache simple && ./run.sh     (or 'make bench')
 
+mips="--icache=128:2:128:2 --dcache=64:4:128:2 --l2cache=128:8:128:50 --memspeed=100"
+alpha="--icache=512:2:64:2 --dcache=256:4:64:2 --l2cache=16384:8:64:50 --memspeed=100"
 
-for file in traces:
-do
-    echo "Running $benchmark benchmark.."
-    output=`unzip2 -kc traces/$file | ./cache  --icache=128:2:128:2 --dcache=64:4:128:2 --l2cache=128:8:128:50 --memspeed=100`
-    echo -n "MIPS-R10k:     ";echo $output
+# The trace of benchmark $1 in any format 'cache' reads, empty if there is none
+trace_of() {
+    for ext in bz2 gz zst bin; do
+        if [ -f "traces/$1.$ext" ]; then
+            echo "traces/$1.$ext"
+            return
+        fi
+    done
+}
 
-    output=`unzip2 -kc traces/$file | ./cache  --icache=512:2:64:2 --dcache=256:4:64:2 --l2cache=16384:8:64:50 --memspeed=100`
-    echo -n "Alpha-21264:   ";echo $output
+# Print one timed run of name $1, $2 accesses from time $3 to $4: the
+# accesses, seconds, ns/access and Maccess/s
+report() {
+    awk -v name="$1" -v n="$2" -v start="$3" -v end="$4" 'BEGIN {
+        s = end - start
+        printf "  %-34s %10d %8.2fs %9.2f %9.2f\n", name, n, s, s * 1e9 / n, n / s / 1e6 }'
+}
 
-    echo "=============================================="
-done
+status=0
+printf "%-36s %10s %9s %9s %9s\n" "End-to-end" "accesses" "time" "ns/access" "Maccess/s"
 
+for expected in correctOutput/mips/*.txt; do
+    benchmark=$(basename "$expected" .txt)
+    trace=$(trace_of "$benchmark")
+    if [ -z "$trace" ]; then
+        if [ $benchmark = sample ]; then
+            echo "  sample: traces/sample.bz2 is missing"
+            status=1
+        else
+            echo "  $benchmark: no trace in traces/, skipped"
+        fi
+        continue
+    fi
+    for config in mips alpha; do
+        for reference in correctOutput correctOutput_with_next_line_prefetcher; do
+            options=${!config}
+            name="$benchmark $config"
+            if [ $reference = correctOutput_with_next_line_prefetcher ]; then
+                options="$options --prefetch"
+                name="$name prefetch"
+            fi
+            start=$(date +%s.%N)
+            output=$(./cache $options "$trace")
+            end=$(date +%s.%N)
+            accesses=$(echo "$output" | awk '/^Total Memory accesses:/ { print $4 }')
+            report "$name" "$accesses" "$start" "$end"
+            if ! changes=$(diff <(grep -v '^Student' "$reference/$config/$benchmark.txt") <(echo "$output")); then
+                echo "  $name: statistics differ from $reference/$config/$benchmark.txt"
+                echo "$changes" | sed 's/^/    /'
+                status=1
+            fi
+        done
+    done
+done
 
+for benchmark in art crafty_mem mcf swim; do
+    trace=traces/$benchmark.trace
+    if [ ! -f "$trace" ]; then
+        echo "  $benchmark: no trace in traces/, skipped"
+        continue
+    fi
+    baseline=$(./simple --simd=scalar "$trace")
+    for options in --simd=scalar "" --threads=4; do
+        start=$(date +%s.%N)
+        output=$(./simple $options "$trace")
+        end=$(date +%s.%N)
+        accesses=$(echo "$output" | awk '/TOTAL ACCESSES:/ { print $3 }')
+        report "simple $benchmark $options" "$accesses" "$start" "$end"
+        if [ "$output" != "$baseline" ]; then
+            echo "  simple $benchmark $options: statistics differ from the scalar serial run"
+            status=1
+        fi
+    done
+done
 
+exit $status
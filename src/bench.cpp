@@ -0,0 +1,375 @@
+//========================================================//
+//  bench.cpp                                             //
+//  Simulator throughput microbenchmarks                  //
+//                                                        //
+//  Times trace parsing and generation, the lookup of one //
+//  cache level per associativity and replacement policy, //
+//  and whole hierarchies on a synthetic trace            //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "cache.hpp"
+#include "trace.hpp"
+#include "parser.hpp"
+
+uint64_t accesses = 4000000;
+unsigned repeat = 3;
+const char *section = NULL;
+
+// Print out the Usage information to stderr
+//
+void
+usage()
+{
+  fprintf(stderr,"Usage: microbench [--accesses=n] [--repeat=n] [--only=parse|lookup|hierarchy]\n");
+  fprintf(stderr," --accesses=n     Accesses per benchmark (default 4000000)\n");
+  fprintf(stderr," --repeat=n       Runs per benchmark, the fastest is reported (default 3)\n");
+  fprintf(stderr," --only=section   Run one section of benchmarks\n");
+}
+
+//------------------------------------//
+//          Synthetic Trace           //
+//------------------------------------//
+
+// xorshift64, the trace is the same on every run and host
+static uint64_t
+next_random(uint64_t &s)
+{
+  s ^= s << 13;
+  s ^= s >> 7;
+  s ^= s << 17;
+  return s;
+}
+
+// Alternating instruction fetches and data accesses. Fetches run through a
+// 64KB text segment with a taken branch every 8 instructions or so; data
+// goes to a hot 8KB stack (60%), a 1MB array walked with a 40-byte stride
+// (30%) or anywhere in 16MB (10%). One data access in four is a store.
+//
+static std::vector<MemAccess>
+make_trace(uint64_t n)
+{
+  std::vector<MemAccess> trace(n);
+  uint64_t s = 0x9E3779B97F4A7C15ull;
+  uint64_t pc = 0x400000;
+  uint64_t walk = 0;
+  for (uint64_t i = 0; i < n; i++) {
+    MemAccess &a = trace[i];
+    uint64_t r = next_random(s);
+    if (i % 2 == 0) {
+      pc = r % 8 == 0 ? 0x400000 + (r >> 8) % 0x10000 / 4 * 4 : pc + 4;
+      a = MemAccess{pc, pc, false, false};
+      continue;
+    }
+    uint64_t addr;
+    uint64_t mix = (r >> 32) % 10;
+    if (mix < 6) {
+      addr = 0x7fff0000 + (r >> 8) % 8192 / 4 * 4;
+    } else if (mix < 9) {
+      walk = (walk + 40) % (1 << 20);
+      addr = 0x10000000 + walk;
+    } else {
+      addr = 0x20000000 + (r >> 8) % (16 << 20) / 4 * 4;
+    }
+    a = MemAccess{pc, addr, true, (r & 3) == 0};
+  }
+  return trace;
+}
+
+//------------------------------------//
+//              Timing                //
+//------------------------------------//
+
+static volatile uint64_t sink;
+
+static double
+now()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void
+print_header(const char *title)
+{
+  printf("\n%-36s %12s %12s %12s\n", title, "accesses", "ns/access", "Maccess/s");
+}
+
+// Print the fastest of the 'times' of 'n' accesses
+//
+static void
+print_result(const char *name, uint64_t n, const std::vector<double> &times)
+{
+  double best = times[0];
+  for (double t : times) {
+    best = t < best ? t : best;
+  }
+  printf("  %-34s %12lu %12.2f %12.2f\n", name, n, best * 1e9 / n, n / best / 1e6);
+  fflush(stdout);
+}
+
+//------------------------------------//
+//           Trace Parsing            //
+//------------------------------------//
+
+// Write 'trace' to a temporary file as text of 'dialect', or as a binary
+// trace when 'binary' is set
+//
+static std::string
+write_trace(const std::vector<MemAccess> &trace, TraceDialect dialect, bool binary)
+{
+  char path[] = "/tmp/microbenchXXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    fprintf(stderr,"Cannot create a temporary trace\n");
+    exit(1);
+  }
+  close(fd);
+  if (binary) {
+    BinaryTraceWriter out(path, dialect);
+    for (const MemAccess &a : trace) {
+      out.append(a);
+    }
+    out.finish();
+    return path;
+  }
+  FILE *out = fopen(path, "w");
+  for (const MemAccess &a : trace) {
+    if (dialect == TraceDialect::CSE240) {
+      fprintf(out, "0x%lx\t0x%lx\t%c\t%c\n", a.pc, a.addr, a.data ? 'D' : 'I', a.write ? 'W' : 'R');
+    } else {
+      fprintf(out, "# %d %lx %lu\n", a.write, a.addr, a.pc % 7 + 1);
+    }
+  }
+  fclose(out);
+  return path;
+}
+
+static void
+bench_parse(const std::vector<MemAccess> &trace)
+{
+  static const struct {
+    const char *name;
+    TraceDialect dialect;
+    bool binary;
+  } formats[] = {
+    { "text I/D",         TraceDialect::CSE240, false },
+    { "text simple",      TraceDialect::SIMPLE, false },
+    { "binary I/D",       TraceDialect::CSE240, true },
+  };
+
+  print_header("Trace parsing");
+  for (const auto &f : formats) {
+    std::string path = write_trace(trace, f.dialect, f.binary);
+    std::vector<double> times;
+    uint64_t n = 0;
+    for (unsigned r = 0; r < repeat; r++) {
+      double start = now();
+      TraceReader in(path.c_str());
+      MemAccess a;
+      uint64_t sum = 0;
+      n = 0;
+      while (in.next(a)) {
+        sum += a.addr;
+        n++;
+      }
+      sink = sum;
+      times.push_back(now() - start);
+    }
+    unlink(path.c_str());
+    print_result(f.name, n, times);
+  }
+
+  static const char *patterns[] = { "seq", "stride", "uniform", "zipf", "chase", "mixed" };
+  for (const char *pattern : patterns) {
+    char path[96], name[64];
+    snprintf(path, sizeof(path), "gen:%s,records=%lu,footprint=16M", pattern, accesses);
+    snprintf(name, sizeof(name), "generated %s", pattern);
+    std::vector<double> times;
+    for (unsigned r = 0; r < repeat; r++) {
+      double start = now();
+      TraceReader in(path);
+      MemAccess a;
+      uint64_t sum = 0;
+      while (in.next(a)) {
+        sum += a.addr;
+      }
+      sink = sum;
+      times.push_back(now() - start);
+    }
+    print_result(name, accesses, times);
+  }
+}
+
+//------------------------------------//
+//           Cache Lookups            //
+//------------------------------------//
+
+// One 32KB level with 64B blocks in front of memory, fed the data accesses
+//
+static void
+bench_lookup(const std::vector<MemAccess> &trace)
+{
+  static const ReplacePolicy policies[] = {
+    ReplacePolicy::LRU, ReplacePolicy::FIFO, ReplacePolicy::PLRU,
+    ReplacePolicy::NRU, ReplacePolicy::SRRIP, ReplacePolicy::BRRIP
+  };
+  static const uint32_t assocs[] = { 1, 2, 4, 8, 16 };
+
+  std::vector<uint32_t> addrs;
+  std::vector<uint8_t> writes;
+  for (const MemAccess &a : trace) {
+    if (a.data) {
+      addrs.push_back(a.addr);
+      writes.push_back(a.write);
+    }
+  }
+
+  print_header("cache_access(), 32KB 64B blocks");
+  for (ReplacePolicy policy : policies) {
+    for (uint32_t assoc : assocs) {
+      char name[64];
+      snprintf(name, sizeof(name), "%-6s %2u-way", policy_name(policy), assoc);
+      std::vector<double> times;
+      for (unsigned r = 0; r < repeat; r++) {
+        CacheBase *cache = make_cache(32768 / 64 / assoc, assoc, 64, 1, CacheType::L1_DCACHE, NULL, 100,
+                                      policy);
+        uint64_t sum = 0;
+        double start = now();
+        for (size_t i = 0; i < addrs.size(); i++) {
+          sum += cache->cache_access(addrs[i], writes[i]);
+        }
+        times.push_back(now() - start);
+        sink = sum;
+        delete cache;
+      }
+      print_result(name, addrs.size(), times);
+    }
+  }
+}
+
+//------------------------------------//
+//          Whole Hierarchies         //
+//------------------------------------//
+
+// A blocking 64B-block I$/D$/L2 hierarchy of 'l1' KB L1s and 'l2' KB L2
+//
+static CacheConfig
+bench_config(uint32_t l1, uint32_t l2, uint32_t blockSize, uint32_t l2HitTime)
+{
+  CacheConfig cfg = default_config();
+  cfg.icacheSets = l1 * 1024 / blockSize / 2;
+  cfg.icacheAssoc = 2;
+  cfg.icacheBlocksize = blockSize;
+  cfg.icacheHitTime = 2;
+  cfg.dcacheSets = l1 * 1024 / blockSize / 4;
+  cfg.dcacheAssoc = 4;
+  cfg.dcacheBlocksize = blockSize;
+  cfg.dcacheHitTime = 2;
+  cfg.l2cacheSets = l2 * 1024 / blockSize / 8;
+  cfg.l2cacheAssoc = 8;
+  cfg.l2cacheBlocksize = blockSize;
+  cfg.l2cacheHitTime = l2HitTime;
+  cfg.memspeed = 100;
+  return cfg;
+}
+
+static void
+bench_hierarchy(const std::vector<MemAccess> &trace)
+{
+  CacheConfig mips = bench_config(32, 128, 128, 50);
+  CacheConfig alpha = bench_config(64, 8192, 64, 50);
+  CacheConfig nextline = alpha;
+  nextline.prefetch = TRUE;
+  CacheConfig detailed = alpha;
+  detailed.prefetch = TRUE;
+  detailed.prefetchPolicy = PrefetchPolicy::STRIDE;
+  detailed.prefetchDegree = 2;
+  detailed.prefetchDistance = 4;
+  detailed.prefetchQueue = 8;
+  detailed.icacheMshrs = detailed.dcacheMshrs = detailed.l2cacheMshrs = 8;
+  CacheConfig classified = alpha;
+  classified.classifyMisses = TRUE;
+  CacheConfig sampledClasses = classified;
+  sampledClasses.classifySampled = TRUE;
+
+  static const struct {
+    const char *name;
+    const CacheConfig *cfg;
+  } hierarchies[] = {
+    { "MIPS R10K",                    &mips },
+    { "Alpha 21264",                  &alpha },
+    { "Alpha 21264, next line",       &nextline },
+    { "Alpha 21264, stride+queue+MSHR", &detailed },
+    { "Alpha 21264, 3C",              &classified },
+    { "Alpha 21264, sampled 3C",      &sampledClasses },
+  };
+
+  print_header("CacheHierarchy::access()");
+  for (const auto &h : hierarchies) {
+    std::vector<double> times;
+    for (unsigned r = 0; r < repeat; r++) {
+      CacheHierarchy hierarchy(*h.cfg);
+      uint64_t sum = 0;
+      double start = now();
+      for (const MemAccess &a : trace) {
+        sum += hierarchy.access(a.pc, a.addr, a.data ? 'D' : 'I', a.write ? 'W' : 'R');
+      }
+      times.push_back(now() - start);
+      sink = sum;
+    }
+    print_result(h.name, trace.size(), times);
+  }
+
+  // the same trace handed over BATCH accesses at a time
+  static const size_t BATCH = 4096;
+  print_header("CacheHierarchy::access_batch()");
+  for (const auto &h : hierarchies) {
+    std::vector<double> times;
+    for (unsigned r = 0; r < repeat; r++) {
+      CacheHierarchy hierarchy(*h.cfg);
+      uint64_t sum = 0;
+      double start = now();
+      for (size_t i = 0; i < trace.size(); i += BATCH) {
+        sum += hierarchy.access_batch(std::span<const MemAccess>(trace).subspan(i, std::min(BATCH, trace.size() - i)));
+      }
+      times.push_back(now() - start);
+      sink = sum;
+    }
+    print_result(h.name, trace.size(), times);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i],"--accesses=",11) && sscanf(argv[i]+11,"%lu", &accesses) == 1 && accesses) {
+    } else if (!strncmp(argv[i],"--repeat=",9) && sscanf(argv[i]+9,"%u", &repeat) == 1 && repeat) {
+    } else if (!strncmp(argv[i],"--only=",7)) {
+      section = argv[i]+7;
+    } else {
+      usage();
+      exit(!!strcmp(argv[i],"--help"));
+    }
+  }
+
+  std::vector<MemAccess> trace = make_trace(accesses);
+  printf("Synthetic trace of %lu accesses, fastest of %u runs\n", accesses, repeat);
+  if (!section || !strcmp(section,"parse")) {
+    bench_parse(trace);
+  }
+  if (!section || !strcmp(section,"lookup")) {
+    bench_lookup(trace);
+  }
+  if (!section || !strcmp(section,"hierarchy")) {
+    bench_hierarchy(trace);
+  }
+
+  return 0;
+}
@@ -7,145 +7,1685 @@
 //========================================================//
 
 #include "cache.hpp"
+#include "prefetch.hpp"
+#include "stages.hpp"
+#include "checkpoint.hpp"
+#include "miss_stream.hpp"
+#include <stdio.h>
+#include <strings.h>
 #include <string>
 #include <math.h>
+#include <bit>
+#include <typeinfo>
 using namespace std;
 
+//------------------------------------//
+//          Cache Functions           //
+//------------------------------------//
+
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+CacheKernel<Assoc, BlockBits, Policy>::CacheKernel(uint32_t sets, uint32_t assoc, uint32_t blockSize,
+                                                   uint32_t hitTime, CacheType type,
+                                                   CacheBase *next, uint32_t memspeed)
+  : tags((size_t)sets * assoc, 0), valid(sets, 0), unused(sets, 0), dirty(sets, 0), clock(0), next(next),
+    memspeed(memspeed), victimsDown(false), exclusive(false)
+{
+  if (!has_single_bit(sets) || !has_single_bit(blockSize) || assoc == 0 || assoc > 64) {
+    fprintf(stderr,"Cache sets and blocksize must be powers of two, assoc between 1 and 64\n");
+    exit(1);
+  }
+  if (Policy == ReplacePolicy::PLRU && !has_single_bit(assoc)) {
+    fprintf(stderr,"Tree-PLRU needs a power of two assoc\n");
+    exit(1);
+  }
+  this->sets = sets;
+  this->assoc = assoc;
+  this->blockSize = blockSize;
+  this->hitTime = hitTime;
+  this->type = type;
+  blockBits = countr_zero(blockSize);
+  setMask = sets - 1;
+  wayMask = ~0ull >> (64 - assoc);
+
+  // replacement state, only the policy's own is allocated
+  if (Policy == ReplacePolicy::LRU) {
+    stamps.assign((size_t)sets * assoc, 0);
+  } else if (Policy == ReplacePolicy::SRRIP || Policy == ReplacePolicy::BRRIP) {
+    rrpv.assign((size_t)sets * assoc, RRPV_DISTANT);
+  } else {
+    state.assign(sets, 0);
+  }
+  evicted.assign(POLLUTION_FILTER, 0);
+
+  // statistics
+  refs = 0;
+  misses = 0;
+  penalties = 0;
+  compulsory_miss = 0;
+  other_miss = 0;
+  prefetches = 0;
+  prefetchHits = 0;
+  uselessPrefetches = 0;
+  pollution = 0;
+  fetches = 0;
+  writebacks = 0;
+  backInvalidations = 0;
+  handedDirty = false;
+  writeThrough = false;
+  coherent = false;
+}
+
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+int
+CacheKernel<Assoc, BlockBits, Policy>::lookup(uint32_t block) const
+{
+  uint32_t set = set_of(block);
+  const uint32_t *t = &tags[(size_t)set * ways()];
+  // Compare every way and branch once
+  uint64_t match = 0;
+  for (uint32_t i = 0; i < ways(); i++) {
+    match |= (uint64_t)(t[i] == block) << i;
+  }
+  match &= valid[set];
+  return match ? countr_zero(match) : -1;
+}
+
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+void
+CacheKernel<Assoc, BlockBits, Policy>::touch(uint32_t set, uint32_t way)
+{
+  size_t base = (size_t)set * ways();
+  if constexpr (Policy == ReplacePolicy::LRU) {
+    stamps[base + way] = ++clock;
+  } else if constexpr (Policy == ReplacePolicy::PLRU) {
+    // point every node on the path away from 'way', node n has children
+    // 2n and 2n+1 and the leaves are ways() .. 2*ways()-1
+    uint64_t bits = state[set];
+    for (uint32_t node = way + ways(); node > 1; node >>= 1) {
+      uint32_t parent = node >> 1;
+      bits = (bits & ~(1ull << parent)) | (uint64_t)(~node & 1) << parent;
+    }
+    state[set] = bits;
+  } else if constexpr (Policy == ReplacePolicy::NRU) {
+    uint64_t ref = state[set] | 1ull << way;
+    state[set] = ref == wayMask ? 1ull << way : ref;
+  } else if constexpr (Policy == ReplacePolicy::SRRIP || Policy == ReplacePolicy::BRRIP) {
+    rrpv[base + way] = 0;
+  }
+}
 
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+uint32_t
+CacheKernel<Assoc, BlockBits, Policy>::victim(uint32_t set)
+{
+  uint64_t invalid = ~valid[set] & wayMask;
+  if (invalid) {
+    return countr_zero(invalid);
+  }
+
+  size_t base = (size_t)set * ways();
+  if constexpr (Policy == ReplacePolicy::LRU) {
+    const uint64_t *s = &stamps[base];
+    uint32_t way = 0;
+    uint64_t oldest = s[0];
+    for (uint32_t i = 1; i < ways(); i++) {
+      way = s[i] < oldest ? i : way;
+      oldest = s[i] < oldest ? s[i] : oldest;
+    }
+    return way;
+  } else if constexpr (Policy == ReplacePolicy::FIFO) {
+    return state[set];
+  } else if constexpr (Policy == ReplacePolicy::PLRU) {
+    uint32_t node = 1;
+    while (node < ways()) {
+      node = 2 * node + (state[set] >> node & 1);
+    }
+    return node - ways();
+  } else if constexpr (Policy == ReplacePolicy::NRU) {
+    // a direct-mapped set always has its one way referenced
+    uint64_t unreferenced = ~state[set] & wayMask;
+    return unreferenced ? countr_zero(unreferenced) : 0;
+  } else {
+    // age the whole set until some way predicts a distant re-reference
+    uint8_t *r = &rrpv[base];
+    uint8_t oldest = 0;
+    for (uint32_t i = 0; i < ways(); i++) {
+      oldest = r[i] > oldest ? r[i] : oldest;
+    }
+    uint8_t age = RRPV_DISTANT - oldest;
+    uint32_t way = ways();
+    for (uint32_t i = 0; i < ways(); i++) {
+      r[i] += age;
+      way = r[i] == RRPV_DISTANT && way == ways() ? i : way;
+    }
+    return way;
+  }
+}
+
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+void
+CacheKernel<Assoc, BlockBits, Policy>::fill(uint32_t set, uint32_t way, uint32_t block, bool prefetch, bool dirty)
+{
+  size_t base = (size_t)set * ways();
+  bool replaced = valid[set] >> way & 1;
+  if (replaced) {
+    uselessPrefetches += unused[set] >> way & 1;
+    if (prefetch) {
+      uint32_t old = tags[base + way];
+      evicted[old % POLLUTION_FILTER] = (uint64_t)old << 1 | 1;
+    }
+    evict(set, way);
+  }
+  tags[base + way] = block;
+  valid[set] |= 1ull << way;
+  unused[set] = (unused[set] & ~(1ull << way)) | (uint64_t)prefetch << way;
+  this->dirty[set] = (this->dirty[set] & ~(1ull << way)) | (uint64_t)dirty << way;
+
+  if constexpr (Policy == ReplacePolicy::FIFO) {
+    // fills go to the lowest invalid way until the set is full, so the
+    // pointer only moves once lines are being replaced
+    if (replaced) {
+      state[set] = (way + 1) % ways();
+    }
+  } else if constexpr (Policy == ReplacePolicy::SRRIP) {
+    rrpv[base + way] = RRPV_LONG;
+  } else if constexpr (Policy == ReplacePolicy::BRRIP) {
+    rrpv[base + way] = ++clock % BRRIP_THROTTLE ? RRPV_DISTANT : RRPV_LONG;
+  } else {
+    touch(set, way);
+  }
+}
 
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+void
+CacheKernel<Assoc, BlockBits, Policy>::evict(uint32_t set, uint32_t way)
+{
+  uint32_t addr = tags[(size_t)set * ways() + way] << (BlockBits ? BlockBits : blockBits);
+  bool wasDirty = dirty[set] >> way & 1;
+  // an inclusive cache cannot keep copies above a line it drops
+  for (CacheBase *a : above) {
+    backInvalidations += a->cache_invalidate(addr, blockSize, wasDirty);
+  }
+  if (wasDirty) {
+    writebacks++;
+  }
+  if (next && (wasDirty || victimsDown)) {
+    next->cache_writeback(addr, wasDirty);
+  }
+}
+
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+void
+CacheKernel<Assoc, BlockBits, Policy>::hand_up(uint32_t set, uint32_t way)
+{
+  uint64_t bit = 1ull << way;
+  handedDirty = dirty[set] & bit;
+  valid[set] &= ~bit;
+  unused[set] &= ~bit;
+  dirty[set] &= ~bit;
+}
 
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+void
+CacheKernel<Assoc, BlockBits, Policy>::write_through(uint32_t addr)
+{
+  writebacks++;
+  if (next) {
+    next->cache_write(addr);
+  }
+}
+
+// Pick the victim way for 'addr': an invalid way if there is one,
+// otherwise the one the replacement policy names
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+uint8_t
+CacheKernel<Assoc, BlockBits, Policy>::cache_replace(uint32_t addr)
+{
+  return victim(set_of(block_of(addr)));
+}
+
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+void
+CacheKernel<Assoc, BlockBits, Policy>::count_miss(uint32_t set, uint32_t block)
+{
+  // A miss into a set that holds nothing yet is compulsory
+  misses++;
+  if (!valid[set]) {
+    compulsory_miss++;
+  } else {
+    other_miss++;
+  }
+  uint64_t &slot = evicted[block % POLLUTION_FILTER];
+  if (slot == ((uint64_t)block << 1 | 1)) {
+    pollution++;
+    slot = 0;
+  }
+}
+
+// Perform a memory access for the address 'addr'
+// Return the access time for the memory operation
+//
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+uint32_t
+CacheKernel<Assoc, BlockBits, Policy>::cache_access(uint32_t addr, bool write)
+{
+  uint32_t block = block_of(addr);
+  uint32_t set = set_of(block);
+  refs++;
+
+  int way = lookup(block);
+  if (classifier) {
+    classifier->access(block, way < 0);
+  }
+  if (way >= 0) {
+    touch(set, way);
+    if (unused[set] >> way & 1) {
+      unused[set] &= ~(1ull << way);
+      prefetchHits++;
+    }
+    if (exclusive) {
+      // the way is free now, the level above takes the line
+      hand_up(set, way);
+    } else if (write && writeThrough) {
+      write_through(addr);
+    } else {
+      if (write && coherent && !(dirty[set] >> way & 1)) {
+        // other L1s may share a clean line
+        next->cache_upgrade(addr);
+      }
+      dirty[set] |= (uint64_t)write << way;
+    }
+    return hitTime;
+  }
+
+  count_miss(set, block);
+  if (write && writeThrough) {
+    // no write-allocate, the store goes on down without waiting
+    write_through(addr);
+    return hitTime;
+  }
+  fetches++;
+  uint32_t penalty = next ? next->cache_access(addr, false) : memspeed;
+  penalties += penalty;
+  if (exclusive) {
+    // the line goes straight up
+    handedDirty = false;
+  } else {
+    fill(set, victim(set), block, false, write || (victimsDown && next->take_dirty()));
+    if (write && coherent) {
+      next->cache_upgrade(addr);
+    }
+  }
+  return hitTime + penalty;
+}
+
+// The same access with the misses kept in the MSHRs. The block is placed
+// at once, as in cache_access(), so hits and misses come out the same; a
+// hit on a block whose miss is still outstanding is a secondary miss that
+// waits for the data, or for the whole fill when its MSHR has no target
+// left.
+//
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+uint32_t
+CacheKernel<Assoc, BlockBits, Policy>::cache_access_nb(uint32_t addr, bool write, uint64_t now, bool wait,
+                                                       uint64_t &ready)
+{
+  uint32_t block = block_of(addr);
+  uint32_t set = set_of(block);
+  uint64_t start = now;
+  refs++;
+  mshrs.retire(now);
+
+  int way = lookup(block);
+  if (classifier) {
+    classifier->access(block, way < 0);
+  }
+  if (way >= 0) {
+    touch(set, way);
+    if (unused[set] >> way & 1) {
+      unused[set] &= ~(1ull << way);
+      prefetchHits++;
+    }
+    if (exclusive) {
+      hand_up(set, way);
+    } else if (write && writeThrough) {
+      write_through(addr);
+    } else {
+      if (write && coherent && !(dirty[set] >> way & 1)) {
+        // other L1s may share a clean line
+        next->cache_upgrade(addr);
+      }
+      dirty[set] |= (uint64_t)write << way;
+    }
+    ready = now + hitTime;
+    MshrFile::Entry *e = mshrs.find(block);
+    if (!e) {
+      return hitTime;
+    }
+    if (!mshrs.merge(*e)) {
+      // wait for the fill, then hit
+      now = e->ready;
+      ready = now + hitTime;
+    } else if (e->ready > ready) {
+      ready = e->ready;
+    }
+  } else if (write && writeThrough) {
+    count_miss(set, block);
+    write_through(addr);
+    ready = now + hitTime;
+  } else {
+    count_miss(set, block);
+    fetches++;
+    now = mshrs.free_at(now);
+    mshrs.retire(now);
+    uint64_t below;
+    uint32_t latency = next ? next->cache_access_nb(addr, false, now + hitTime, true, below) : memspeed;
+    ready = now + hitTime + latency;
+    mshrs.allocate(block, ready);
+    if (exclusive) {
+      handedDirty = false;
+    } else {
+      fill(set, victim(set), block, false, write || (victimsDown && next->take_dirty()));
+      if (write && coherent) {
+        next->cache_upgrade(addr);
+      }
+    }
+  }
+
+  uint32_t access = wait ? ready - start : now - start + hitTime;
+  penalties += access - hitTime;
+  return access;
+}
+
+// Next line prefetching
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+uint32_t
+CacheKernel<Assoc, BlockBits, Policy>::cache_prefetch_addr(uint32_t pc, uint32_t addr, bool rw)
+{
+  return addr + blockSize;
+}
+
+// Bring the block at 'addr' into this cache and the levels below it
+// without touching any statistics
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+void
+CacheKernel<Assoc, BlockBits, Policy>::cache_prefetch(uint32_t addr, PrefetchPolicy policy)
+{
+  uint32_t block = block_of(addr);
+  uint32_t set = set_of(block);
+  int way = lookup(block);
+  if (exclusive) {
+    // an exclusive cache only passes the line up
+    if (way >= 0) {
+      hand_up(set, way);
+    } else {
+      handedDirty = false;
+      fetches++;
+    }
+    return;
+  }
+  if (way >= 0) {
+    return;
+  }
+  if (next) {
+    next->cache_prefetch(addr, policy);
+  }
+  fetches++;
+  fill(set, victim(set), block, true, victimsDown && next->take_dirty());
+  prefetches++;
+}
+
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+bool
+CacheKernel<Assoc, BlockBits, Policy>::cache_probe(uint32_t addr) const
+{
+  return lookup(block_of(addr)) >= 0;
+}
+
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+void
+CacheKernel<Assoc, BlockBits, Policy>::cache_install(uint32_t addr, bool dirty)
+{
+  uint32_t block = block_of(addr);
+  if (lookup(block) >= 0) {
+    return;
+  }
+  uint32_t set = set_of(block);
+  fetches++;
+  fill(set, victim(set), block, true, dirty);
+  prefetches++;
+}
+
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+void
+CacheKernel<Assoc, BlockBits, Policy>::cache_writeback(uint32_t addr, bool dirty)
+{
+  uint32_t block = block_of(addr);
+  uint32_t set = set_of(block);
+  int way = lookup(block);
+  if (way >= 0) {
+    this->dirty[set] |= (uint64_t)dirty << way;
+  } else if (exclusive) {
+    fill(set, victim(set), block, false, dirty);
+  } else if (dirty) {
+    // no allocation for writebacks, the line goes on down
+    writebacks++;
+    if (next) {
+      next->cache_writeback(addr, true);
+    }
+  }
+}
+
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+void
+CacheKernel<Assoc, BlockBits, Policy>::cache_write(uint32_t addr)
+{
+  uint32_t block = block_of(addr);
+  int way = lookup(block);
+  if (way >= 0 && !writeThrough) {
+    dirty[set_of(block)] |= 1ull << way;
+  } else {
+    write_through(addr);
+  }
+}
+
+// Run one miss stream event on 'cache'. With a kernel, whose type is
+// final, it calls the kernel's own code without the vtable.
+//
+template <class Cache>
+static inline void
+replay_event(Cache *cache, const MissRecord &e, uint64_t &ilatency, uint64_t &dlatency)
+{
+  switch (e.event) {
+  case MissEvent::IREAD:
+    ilatency += cache->cache_access(e.addr, false);
+    break;
+  case MissEvent::DREAD:
+    dlatency += cache->cache_access(e.addr, false);
+    break;
+  case MissEvent::WRITEBACK:
+  case MissEvent::DIRTY_WRITEBACK:
+    cache->cache_writeback(e.addr, e.event == MissEvent::DIRTY_WRITEBACK);
+    break;
+  case MissEvent::WRITE:
+    cache->cache_write(e.addr);
+    break;
+  case MissEvent::PREFETCH:
+    cache->cache_prefetch(e.addr, PrefetchPolicy::NEXT_LINE);
+    break;
+  }
+}
+
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+void
+CacheKernel<Assoc, BlockBits, Policy>::cache_replay(const MissRecord *run, size_t n, uint64_t &ilatency,
+                                                    uint64_t &dlatency)
+{
+  for (size_t i = 0; i < n; i++) {
+    replay_event(this, run[i], ilatency, dlatency);
+  }
+}
+
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+void
+CacheKernel<Assoc, BlockBits, Policy>::cache_warm(uint32_t addr, bool write)
+{
+  uint32_t block = block_of(addr);
+  uint32_t set = set_of(block);
+  int way = lookup(block);
+  bool store = write && !writeThrough;
+  if (classifier) {
+    classifier->access(block, way < 0, false);
+  }
+  if (way >= 0) {
+    touch(set, way);
+    if (exclusive) {
+      hand_up(set, way);
+    } else {
+      dirty[set] |= (uint64_t)store << way;
+    }
+    return;
+  }
+  if (write && writeThrough) {
+    return;
+  }
+  if (next) {
+    next->cache_warm(addr, false);
+  }
+  if (exclusive) {
+    handedDirty = false;
+  } else {
+    fill(set, victim(set), block, false, store || (victimsDown && next->take_dirty()));
+  }
+}
+
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+void
+CacheKernel<Assoc, BlockBits, Policy>::save_state(CheckpointWriter &out) const
+{
+  CacheBase::save_state(out);
+  out.put(tags);
+  out.put(valid);
+  out.put(unused);
+  out.put(dirty);
+  out.put(stamps);
+  out.put(rrpv);
+  out.put(state);
+  out.put(evicted);
+  out.put(clock);
+}
+
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+void
+CacheKernel<Assoc, BlockBits, Policy>::load_state(CheckpointReader &in)
+{
+  CacheBase::load_state(in);
+  in.get(tags);
+  in.get(valid);
+  in.get(unused);
+  in.get(dirty);
+  in.get(stamps);
+  in.get(rrpv);
+  in.get(state);
+  in.get(evicted);
+  in.get(clock);
+}
+
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+bool
+CacheKernel<Assoc, BlockBits, Policy>::cache_clean(uint32_t addr)
+{
+  uint32_t block = block_of(addr);
+  int way = lookup(block);
+  if (way < 0 || !(dirty[set_of(block)] >> way & 1)) {
+    return false;
+  }
+  dirty[set_of(block)] &= ~(1ull << way);
+  writebacks++;
+  return true;
+}
+
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+uint32_t
+CacheKernel<Assoc, BlockBits, Policy>::cache_invalidate(uint32_t addr, uint32_t bytes, bool &dirty)
+{
+  uint32_t lines = bytes > blockSize ? bytes / blockSize : 1;
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < lines; i++) {
+    uint32_t block = block_of(addr) + i;
+    int way = lookup(block);
+    if (way >= 0) {
+      uint32_t set = set_of(block);
+      uint64_t bit = 1ull << way;
+      dirty |= (this->dirty[set] & bit) != 0;
+      valid[set] &= ~bit;
+      unused[set] &= ~bit;
+      this->dirty[set] &= ~bit;
+      n++;
+    }
+  }
+  return n;
+}
+
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+void
+CacheKernel<Assoc, BlockBits, Policy>::set_inclusion(InclusionPolicy policy, const vector<CacheBase *> &above)
+{
+  if (!above.empty()) {
+    exclusive = policy == InclusionPolicy::EXCLUSIVE;
+    if (policy == InclusionPolicy::INCLUSIVE) {
+      this->above = above;
+    }
+  }
+  // the level below is set up first
+  victimsDown = next && next->takes_victims();
+}
 
 //------------------------------------//
-//        Cache Data Structures       //
+//               MSHRs                //
 //------------------------------------//
 
+void
+MshrFile::resize(uint32_t entries, uint32_t targets)
+{
+  this->entries = entries;
+  this->targets = targets;
+  pending.clear();
+  pending.reserve(entries);
+}
+
+void
+MshrFile::retire(uint64_t now)
+{
+  for (size_t i = 0; i < pending.size();) {
+    if (pending[i].ready <= now) {
+      pending[i] = pending.back();
+      pending.pop_back();
+    } else {
+      i++;
+    }
+  }
+}
+
+MshrFile::Entry *
+MshrFile::find(uint32_t block)
+{
+  for (Entry &e : pending) {
+    if (e.block == block) {
+      return &e;
+    }
+  }
+  return NULL;
+}
 
+bool
+MshrFile::merge(Entry &e)
+{
+  if (e.targets == targets) {
+    counts.targetStalls++;
+    return false;
+  }
+  e.targets++;
+  counts.merged++;
+  return true;
+}
 
+uint64_t
+MshrFile::free_at(uint64_t now)
+{
+  if (pending.size() < entries) {
+    return now;
+  }
+  uint64_t first = pending[0].ready;
+  for (const Entry &e : pending) {
+    first = e.ready < first ? e.ready : first;
+  }
+  counts.fullStalls++;
+  counts.stallCycles += first - now;
+  return first;
+}
+
+void
+MshrFile::allocate(uint32_t block, uint64_t ready)
+{
+  pending.push_back(Entry{block, 1, ready});
+}
+
+void
+MshrFile::save_state(CheckpointWriter &out) const
+{
+  out.put(pending);
+  out.put(counts);
+}
+
+void
+MshrFile::load_state(CheckpointReader &in)
+{
+  in.get(pending);
+  in.get(counts);
+}
+
+void
+CacheBase::cache_replay(const MissRecord *run, size_t n, uint64_t &ilatency, uint64_t &dlatency)
+{
+  for (size_t i = 0; i < n; i++) {
+    replay_event(this, run[i], ilatency, dlatency);
+  }
+}
 
 //------------------------------------//
-//          Cache Functions           //
+//            Checkpoints             //
+//------------------------------------//
+
+void
+CacheBase::save_state(CheckpointWriter &out) const
+{
+  for (uint64_t v : {refs, misses, penalties, compulsory_miss, other_miss, prefetches, prefetchHits,
+                     uselessPrefetches, pollution, fetches, writebacks, backInvalidations}) {
+    out.put(v);
+  }
+  out.put(handedDirty);
+  mshrs.save_state(out);
+  if (classifier) {
+    classifier->save_state(out);
+  }
+}
+
+void
+CacheBase::load_state(CheckpointReader &in)
+{
+  for (uint64_t *v : {&refs, &misses, &penalties, &compulsory_miss, &other_miss, &prefetches, &prefetchHits,
+                      &uselessPrefetches, &pollution, &fetches, &writebacks, &backInvalidations}) {
+    in.get(*v);
+  }
+  in.get(handedDirty);
+  mshrs.load_state(in);
+  if (classifier) {
+    classifier->load_state(in);
+  }
+}
+
+void
+CacheBase::classify_misses(bool sampled)
+{
+  classifier = make_unique<MissClassifier>(sets, assoc, countr_zero(blockSize), sampled);
+}
+
+//------------------------------------//
+//        Miss Classification         //
 //------------------------------------//
 
+MissClassifier::MissClassifier(uint32_t sets, uint32_t assoc, uint32_t blockBits, bool sampleSets)
+  : head(NONE), tail(NONE), used(0), setMask(sets - 1), sampleShift(0), misses(0), counts{}
+{
+  uint32_t topBits = blockBits + CHUNK_BITS < 32 ? 32 - blockBits - CHUNK_BITS : 0;
+  seen.resize((size_t)1 << topBits);
+  while (sampleSets && ((uint64_t)sets * assoc) >> sampleShift > SHADOW_LINES &&
+         sets >> (sampleShift + 1) >= SAMPLED_SETS) {
+    sampleShift++;
+  }
+  uint32_t lines = 0;
+  for (uint32_t set = 0; set < sets; set++) {
+    lines += sampled(set) ? assoc : 0;
+  }
+  nodes.resize(lines);
+  // at most half full, the probes stay short
+  uint32_t size = bit_ceil(2 * lines);
+  table.assign(size, Slot{0, NONE});
+  mask = size - 1;
+  hashShift = 32 - countr_zero(size);
+}
 
+void
+MissClassifier::access(uint32_t block, bool miss, bool count)
+{
+  bool counted = miss && count;
+  misses += counted;
+  bool first = first_touch(block);
+  if (first) {
+    counts.compulsory += counted;
+  }
+  if (!sampled(block)) {
+    return;
+  }
+  bool hit = shadow_access(block);
+  if (!counted || first) {
+    return;
+  }
+  if (hit) {
+    counts.conflict++;
+  } else {
+    counts.capacity++;
+  }
+}
 
-// Initialize the Cache Hierarchy
+// The sampled sets' split of the other misses applied to all of them, which
+// is exact when every set is sampled. Without a sampled miss to go by they
+// count as capacity misses.
 //
-void init_cache()
+MissClassStats
+MissClassifier::stats() const
 {
-  // Initialize cache stats
-  icacheRefs = 0;
-  icacheMisses = 0;
-  icachePenalties = 0;
-  dcacheRefs = 0;
-  dcacheMisses = 0;
-  dcachePenalties = 0;
-  l2cacheRefs = 0;
-  l2cacheMisses = 0;
-  l2cachePenalties = 0;
+  uint64_t rest = misses - counts.compulsory;
+  uint64_t sampledRest = counts.capacity + counts.conflict;
+  if (sampledRest == rest) {
+    return counts;
+  }
+  MissClassStats s = {};
+  s.compulsory = counts.compulsory;
+  if (sampledRest) {
+    s.conflict = llround((double)rest * counts.conflict / sampledRest);
+  }
+  s.capacity = rest - s.conflict;
+  return s;
+}
 
-  compulsory_miss = 0;
-  other_miss = 0;
-  prefetch = false;
+bool
+MissClassifier::first_touch(uint32_t block)
+{
+  vector<uint64_t> &chunk = seen[block >> CHUNK_BITS];
+  if (chunk.empty()) {
+    chunk.assign((1u << CHUNK_BITS) / 64, 0);
+  }
+  uint32_t bit = block & ((1u << CHUNK_BITS) - 1);
+  uint64_t &word = chunk[bit / 64];
+  uint64_t m = 1ull << (bit % 64);
+  bool first = !(word & m);
+  word |= m;
+  return first;
+}
+
+bool
+MissClassifier::shadow_access(uint32_t block)
+{
+  // runs of accesses to one line skip the table
+  if (head != NONE && nodes[head].block == block) {
+    return true;
+  }
+  for (uint32_t i = home(block); table[i].node != NONE; i = (i + 1) & mask) {
+    if (table[i].block == block) {
+      uint32_t n = table[i].node;
+      unlink(n);
+      push_front(n);
+      return true;
+    }
+  }
 
+  uint32_t n;
+  if (used < nodes.size()) {
+    n = used++;
+  } else {
+    // the least recent line makes room
+    n = tail;
+    uint32_t i = home(nodes[n].block);
+    while (table[i].node != n) {
+      i = (i + 1) & mask;
+    }
+    erase(i);
+    unlink(n);
+  }
+  nodes[n].block = block;
+  push_front(n);
+  uint32_t i = home(block);
+  while (table[i].node != NONE) {
+    i = (i + 1) & mask;
+  }
+  table[i] = Slot{block, n};
+  return false;
 }
 
-// Clean Up the Cache Hierarchy
+// Backward-shift deletion: every entry of the probe run after the hole
+// whose home does not lie between the hole and itself moves into it
 //
-void clean_cache()
+void
+MissClassifier::erase(uint32_t i)
 {
+  for (uint32_t j = (i + 1) & mask; table[j].node != NONE; j = (j + 1) & mask) {
+    if (((j - home(table[j].block)) & mask) >= ((j - i) & mask)) {
+      table[i] = table[j];
+      i = j;
+    }
+  }
+  table[i].node = NONE;
 }
 
-// Perform a memory access through the icache interface for the address 'addr'
-// Return the access time for the memory operation
+void
+MissClassifier::unlink(uint32_t n)
+{
+  Node &e = nodes[n];
+  if (e.prev != NONE) {
+    nodes[e.prev].next = e.next;
+  } else {
+    head = e.next;
+  }
+  if (e.next != NONE) {
+    nodes[e.next].prev = e.prev;
+  } else {
+    tail = e.prev;
+  }
+}
+
+void
+MissClassifier::push_front(uint32_t n)
+{
+  nodes[n].prev = NONE;
+  nodes[n].next = head;
+  if (head != NONE) {
+    nodes[head].prev = n;
+  } else {
+    tail = n;
+  }
+  head = n;
+}
+
+// Only the first-touch chunks in use are saved, with their index
 //
-uint32_t
-icache_access(uint32_t addr)
+void
+MissClassifier::save_state(CheckpointWriter &out) const
 {
+  uint64_t chunks = 0;
+  for (const vector<uint64_t> &c : seen) {
+    chunks += !c.empty();
+  }
+  out.put(chunks);
+  for (size_t i = 0; i < seen.size(); i++) {
+    if (!seen[i].empty()) {
+      out.put((uint64_t)i);
+      out.put(seen[i]);
+    }
+  }
+  out.put(table);
+  out.put(nodes);
+  out.put(head);
+  out.put(tail);
+  out.put(used);
+  out.put(misses);
+  out.put(counts);
+}
 
+void
+MissClassifier::load_state(CheckpointReader &in)
+{
+  uint64_t chunks, i;
+  in.get(chunks);
+  for (uint64_t k = 0; k < chunks; k++) {
+    in.get(i);
+    if (i >= seen.size()) {
+      fprintf(stderr,"Checkpoint holds a block outside the address space\n");
+      exit(1);
+    }
+    in.get(seen[i]);
+  }
+  in.get(table);
+  in.get(nodes);
+  in.get(head);
+  in.get(tail);
+  in.get(used);
+  in.get(misses);
+  in.get(counts);
 }
 
-// Perform a memory access through the dcache interface for the address 'addr'
-// Return the access time for the memory operation
+//------------------------------------//
+//          Kernel Dispatch           //
+//------------------------------------//
+
+typedef CacheBase *(*CacheFactory)(uint32_t sets, uint32_t assoc, uint32_t blockSize, uint32_t hitTime,
+                                   CacheType type, CacheBase *next, uint32_t memspeed);
+
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+CacheBase *
+new_kernel(uint32_t sets, uint32_t assoc, uint32_t blockSize, uint32_t hitTime, CacheType type,
+           CacheBase *next, uint32_t memspeed)
+{
+  return new CacheKernel<Assoc, BlockBits, Policy>(sets, assoc, blockSize, hitTime, type, next, memspeed);
+}
+
+// The shapes with a specialized kernel, everything else runs generic.
+// X(assoc, blockBits, policy) is expanded for each.
+#define KERNEL_SHAPES(X, P) \
+  X( 2, 6, P), X( 4, 6, P), X( 8, 6, P), X(16, 6, P), \
+  X( 2, 7, P), X( 4, 7, P), X( 8, 7, P), X(16, 7, P), \
+  X( 0, 0, P)
+#define KERNEL_FACTORY(A, B, P) { A, A ? 1u << B : 0, P, new_kernel<A, B, P> }
+
+static const struct
+{
+  uint32_t assoc;     // 0 matches any shape
+  uint32_t blockSize;
+  ReplacePolicy policy;
+  CacheFactory make;
+} kernels[] = {
+  KERNEL_SHAPES(KERNEL_FACTORY, ReplacePolicy::LRU),
+  KERNEL_SHAPES(KERNEL_FACTORY, ReplacePolicy::FIFO),
+  KERNEL_SHAPES(KERNEL_FACTORY, ReplacePolicy::PLRU),
+  KERNEL_SHAPES(KERNEL_FACTORY, ReplacePolicy::NRU),
+  KERNEL_SHAPES(KERNEL_FACTORY, ReplacePolicy::SRRIP),
+  KERNEL_SHAPES(KERNEL_FACTORY, ReplacePolicy::BRRIP),
+};
+
+CacheBase *
+make_cache(uint32_t sets, uint32_t assoc, uint32_t blockSize, uint32_t hitTime, CacheType type,
+           CacheBase *next, uint32_t memspeed, ReplacePolicy policy)
+{
+  for (const auto &k : kernels) {
+    if (k.policy == policy && (k.assoc == 0 || (k.assoc == assoc && k.blockSize == blockSize))) {
+      return k.make(sets, assoc, blockSize, hitTime, type, next, memspeed);
+    }
+  }
+  fprintf(stderr,"No cache kernel for replacement policy %d\n", (int)policy);
+  exit(1);
+}
+
+CacheConfig
+default_config()
+{
+  CacheConfig cfg = {};
+  cfg.inclusion       = InclusionPolicy::NINE;
+  cfg.victimHitTime   = 1;
+  cfg.prefetchPolicy  = PrefetchPolicy::NEXT_LINE;
+  cfg.prefetchDegree  = 1;
+  cfg.prefetchDistance= 1;
+  cfg.iprefetchPolicy = PrefetchPolicy::NEXT_LINE;
+  cfg.iprefetchDegree = 1;
+  cfg.prefetchInflight= 8;
+  cfg.icacheBlocksize = 16;
+  cfg.dcacheBlocksize = 16;
+  cfg.l2cacheBlocksize= 16;
+  cfg.icachePolicy    = ReplacePolicy::LRU;
+  cfg.dcachePolicy    = ReplacePolicy::LRU;
+  cfg.l2cachePolicy   = ReplacePolicy::LRU;
+  cfg.icacheMshrTargets = 4;
+  cfg.dcacheMshrTargets = 4;
+  cfg.l2cacheMshrTargets = 4;
+  cfg.mshrWindow      = 32;
+  cfg.cores           = 1;
+  cfg.interleave      = Interleave::ROUND_ROBIN;
+  cfg.quantum         = 1;
+  cfg.memspeed        = 50;
+  return cfg;
+}
+
+static const char *policyNames[] = { "lru", "fifo", "plru", "nru", "srrip", "brrip" };
+
+const char *
+policy_name(ReplacePolicy policy)
+{
+  return policyNames[(int)policy];
+}
+
+bool
+parse_policy(const char *name, ReplacePolicy &policy)
+{
+  for (size_t i = 0; i < sizeof(policyNames) / sizeof(policyNames[0]); i++) {
+    if (!strcasecmp(name, policyNames[i])) {
+      policy = (ReplacePolicy)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+//------------------------------------//
+//          Cache Hierarchy           //
+//------------------------------------//
+
+// With the MSHRs on anywhere, a level without any is blocking: it holds
+// one miss at a time
 //
-uint32_t
-dcache_access(uint32_t addr)
+void
+CacheHierarchy::set_mshrs(CacheBase *cache, uint32_t entries, uint32_t targets)
 {
-  //
-  // TODO: Implement D$
-  //
+  if (overlap) {
+    cache->set_mshrs(entries ? entries : 1, entries ? targets : 1);
+  }
+}
 
-  return memspeed;
+// The L1s send the L2 the same stream whatever the L2 is as long as the L2
+// never reaches back into them and nothing waits on its timing
+//
+static void
+check_recordable(const CacheConfig &cfg)
+{
+  const char *why = NULL;
+  if (!cfg.icacheSets || !cfg.dcacheSets || !cfg.l2cacheSets) {
+    why = "it takes an I$, a D$ and an L2";
+  } else if (cfg.inclusion != InclusionPolicy::NINE) {
+    why = "an inclusive or exclusive L2 changes the L1 contents";
+  } else if (cfg.icacheMshrs || cfg.dcacheMshrs || cfg.l2cacheMshrs || cfg.prefetchQueue || cfg.writeBuffer) {
+    why = "MSHRs, prefetch queues and the write buffer depend on the L2 timing";
+  } else if (cfg.cores > 1) {
+    why = "the cores share the L2";
+  }
+  if (why) {
+    fprintf(stderr,"Cannot record or replay an L1 miss stream: %s\n", why);
+    exit(1);
+  }
+}
+
+// Initialize the Cache Hierarchy
+//
+CacheHierarchy::CacheHierarchy(const CacheConfig &config, MissStreamWriter *record)
+  : cfg(config), icache(NULL), dcache(NULL), l2cache(NULL), iprefetcher(NULL), dprefetcher(NULL),
+    iqueue(NULL), dqueue(NULL), ivictim(NULL), dvictim(NULL), wbuffer(NULL), irecorder(NULL), drecorder(NULL),
+    record(record), replayed(false), replayStats{}, overlap(false), slot(0), totalRefs(0), totalPenalties(0)
+{
+  if (record) {
+    check_recordable(cfg);
+  }
+  overlap = cfg.icacheMshrs || cfg.dcacheMshrs || cfg.l2cacheMshrs;
+  if (overlap) {
+    window.assign(cfg.mshrWindow, InFlight{0, NULL});
+  }
+  if (cfg.l2cacheSets) {
+    l2cache = make_cache(cfg.l2cacheSets, cfg.l2cacheAssoc, cfg.l2cacheBlocksize, cfg.l2cacheHitTime,
+                         CacheType::L2_CACHE, NULL, cfg.memspeed, cfg.l2cachePolicy);
+    set_mshrs(l2cache, cfg.l2cacheMshrs, cfg.l2cacheMshrTargets);
+  } else if (cfg.icacheVictims || cfg.dcacheVictims || cfg.writeBuffer) {
+    fprintf(stderr,"Victim caches and the write buffer sit in front of an L2\n");
+    exit(1);
+  }
+  if (cfg.icacheSets) {
+    CacheBase *below = l2cache;
+    if (record) {
+      below = irecorder = new MissRecorder(cfg.l2cacheBlocksize, CacheType::L1_ICACHE, below, record);
+    }
+    if (cfg.icacheVictims) {
+      below = ivictim = new VictimCache(cfg.icacheVictims, cfg.icacheBlocksize, cfg.victimHitTime,
+                                        CacheType::L1_ICACHE, below);
+    }
+    icache = make_cache(cfg.icacheSets, cfg.icacheAssoc, cfg.icacheBlocksize, cfg.icacheHitTime,
+                         CacheType::L1_ICACHE, below, cfg.memspeed, cfg.icachePolicy);
+    set_mshrs(icache, cfg.icacheMshrs, cfg.icacheMshrTargets);
+    if (cfg.prefetch == TRUE) {
+      iprefetcher = make_prefetcher(cfg.iprefetchPolicy, cfg.icacheBlocksize, cfg.iprefetchDegree, 1);
+      if (cfg.prefetchQueue) {
+        iqueue = new PrefetchQueue(icache, below, cfg.icacheBlocksize, cfg.l2cacheHitTime, cfg.memspeed,
+                                   cfg.prefetchQueue, cfg.prefetchInflight);
+      }
+    }
+  }
+  if (cfg.dcacheSets) {
+    // the L2 takes one buffered write per hit time
+    CacheBase *below = l2cache;
+    if (record) {
+      below = drecorder = new MissRecorder(cfg.l2cacheBlocksize, CacheType::L1_DCACHE, below, record);
+    }
+    if (cfg.writeBuffer) {
+      below = wbuffer = new WriteBuffer(cfg.writeBuffer, cfg.dcacheBlocksize, cfg.l2cacheHitTime, below);
+    }
+    if (cfg.dcacheVictims) {
+      below = dvictim = new VictimCache(cfg.dcacheVictims, cfg.dcacheBlocksize, cfg.victimHitTime,
+                                        CacheType::L1_DCACHE, below);
+    }
+    dcache = make_cache(cfg.dcacheSets, cfg.dcacheAssoc, cfg.dcacheBlocksize, cfg.dcacheHitTime,
+                         CacheType::L1_DCACHE, below, cfg.memspeed, cfg.dcachePolicy);
+    dcache->set_write_through(cfg.writeThrough);
+    set_mshrs(dcache, cfg.dcacheMshrs, cfg.dcacheMshrTargets);
+    if (cfg.prefetch == TRUE) {
+      dprefetcher = make_prefetcher(cfg.prefetchPolicy, cfg.dcacheBlocksize, cfg.prefetchDegree,
+                                    cfg.prefetchDistance);
+      if (cfg.prefetchQueue) {
+        dqueue = new PrefetchQueue(dcache, below, cfg.dcacheBlocksize, cfg.l2cacheHitTime, cfg.memspeed,
+                                   cfg.prefetchQueue, cfg.prefetchInflight);
+      }
+    }
+  }
+  if (l2cache && (icache || dcache)) {
+    set_inclusion();
+  }
+  if (cfg.classifyMisses) {
+    for (CacheBase *c : {icache, dcache, l2cache}) {
+      if (c) {
+        c->classify_misses(cfg.classifySampled);
+      }
+    }
+  }
+}
+
+// Tell the levels how the L2 relates to the L1s
+//
+void
+CacheHierarchy::set_inclusion()
+{
+  // each L1 and the stages under it, top down
+  vector<vector<CacheBase *>> chains;
+  for (const vector<CacheBase *> &stages : {vector<CacheBase *>{icache, ivictim, irecorder},
+                                            vector<CacheBase *>{dcache, dvictim, wbuffer, drecorder}}) {
+    vector<CacheBase *> chain;
+    for (CacheBase *c : stages) {
+      if (c) {
+        chain.push_back(c);
+      }
+    }
+    if (!chain.empty()) {
+      chains.push_back(chain);
+    }
+  }
+  // the side without an L1 would reach the L2 directly, and an exclusive L2
+  // hands its hits up to an L1 that is not there and never fills
+  if (cfg.inclusion == InclusionPolicy::EXCLUSIVE && chains.size() < 2) {
+    fprintf(stderr,"An exclusive L2 needs both an I-cache and a D-cache above it\n");
+    exit(1);
+  }
+  vector<CacheBase *> above;
+  for (const vector<CacheBase *> &chain : chains) {
+    above.push_back(chain.back());
+  }
+  // an inclusive L2 line must cover the L1 lines it holds, an exclusive one
+  // must be the very same line
+  for (uint32_t size : {cfg.icacheSets ? cfg.icacheBlocksize : 0, cfg.dcacheSets ? cfg.dcacheBlocksize : 0}) {
+    if ((cfg.inclusion == InclusionPolicy::INCLUSIVE && size > cfg.l2cacheBlocksize) ||
+        (cfg.inclusion == InclusionPolicy::EXCLUSIVE && size && size != cfg.l2cacheBlocksize)) {
+      fprintf(stderr,"An inclusive L2 needs blocks at least as large as the L1s, an exclusive one the same\n");
+      exit(1);
+    }
+  }
+  l2cache->set_inclusion(cfg.inclusion, above);
+  // bottom up, so every level knows whether the one below takes its victims
+  for (const vector<CacheBase *> &chain : chains) {
+    for (size_t k = chain.size(); k-- > 0;) {
+      chain[k]->set_inclusion(cfg.inclusion, k ? vector<CacheBase *>{chain[k - 1]} : vector<CacheBase *>{});
+    }
+  }
+}
+
+// Clean Up the Cache Hierarchy
+//
+CacheHierarchy::~CacheHierarchy()
+{
+  delete icache;
+  delete dcache;
+  delete l2cache;
+  delete iprefetcher;
+  delete dprefetcher;
+  delete iqueue;
+  delete dqueue;
+  delete ivictim;
+  delete dvictim;
+  delete wbuffer;
+  delete irecorder;
+  delete drecorder;
+}
+
+// Perform a trace access to 'cache'. With the MSHRs on, the core goes on
+// after the hit time unless 'wait' asks for the data, and the access holds
+// its window slot until the data is back
+//
+template <class Cache>
+inline uint32_t
+CacheHierarchy::level_access(Cache *cache, uint32_t addr, bool write, bool wait)
+{
+  if (!overlap) {
+    return cache->cache_access(addr, write);
+  }
+  InFlight &f = window[slot];
+  f.cache = cache;
+  return cache->cache_access_nb(addr, write, totalPenalties, wait, f.ready);
 }
 
 // Perform a memory access to the l2cache for the address 'addr'
 // Return the access time for the memory operation
 //
 uint32_t
-l2cache_access(uint32_t addr)
+CacheHierarchy::l2cache_access(uint32_t addr, bool write, bool wait)
 {
-  //
-  // TODO: Implement L2$
-  //
-  return memspeed;
+  return l2cache ? level_access(l2cache, addr, write, wait) : cfg.memspeed;
 }
 
-// Predict an address to prefetch on icache with the information of last icache access:
-// 'pc':     Program Counter of the instruction of last icache access
-// 'addr':   Accessed Address of last icache access
-// 'r_or_w': Read/Write of last icache access
-// 'policy': Prefetch Policy
+// An access cannot issue while the one 'mshrWindow' accesses before it is
+// still waiting for its data. Returns the cycles this stalls the core,
+// which are charged to the cache that missed.
+//
 uint32_t
-icache_prefetch_addr(uint32_t pc, uint32_t addr, char r_or_w, PrefetchPolicy policy)
+CacheHierarchy::window_wait()
 {
-  if (policy == PrefetchPolicy::NEXT_LINE)
-    return addr + icacheBlocksize; // Next line prefetching
-  //
-  // TODO: Implement a better prefetching strategy
-  //
+  slot = totalRefs % window.size();
+  InFlight &f = window[slot];
+  uint32_t wait = 0;
+  if (f.ready > totalPenalties) {
+    wait = f.ready - totalPenalties;
+    f.cache->charge(wait);
+    totalPenalties += wait;
+  }
+  f.ready = 0;
+  return wait;
 }
 
-// Predict an address to prefetch on dcache with the information of last dcache access:
-// 'pc':     Program Counter of the instruction of last dcache access
-// 'addr':   Accessed Address of last dcache access
-// 'r_or_w': Read/Write of last dcache access
-// 'policy': Prefetch Policy
+// With a prefetch queue the proposals wait for an in-flight entry and reach
+// the L1 only once the L2/memory latency has passed on the hierarchy clock,
+// the sum of the penalties so far
+//
+template <class Cache>
 uint32_t
-dcache_prefetch_addr(uint32_t pc, uint32_t addr, char r_or_w, PrefetchPolicy policy)
+CacheHierarchy::prefetch_access(Cache *cache, Prefetcher *prefetcher, PrefetchQueue *queue,
+                                PrefetchPolicy policy, uint32_t pc, uint32_t addr, bool write)
+{
+  uint64_t now = totalPenalties;
+  uint32_t wait = 0;
+  if (queue) {
+    queue->retire(now);
+    wait = queue->claim(addr, now);
+  }
+
+  uint64_t misses = cache->get_misses();
+  uint64_t used = cache->get_prefetch_hits();
+  uint32_t penalty = level_access(cache, addr, write, cache == icache);
+  if (wait) {
+    cache->charge(wait);
+    penalty += wait;
+  }
+  prefetcher->observe(pc, addr, cache->get_misses() != misses, cache->get_prefetch_hits() != used,
+                      prefetches);
+  for (uint32_t a : prefetches) {
+    if (queue) {
+      queue->push(a);
+    } else {
+      cache->cache_prefetch(a, policy);
+    }
+  }
+  prefetches.clear();
+  if (queue) {
+    queue->issue(now + penalty);
+  }
+  return penalty;
+}
+
+template <class ICache, class DCache>
+inline uint32_t
+CacheHierarchy::access_as(ICache *l1i, DCache *l1d, uint32_t pc, uint32_t addr, bool data, bool write)
+{
+  uint32_t penalty;
+  uint32_t stall = overlap ? window_wait() : 0;
+  totalRefs++;
+  if (wbuffer) {
+    wbuffer->advance(totalPenalties);
+  }
+  // Direct the memory access to the appropriate cache
+  if (!data) {
+    if (iprefetcher) {
+      penalty = prefetch_access(l1i, iprefetcher, iqueue, cfg.iprefetchPolicy, pc, addr, false);
+    } else {
+      // fetch cannot run ahead of a missing instruction
+      penalty = l1i ? level_access(l1i, addr, false, true) : l2cache_access(addr, false, true);
+    }
+  } else {
+    if (dprefetcher) {
+      penalty = prefetch_access(l1d, dprefetcher, dqueue, cfg.prefetchPolicy, pc, addr, write);
+    } else {
+      penalty = l1d ? level_access(l1d, addr, write, false) : l2cache_access(addr, write, false);
+    }
+    // a write that found the write buffer full waited for an entry
+    if (wbuffer) {
+      uint32_t wait = wbuffer->take_stall();
+      dcache->charge(wait);
+      penalty += wait;
+    }
+  }
+  totalPenalties += penalty;
+  return stall + penalty;
+}
+
+uint32_t
+CacheHierarchy::access(uint32_t pc, uint32_t addr, char i_or_d, char r_or_w)
+{
+  return access_as(icache, dcache, pc, addr, i_or_d != 'I', r_or_w == 'W');
+}
+
+// Blocking levels without prefetchers or a write buffer have nothing to do
+// between the accesses, so the loop is the two L1 lookups alone
+//
+template <class ICache, class DCache>
+uint64_t
+CacheHierarchy::batch_as(ICache *l1i, DCache *l1d, std::span<const MemAccess> batch)
+{
+  uint64_t penalty = 0;
+  if (l1i && l1d && !overlap && !iprefetcher && !dprefetcher && !wbuffer) {
+    for (const MemAccess &a : batch) {
+      penalty += a.data ? l1d->cache_access(a.addr, a.write) : l1i->cache_access(a.addr, false);
+    }
+    totalRefs += batch.size();
+    totalPenalties += penalty;
+    return penalty;
+  }
+  for (const MemAccess &a : batch) {
+    penalty += access_as(l1i, l1d, a.pc, a.addr, a.data, a.data && a.write);
+  }
+  return penalty;
+}
+
+// 'cache' as the kernel 'Assoc', 'BlockBits' and 'Policy' pick, or NULL
+//
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+static CacheKernel<Assoc, BlockBits, Policy> *
+as_kernel(CacheBase *cache)
+{
+  if (typeid(*cache) != typeid(CacheKernel<Assoc, BlockBits, Policy>)) {
+    return NULL;
+  }
+  return static_cast<CacheKernel<Assoc, BlockBits, Policy> *>(cache);
+}
+
+// I and D-caches nearly always share the policy and block size, so only
+// those pairs get a loop of their own; any other D-cache keeps its vtable
+//
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+uint64_t
+CacheHierarchy::batch_dcache(CacheBase *l1i, std::span<const MemAccess> batch)
+{
+  auto *i = static_cast<CacheKernel<Assoc, BlockBits, Policy> *>(l1i);
+  if constexpr (BlockBits != 0) {
+    if (auto *d = as_kernel<2, BlockBits, Policy>(dcache)) {
+      return batch_as(i, d, batch);
+    }
+    if (auto *d = as_kernel<4, BlockBits, Policy>(dcache)) {
+      return batch_as(i, d, batch);
+    }
+    if (auto *d = as_kernel<8, BlockBits, Policy>(dcache)) {
+      return batch_as(i, d, batch);
+    }
+    if (auto *d = as_kernel<16, BlockBits, Policy>(dcache)) {
+      return batch_as(i, d, batch);
+    }
+  } else if (auto *d = as_kernel<0, 0, Policy>(dcache)) {
+    return batch_as(i, d, batch);
+  }
+  return batch_as(i, dcache, batch);
+}
+
+// The L1 kernels are found once per batch, so every access of the batch
+// calls them directly and only their misses go through a vtable
+//
+uint64_t
+CacheHierarchy::access_batch(std::span<const MemAccess> batch)
 {
-  return addr + dcacheBlocksize; // Next line prefetching
-  //
-  // TODO: Implement a better prefetching strategy
-  //
+  typedef uint64_t (CacheHierarchy::*BatchLoop)(CacheBase *, std::span<const MemAccess>);
+#define KERNEL_BATCH(A, B, P) { typeid(CacheKernel<A, B, P>), &CacheHierarchy::batch_dcache<A, B, P> }
+  static const struct
+  {
+    const std::type_info &type;
+    BatchLoop run;
+  } loops[] = {
+    KERNEL_SHAPES(KERNEL_BATCH, ReplacePolicy::LRU),
+    KERNEL_SHAPES(KERNEL_BATCH, ReplacePolicy::FIFO),
+    KERNEL_SHAPES(KERNEL_BATCH, ReplacePolicy::PLRU),
+    KERNEL_SHAPES(KERNEL_BATCH, ReplacePolicy::NRU),
+    KERNEL_SHAPES(KERNEL_BATCH, ReplacePolicy::SRRIP),
+    KERNEL_SHAPES(KERNEL_BATCH, ReplacePolicy::BRRIP),
+  };
+#undef KERNEL_BATCH
+  if (icache && dcache) {
+    for (const auto &l : loops) {
+      if (typeid(*icache) == l.type) {
+        return (this->*l.run)(icache, batch);
+      }
+    }
+  }
+  return batch_as(icache, dcache, batch);
 }
 
-// Perform a prefetch operation to I$ for the address 'addr'
-void icache_prefetch(uint32_t addr)
+void
+CacheHierarchy::warm(uint32_t addr, char i_or_d, char r_or_w)
 {
-  //
-  // TODO: Implement I$ prefetch operation
-  //
+  CacheBase *cache = i_or_d == 'I' ? icache : dcache;
+  if (!cache) {
+    cache = l2cache;
+  }
+  if (cache) {
+    cache->cache_warm(addr, i_or_d == 'D' && r_or_w == 'W');
+  }
 }
 
-// Perform a prefetch operation to D$ for the address 'addr'
-void dcache_prefetch(uint32_t addr)
+static PrefetchStats
+prefetch_stats(const CacheBase *cache, const PrefetchQueue *queue)
 {
-  //
-  // TODO: Implement D$ prefetch operation
-  //
+  PrefetchStats p = {};
+  p.fills = cache->get_prefetches();
+  p.used = cache->get_prefetch_hits();
+  p.useless = cache->get_useless_prefetches();
+  p.pollution = cache->get_pollution();
+  if (queue) {
+    p.late = queue->get_late();
+    p.dropped = queue->get_dropped();
+  }
+  return p;
 }
 
-// Replace the cache line in the I$ for the address 'addr'
-uint8_t icache_replace(uint32_t addr)
+CacheStats
+CacheHierarchy::upper_stats() const
 {
-  //
-  // TODO: Implement I$ replacement
-  //
+  CacheStats s = {};
+  for (CacheBase *c : {icache, dcache}) {
+    if (c) {
+      s.compulsory_miss += c->get_compulsory_miss();
+      s.other_miss += c->get_other_miss();
+    }
+  }
+  for (auto [c, classes] : {pair{icache, &s.icacheClasses}, pair{dcache, &s.dcacheClasses}}) {
+    if (c && c->get_classifier()) {
+      *classes = c->get_classifier()->stats();
+    }
+  }
+  // without an L2 the L1s read from and write back to memory
+  for (CacheBase *c : {icache, dcache}) {
+    if (c && !l2cache) {
+      s.memoryReads += c->get_fetches();
+      s.memoryWrites += c->get_writebacks();
+    }
+  }
+  if (icache) {
+    s.icacheWritebacks = icache->get_writebacks();
+    s.icachePrefetch = prefetch_stats(icache, iqueue);
+    s.icacheMshr = icache->get_mshrs().stats();
+    s.icacheRefs = icache->get_refs();
+    s.icacheMisses = icache->get_misses();
+    s.icachePenalties = icache->get_penalties();
+  }
+  if (dcache) {
+    s.dcacheWritebacks = dcache->get_writebacks();
+    s.dcachePrefetch = prefetch_stats(dcache, dqueue);
+    s.dcacheMshr = dcache->get_mshrs().stats();
+    s.dcacheRefs = dcache->get_refs();
+    s.dcacheMisses = dcache->get_misses();
+    s.dcachePenalties = dcache->get_penalties();
+  }
+  if (ivictim) {
+    s.icacheVictim = ivictim->stats();
+  }
+  if (dvictim) {
+    s.dcacheVictim = dvictim->stats();
+  }
+  if (wbuffer) {
+    s.writeBuffer = wbuffer->stats();
+  }
+  s.totalRefs = totalRefs;
+  s.totalPenalties = totalPenalties;
+  return s;
 }
 
-// Replace the cache line in the D$ for the address 'addr'
-uint8_t dcache_replace(uint32_t addr)
+CacheStats
+CacheHierarchy::stats() const
 {
-  //
-  // TODO: Implement D$ replacement
-  //
-}
\ No newline at end of file
+  CacheStats s = replayed ? replayStats : upper_stats();
+  if (l2cache) {
+    s.compulsory_miss += l2cache->get_compulsory_miss();
+    s.other_miss += l2cache->get_other_miss();
+    if (l2cache->get_classifier()) {
+      s.l2cacheClasses = l2cache->get_classifier()->stats();
+    }
+    // the lowest level reads from and writes back to memory
+    s.memoryReads = l2cache->get_fetches();
+    s.memoryWrites = l2cache->get_writebacks();
+    s.backInvalidations = l2cache->get_back_invalidations();
+    s.l2cacheWritebacks = l2cache->get_writebacks();
+    s.l2cacheMshr = l2cache->get_mshrs().stats();
+    s.l2cacheRefs = l2cache->get_refs();
+    s.l2cacheMisses = l2cache->get_misses();
+    s.l2cachePenalties = l2cache->get_penalties();
+  }
+  return s;
+}
+
+// The window refers to the levels by position: I$, D$, L2, none
+//
+void
+CacheHierarchy::save_state(CheckpointWriter &out) const
+{
+  for (CacheBase *c : {icache, dcache, l2cache, (CacheBase *)ivictim, (CacheBase *)dvictim,
+                       (CacheBase *)wbuffer}) {
+    if (c) {
+      c->save_state(out);
+    }
+  }
+  for (Prefetcher *p : {iprefetcher, dprefetcher}) {
+    if (p) {
+      p->save_state(out);
+    }
+  }
+  for (PrefetchQueue *q : {iqueue, dqueue}) {
+    if (q) {
+      q->save_state(out);
+    }
+  }
+  out.put((uint64_t)window.size());
+  for (const InFlight &f : window) {
+    uint8_t level = f.cache == icache ? 0 : f.cache == dcache ? 1 : f.cache == l2cache ? 2 : 3;
+    out.put(f.ready);
+    out.put(f.cache ? level : (uint8_t)3);
+  }
+  out.put((uint64_t)slot);
+  out.put(totalRefs);
+  out.put(totalPenalties);
+}
+
+void
+CacheHierarchy::load_state(CheckpointReader &in)
+{
+  for (CacheBase *c : {icache, dcache, l2cache, (CacheBase *)ivictim, (CacheBase *)dvictim,
+                       (CacheBase *)wbuffer}) {
+    if (c) {
+      c->load_state(in);
+    }
+  }
+  for (Prefetcher *p : {iprefetcher, dprefetcher}) {
+    if (p) {
+      p->load_state(in);
+    }
+  }
+  for (PrefetchQueue *q : {iqueue, dqueue}) {
+    if (q) {
+      q->load_state(in);
+    }
+  }
+  uint64_t n, pos;
+  in.get(n);
+  window.resize(n);
+  for (InFlight &f : window) {
+    uint8_t level;
+    in.get(f.ready);
+    in.get(level);
+    CacheBase *levels[] = { icache, dcache, l2cache, NULL };
+    f.cache = levels[level < 3 ? level : 3];
+  }
+  in.get(pos);
+  slot = pos;
+  in.get(totalRefs);
+  in.get(totalPenalties);
+}
+
+//------------------------------------//
+//         L1 Miss Streams            //
+//------------------------------------//
+
+// The statistics saved with the stream are those of the L1s without the
+// latencies this L2 answered them with, which a replay adds back for its own
+//
+void
+CacheHierarchy::finish_record()
+{
+  CacheStats s = upper_stats();
+  s.icachePenalties -= irecorder->latency();
+  s.dcachePenalties -= drecorder->latency();
+  s.totalPenalties -= irecorder->latency() + drecorder->latency();
+  record->finish(s);
+}
+
+void
+CacheHierarchy::replay(const char *path)
+{
+  check_recordable(cfg);
+  MissStreamReader in(path, l1_config_key(cfg));
+  replayStats = in.upper();
+  // decoded a block at a time, so the L2 kernel takes each block in one call
+  vector<MissRecord> run(REPLAY_BLOCK);
+  uint64_t ilatency = 0;
+  uint64_t dlatency = 0;
+  for (size_t n; (n = in.read(run.data(), run.size()));) {
+    l2cache->cache_replay(run.data(), n, ilatency, dlatency);
+  }
+  replayStats.icachePenalties += ilatency;
+  replayStats.dcachePenalties += dlatency;
+  replayStats.totalPenalties += ilatency + dlatency;
+  replayed = true;
+  totalRefs = replayStats.totalRefs;
+  totalPenalties = replayStats.totalPenalties;
+}
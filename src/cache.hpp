@@ -4,19 +4,396 @@
 #include <stdlib.h>
 #include <vector>
 #include <bitset>
+#include <memory>
+#include <span>
+#include "trace.hpp"
 
 using namespace std;
 
+class CheckpointWriter;
+class CheckpointReader;
+struct MissRecord;
+
+enum class CacheType
+{
+    L1_ICACHE,
+    L1_DCACHE,
+    L2_CACHE
+};
+
+enum class ReplacePolicy
+{
+    LRU,   // true LRU, one timestamp per way
+    FIFO,  // round-robin pointer per set
+    PLRU,  // tree pseudo-LRU, assoc-1 bits per set
+    NRU,   // not recently used, one reference bit per way
+    SRRIP, // static re-reference interval prediction, 2-bit RRPV per way
+    BRRIP  // bimodal RRIP, inserts at distant re-reference most of the time
+};
+
+enum class PrefetchPolicy
+{
+    NEXT_LINE,
+    STRIDE,
+    STREAM,
+    DISCONTINUITY, // I$ only: learned non-sequential fetch transitions
+    TEMPORAL       // I$ only: replays recorded I$ miss sequences
+};
+
+enum class InclusionPolicy
+{
+    NINE,      // non-inclusive non-exclusive: the L2 keeps what it fetched
+    INCLUSIVE, // every L1 line is also in the L2, L2 evictions invalidate the L1s
+    EXCLUSIVE  // the L2 holds only L1 victims, its hits move up into the L1
+};
+
+enum class Interleave
+{
+    ROUND_ROBIN, // the cores take turns
+    RANDOM,      // a random core goes next, from a fixed seed
+    CYCLE        // the core with the fewest cycles so far goes next
+};
+
+#define TRUE 1
+#define FALSE 0
+
+//------------------------------------//
+//      Cache Configuration           //
+//------------------------------------//
+
+struct CacheConfig
+{
+    uint32_t icacheSets;      // Number of sets in the I$
+    uint32_t icacheAssoc;     // Associativity of the I$
+    uint32_t icacheBlocksize; // Blocksize of the I$
+    uint32_t icacheHitTime;   // Hit Time of the I$
+    ReplacePolicy icachePolicy;// Replacement policy of the I$
+    uint32_t icacheMshrs;     // MSHRs of the I$, 0 = blocking
+    uint32_t icacheMshrTargets;// Accesses one I$ MSHR can hold
+
+    uint32_t dcacheSets;      // Number of sets in the D$
+    uint32_t dcacheAssoc;     // Associativity of the D$
+    uint32_t dcacheBlocksize; // Blocksize of the D$
+    uint32_t dcacheHitTime;   // Hit Time of the D$
+    ReplacePolicy dcachePolicy;// Replacement policy of the D$
+    uint32_t dcacheMshrs;     // MSHRs of the D$, 0 = blocking
+    uint32_t dcacheMshrTargets;// Accesses one D$ MSHR can hold
+
+    uint32_t l2cacheSets;     // Number of sets in the L2$
+    uint32_t l2cacheAssoc;    // Associativity of the L2$
+    uint32_t l2cacheBlocksize;// Blocksize of the L2$
+    uint32_t l2cacheHitTime;  // Hit Time of the L2$
+    ReplacePolicy l2cachePolicy;// Replacement policy of the L2$
+    uint32_t l2cacheMshrs;    // MSHRs of the L2$, 0 = blocking
+    uint32_t l2cacheMshrTargets;// Accesses one L2$ MSHR can hold
+    uint32_t mshrWindow;      // Accesses the core can run ahead of one still waiting for data
+    InclusionPolicy inclusion;// Relation of the L2 contents to the L1s
+    uint32_t trafficReport;   // Print writebacks and memory traffic
+    uint32_t icacheVictims;   // Victim cache entries behind the I$, 0 = none
+    uint32_t dcacheVictims;   // Victim cache entries behind the D$, 0 = none
+    uint32_t victimHitTime;   // Cycles to swap a line back from a victim cache
+    uint32_t writeBuffer;     // Coalescing write buffer entries before the L2, 0 = none
+    uint32_t writeThrough;    // D$ writes through to the L2 and does not allocate on write misses
+
+    uint32_t prefetch;        // Indicate if prefetching is enabled
+    PrefetchPolicy prefetchPolicy; // D$ prefetcher, the I$ always prefetches the next line
+    uint32_t prefetchDegree;  // Prefetches issued per trigger (stride/stream)
+    uint32_t prefetchDistance;// How far ahead the first prefetch goes (stride/stream)
+    PrefetchPolicy iprefetchPolicy; // I$ prefetcher
+    uint32_t iprefetchDegree; // Lines prefetched per trigger (discontinuity/temporal)
+    uint32_t prefetchReport;  // Print prefetcher coverage and accuracy
+    uint32_t prefetchQueue;   // Prefetch issue queue entries per L1, 0 = prefetches land at once
+    uint32_t prefetchInflight;// Prefetches per L1 that can wait on the L2/memory at a time
+
+    uint32_t cores;           // Cores, one trace each, sharing the L2
+    Interleave interleave;    // Order the core traces are merged in
+    uint32_t quantum;         // Accesses a core runs per turn
+    uint32_t transferTime;    // Cycles of a cache-to-cache transfer, 0 = the L2 hit time
+    uint32_t classifyMisses;  // Split every level's misses into compulsory, capacity and conflict
+    uint32_t classifySampled; // Capacity and conflict misses of large levels from a sample of their sets
+
+    uint32_t memspeed;        // Latency of Main Memory
+};
+
+//------------------------------------//
+//          Cache Statistics          //
+//------------------------------------//
+
+struct PrefetchStats
+{
+    uint64_t fills;            // Lines the prefetcher brought into the L1
+    uint64_t used;             // Of those, lines later used by a demand access
+    uint64_t late;             // Demand accesses that found their line still queued or in flight
+    uint64_t useless;          // Prefetched lines evicted before any use
+    uint64_t pollution;        // Demand misses on lines a prefetch had evicted
+    uint64_t dropped;          // Prefetches dropped on a full issue queue
+};
+
+struct MshrStats
+{
+    uint64_t merged;           // Secondary misses merged into an outstanding miss
+    uint64_t targetStalls;     // Secondary misses that found their MSHR out of targets
+    uint64_t fullStalls;       // Misses that found every MSHR busy
+    uint64_t stallCycles;      // Cycles those misses waited for a free MSHR
+};
+
+struct VictimStats
+{
+    uint64_t probes;           // L1 misses that looked in the victim cache
+    uint64_t hits;             // Of those, lines swapped back into the L1
+    uint64_t evictions;        // Lines pushed out to the L2
+    uint64_t writebacks;       // Of those, dirty ones
+};
+
+struct MissClassStats
+{
+    uint64_t compulsory;       // Misses on blocks the level never saw before
+    uint64_t capacity;         // Misses a fully-associative LRU cache of the same size also takes
+    uint64_t conflict;         // Misses the fully-associative cache would have hit
+};
+
+struct WriteBufferStats
+{
+    uint64_t writes;           // Writes that took a new entry
+    uint64_t merges;           // Writes coalesced into a buffered block
+    uint64_t drains;           // Entries written to the L2
+    uint64_t readFlushes;      // Reads and prefetches that drained their block early
+    uint64_t fullStalls;       // Writes that found every entry taken
+    uint64_t stallCycles;      // Cycles those writes waited for an entry
+};
+
+struct CacheStats
+{
+    uint64_t icacheRefs;       // I$ references
+    uint64_t icacheMisses;     // I$ misses
+    uint64_t icachePenalties;  // I$ penalties
+
+    uint64_t dcacheRefs;       // D$ references
+    uint64_t dcacheMisses;     // D$ misses
+    uint64_t dcachePenalties;  // D$ penalties
+
+    uint64_t l2cacheRefs;      // L2$ references
+    uint64_t l2cacheMisses;    // L2$ misses
+    uint64_t l2cachePenalties; // L2$ penalties
+
+    uint64_t icacheWritebacks; // Dirty I$ lines written to the L2
+    uint64_t dcacheWritebacks; // Dirty D$ lines written to the L2
+    uint64_t l2cacheWritebacks;// Dirty L2$ lines written to memory
+    uint64_t backInvalidations;// L1 lines invalidated by inclusive L2 evictions
+    uint64_t memoryReads;      // Lines read from memory
+    uint64_t memoryWrites;     // Lines written to memory
+
+    uint64_t compulsory_miss;  // Compulsory misses on all caches
+    uint64_t other_miss;       // Other misses (Conflict / Capacity miss) on all caches
+
+    PrefetchStats icachePrefetch; // I$ prefetcher
+    PrefetchStats dcachePrefetch; // D$ prefetcher
+
+    MshrStats icacheMshr;      // I$ MSHRs
+    MshrStats dcacheMshr;      // D$ MSHRs
+    MshrStats l2cacheMshr;     // L2$ MSHRs
+
+    VictimStats icacheVictim;  // I$ victim cache
+    VictimStats dcacheVictim;  // D$ victim cache
+    WriteBufferStats writeBuffer; // Write buffer before the L2
+
+    MissClassStats icacheClasses; // I$ misses by cause
+    MissClassStats dcacheClasses; // D$ misses by cause
+    MissClassStats l2cacheClasses;// L2$ misses by cause
+
+    uint64_t totalRefs;        // Memory accesses
+    uint64_t totalPenalties;   // Memory penalties, including hit times
+};
+
 //------------------------------------//
-//        Cache Configuration         //
+//               MSHRs                //
+//------------------------------------//
+
+// Miss status holding registers of one cache level: the outstanding misses
+// by block, each with the cycle its data returns and the number of accesses
+// waiting on it. Entries are freed lazily once their data is back.
+class MshrFile
+{
+public:
+    struct Entry
+    {
+        uint32_t block;
+        uint32_t targets;  // accesses waiting on the block
+        uint64_t ready;    // cycle the data returns
+    };
+
+    // Allow 'entries' outstanding misses of up to 'targets' accesses each
+    void resize(uint32_t entries, uint32_t targets);
+    bool enabled() const { return entries != 0; }
+
+    // Free the entries whose data has returned by cycle 'now'
+    void retire(uint64_t now);
+    // The outstanding miss on 'block', or NULL
+    Entry *find(uint32_t block);
+    // Add a secondary miss to 'e', false when 'e' has no target left
+    bool merge(Entry &e);
+    // First cycle from 'now' on at which a new miss finds a free entry
+    uint64_t free_at(uint64_t now);
+    void allocate(uint32_t block, uint64_t ready);
+
+    uint32_t get_entries() const { return entries; }
+    uint32_t get_targets() const { return targets; }
+    const MshrStats &stats() const { return counts; }
+
+    void save_state(CheckpointWriter &out) const;
+    void load_state(CheckpointReader &in);
+
+private:
+    vector<Entry> pending;
+    uint32_t entries = 0;
+    uint32_t targets = 0;
+    MshrStats counts = {};
+};
+
+//------------------------------------//
+//        Miss Classification         //
+//------------------------------------//
+
+// 3C classification of the misses of one level. Every demand access is
+// replayed on a fully-associative LRU cache of the same number of lines: a
+// miss on a block never referenced before is compulsory, a miss that the
+// fully-associative cache hits is a conflict miss, and the rest are
+// capacity misses. The shadow cache is an open-addressing hash table from
+// block to a node of an LRU list kept in arrays, so an access is O(1) and
+// allocates nothing.
+//
+// The shadow cache costs more than the level itself, so 'sampleSets' replays
+// only the accesses to a hashed sample of the sets, on a fully-associative
+// cache of their lines, and scales their split of the non-compulsory misses
+// up to all of them. A level is sampled down to SHADOW_LINES lines, but no
+// fewer than SAMPLED_SETS sets; smaller levels are classified exactly.
+// Compulsory misses are always counted in every set.
+class MissClassifier
+{
+public:
+    MissClassifier(uint32_t sets, uint32_t assoc, uint32_t blockBits, bool sampleSets);
+
+    // A demand access to 'block', 'miss' in the real cache. 'count' is false
+    // for functional warming, which updates the state only.
+    void access(uint32_t block, bool miss, bool count = true);
+
+    MissClassStats stats() const;
+
+    void save_state(CheckpointWriter &out) const;
+    void load_state(CheckpointReader &in);
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+    static constexpr uint32_t CHUNK_BITS = 16; // blocks per first-touch chunk, log2
+    static constexpr uint32_t SHADOW_LINES = 256;
+    static constexpr uint32_t SAMPLED_SETS = 32;
+
+    struct Slot
+    {
+        uint32_t block;
+        uint32_t node;         // NONE = empty
+    };
+
+    // A shadow line, linked into the LRU list
+    struct Node
+    {
+        uint32_t block;
+        uint32_t prev;         // more recent line, NONE at the head
+        uint32_t next;         // less recent line, NONE at the tail
+    };
+
+    // Mark 'block' referenced, returns true the first time
+    bool first_touch(uint32_t block);
+    // Look 'block' up in the shadow cache and make it the most recent,
+    // filling it over the least recent line on a miss. Returns true on a hit.
+    bool shadow_access(uint32_t block);
+    uint32_t home(uint32_t block) const { return (block * 0x9E3779B1u) >> hashShift; }
+    // Is the set of 'block' one the shadow cache replays?
+    bool sampled(uint32_t block) const
+    {
+        return !sampleShift || !(((block & setMask) * 0x85EBCA6Bu) >> (32 - sampleShift));
+    }
+    void erase(uint32_t slot);
+    void unlink(uint32_t node);
+    void push_front(uint32_t node);
+
+    vector<vector<uint64_t>> seen; // first-touch bitmap, a chunk allocated on its first block
+    vector<Slot> table;
+    vector<Node> nodes;
+    uint32_t head;                 // most recent line
+    uint32_t tail;
+    uint32_t used;                 // lines filled so far
+    uint32_t mask;                 // table size - 1
+    uint32_t hashShift;
+    uint32_t setMask;
+    uint32_t sampleShift;          // log2 of the sets per sampled set
+    uint64_t misses;               // in all sets
+    MissClassStats counts;         // compulsory in all sets, the rest of the sampled sets
+};
+
+//------------------------------------//
+//          Cache Interfaces          //
 //------------------------------------//
 class CacheBase
 {
 public:
     virtual ~CacheBase() = default;
-    // Perform a memory access through the cache interface for the address 'addr'
+    // Perform a memory access through the cache interface for the address 'addr',
+    // a 'write' makes the line dirty
     // Return the access time for the memory operation
-    virtual uint32_t cache_access(uint32_t addr) = 0;
+    virtual uint32_t cache_access(uint32_t addr, bool write) = 0;
+
+    // Perform a memory access for 'addr' arriving at cycle 'now' with the
+    // misses kept in the MSHRs, so later accesses can overlap them. 'ready'
+    // is set to the cycle the data is back. Return the cycles the requester
+    // waits: until then when 'wait' is set, otherwise only the hit time plus
+    // any stall for a free MSHR.
+    virtual uint32_t cache_access_nb(uint32_t addr, bool write, uint64_t now, bool wait, uint64_t &ready) = 0;
+
+    // Take a line evicted from the level above. A 'dirty' one is written
+    // back, into this cache when it holds the line and further down
+    // otherwise; an exclusive cache places every victim.
+    virtual void cache_writeback(uint32_t addr, bool dirty) = 0;
+
+    // Take a store written through by the level above: it dirties the line
+    // when this cache holds it and goes on down otherwise
+    virtual void cache_write(uint32_t addr) = 0;
+
+    // Run the 'n' miss stream events from 'run' on this cache, in order,
+    // adding the latencies of the I-side and D-side reads to 'ilatency' and
+    // 'dlatency'
+    virtual void cache_replay(const MissRecord *run, size_t n, uint64_t &ilatency, uint64_t &dlatency);
+
+    // Invalidate the lines in the 'bytes' from 'addr', 'dirty' is set if one
+    // of them was. Returns the number of lines invalidated.
+    virtual uint32_t cache_invalidate(uint32_t addr, uint32_t bytes, bool &dirty) = 0;
+
+    // Make this cache 'policy' to the caches in 'above', which is empty
+    // for the caches on top
+    virtual void set_inclusion(InclusionPolicy policy, const vector<CacheBase *> &above) = 0;
+
+    // Does this level want the clean victims of the level above too
+    virtual bool takes_victims() const = 0;
+
+    // A store to the clean line at 'addr' above, which must now be the only
+    // copy among the coherent L1s
+    virtual void cache_upgrade(uint32_t addr) {}
+
+    // Write the line at 'addr' back if it is dirty and keep it clean, for
+    // another L1 to share it. Returns whether it was dirty.
+    virtual bool cache_clean(uint32_t addr) { return false; }
+
+    // Functional warming: bring 'addr' in and update the replacement state
+    // as an access would, without counting it or timing it
+    virtual void cache_warm(uint32_t addr, bool write) { cache_access(addr, write); }
+
+    // Save everything a later run needs to carry on from here: the lines,
+    // the replacement state, the outstanding misses and the counters
+    virtual void save_state(CheckpointWriter &out) const;
+    virtual void load_state(CheckpointReader &in);
+
+    // Was the line the last access moved up out of this exclusive cache dirty
+    bool take_dirty() { bool d = handedDirty; handedDirty = false; return d; }
 
     // Predict an address to prefetch on dcache with the information of last dcache access:
     // 'pc':     Program Counter of the instruction of last dcache access
@@ -27,8 +404,44 @@ public:
     // Perform a prefetch operation to I$ for the address 'addr'
     virtual void cache_prefetch(uint32_t addr, PrefetchPolicy policy) = 0;
 
-    // 最多8路组相联的替换策略
-    virtual uint8_t cache_replace(uint32_t addr, ReplacePolicy policy) = 0;
+    // Is the block at 'addr' in this cache
+    virtual bool cache_probe(uint32_t addr) const = 0;
+
+    // Place the prefetched block at 'addr' into this cache only, once it has
+    // arrived from the level below
+    virtual void cache_install(uint32_t addr, bool dirty) = 0;
+
+    // Victim way for 'addr': an invalid way, else the choice of the level's
+    // replacement policy
+    virtual uint8_t cache_replace(uint32_t addr) = 0;
+
+    uint64_t get_refs() const { return refs; }
+    uint64_t get_misses() const { return misses; }
+    uint64_t get_penalties() const { return penalties; }
+    uint64_t get_compulsory_miss() const { return compulsory_miss; }
+    uint64_t get_other_miss() const { return other_miss; }
+    uint64_t get_prefetches() const { return prefetches; }
+    uint64_t get_prefetch_hits() const { return prefetchHits; }
+    uint64_t get_useless_prefetches() const { return uselessPrefetches; }
+    uint64_t get_pollution() const { return pollution; }
+    uint64_t get_fetches() const { return fetches; }
+    uint64_t get_writebacks() const { return writebacks; }
+    uint64_t get_back_invalidations() const { return backInvalidations; }
+
+    // Add 'cycles' spent waiting on a late prefetch to the penalties
+    void charge(uint32_t cycles) { penalties += cycles; }
+
+    void set_mshrs(uint32_t entries, uint32_t targets) { mshrs.resize(entries, targets); }
+    const MshrFile &get_mshrs() const { return mshrs; }
+
+    // Write stores through to the level below, allocating only on reads
+    void set_write_through(bool on) { writeThrough = on; }
+    // Report the first store to each clean line to the level below
+    void set_coherent(bool on) { coherent = on; }
+    // Classify this level's misses with a fully-associative shadow cache
+    void classify_misses(bool sampled);
+    // NULL unless misses are classified
+    const MissClassifier *get_classifier() const { return classifier.get(); }
 
 protected:
     uint32_t sets;
@@ -43,69 +456,226 @@ protected:
     uint64_t penalties;       // $ penalties
     uint64_t compulsory_miss; // Compulsory misses on all caches
     uint64_t other_miss;      // Other misses (Conflict / Capacity miss) on all caches
+    uint64_t prefetches;      // Lines filled by cache_prefetch()
+    uint64_t prefetchHits;    // First demand hits on prefetched lines
+    uint64_t uselessPrefetches; // Prefetched lines evicted unused
+    uint64_t pollution;       // Demand misses on lines evicted by a prefetch
+
+    uint64_t fetches;         // Lines read from the level below, demand and prefetch
+    uint64_t writebacks;      // Dirty lines written to the level below
+    uint64_t backInvalidations; // Lines above invalidated by this cache's evictions
+    bool handedDirty;         // The last line moved up was dirty
+    bool writeThrough;        // stores go down, write misses do not allocate
+    bool coherent;            // stores to clean lines claim ownership below
+    unique_ptr<MissClassifier> classifier; // NULL unless misses are classified
+
+    MshrFile mshrs;           // outstanding misses, used by cache_access_nb()
 };
 
 
-class L1_ICache : public CacheBase
+// Set-associative cache level. The shape is fixed at compile time so the
+// tag search and replacement unroll into straight-line code; a zero 'Assoc'
+// or 'BlockBits' falls back to the runtime value for uncommon shapes.
+// Misses are forwarded to 'next', or to main memory when 'next' is NULL.
+//
+// Each set keeps its tags in one contiguous run and a valid mask, so a
+// lookup is one pass of compares. Fills take the lowest invalid way first
+// and only ask 'Policy' for a victim once the set is full.
+template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+class CacheKernel final : public CacheBase
 {
 public:
-    L1_ICache(uint32_t sets, uint32_t assoc, uint32_t blockSize, uint32_t hitTime, CacheType type) :
-    data(sets, vector<uint32_t>(assoc, 0)) {
-        this->sets = sets;
-        this->assoc = assoc;
-        this->blockSize = blockSize;
-        this->hitTime = hitTime;
-        this->type = type;
-
-        // statistics
-        this->refs = 0;
-        this->misses = 0;
-        this->penalties = 0;
-        this->compulsory_miss = 0;
-        this->other_miss = 0;
-    }
-    ~L1_ICache() {
-        for (int i = 0; i < sets; i++) {
-            data[i].clear();
-        }
-        data.clear();
-    }
-
-    uint32_t cache_access(uint32_t addr) override {
-        return 0;
-    }
-    uint32_t cache_prefetch_addr(uint32_t pc, uint32_t addr, bool rw) override {
-        return 0;
-    }
-    void cache_prefetch(uint32_t addr, PrefetchPolicy policy) override {
+    CacheKernel(uint32_t sets, uint32_t assoc, uint32_t blockSize, uint32_t hitTime, CacheType type,
+                CacheBase *next, uint32_t memspeed);
 
-    }
-    uint8_t cache_replace(uint32_t addr, ReplacePolicy policy) override {
-        return 0;
-    }
+    uint32_t cache_access(uint32_t addr, bool write) override;
+    uint32_t cache_access_nb(uint32_t addr, bool write, uint64_t now, bool wait, uint64_t &ready) override;
+    void cache_writeback(uint32_t addr, bool dirty) override;
+    void cache_write(uint32_t addr) override;
+    void cache_replay(const MissRecord *run, size_t n, uint64_t &ilatency, uint64_t &dlatency) override;
+    uint32_t cache_invalidate(uint32_t addr, uint32_t bytes, bool &dirty) override;
+    void set_inclusion(InclusionPolicy policy, const vector<CacheBase *> &above) override;
+    bool takes_victims() const override { return exclusive; }
+    bool cache_clean(uint32_t addr) override;
+    void cache_warm(uint32_t addr, bool write) override;
+    void save_state(CheckpointWriter &out) const override;
+    void load_state(CheckpointReader &in) override;
+    uint32_t cache_prefetch_addr(uint32_t pc, uint32_t addr, bool rw) override;
+    void cache_prefetch(uint32_t addr, PrefetchPolicy policy) override;
+    bool cache_probe(uint32_t addr) const override;
+    void cache_install(uint32_t addr, bool dirty) override;
+    uint8_t cache_replace(uint32_t addr) override;
 
 private:
-    vector<vector<uint32_t>> data;
-};
+    // Distant and long re-reference prediction values of the RRIP policies
+    static constexpr uint8_t RRPV_DISTANT = 3;
+    static constexpr uint8_t RRPV_LONG = 2;
+    // BRRIP inserts one fill in this many at RRPV_LONG
+    static constexpr uint32_t BRRIP_THROTTLE = 32;
+    // Blocks evicted by prefetches remembered to spot pollution misses
+    static constexpr uint32_t POLLUTION_FILTER = 1024;
 
+    uint32_t ways() const { return Assoc ? Assoc : assoc; }
+    uint32_t block_of(uint32_t addr) const { return addr >> (BlockBits ? BlockBits : blockBits); }
+    uint32_t set_of(uint32_t block) const { return block & setMask; }
+    // Returns the way holding 'block', or -1
+    int lookup(uint32_t block) const;
+    // Returns the way to fill in 'set': the lowest invalid way, otherwise
+    // the victim of the replacement policy
+    uint32_t victim(uint32_t set);
+    // Count a demand miss on 'block' in 'set'
+    void count_miss(uint32_t set, uint32_t block);
+    // Place 'block' into 'way' of 'set', 'prefetch' marks it unused and
+    // remembers the block it evicts
+    void fill(uint32_t set, uint32_t way, uint32_t block, bool prefetch, bool dirty);
+    // Write back, pass down or back-invalidate the line leaving 'way'
+    void evict(uint32_t set, uint32_t way);
+    // Move the line in 'way' up to the level above and drop it here
+    void hand_up(uint32_t set, uint32_t way);
+    // Send a store on to the level below, or to memory
+    void write_through(uint32_t addr);
+    // Update the replacement state of 'set' for a hit on 'way'
+    void touch(uint32_t set, uint32_t way);
 
-enum class CacheType
-{
-    L1_ICACHE,
-    L1_DCACHE,
-    L2_CACHE
+    vector<uint32_t> tags;   // block address (addr >> blockBits) per way
+    vector<uint64_t> valid;  // valid ways per set
+    vector<uint64_t> unused; // prefetched ways per set not yet used by a demand access
+    vector<uint64_t> dirty;  // written ways per set
+    vector<uint64_t> stamps; // LRU: last touch per way, larger is more recent
+    vector<uint8_t> rrpv;    // SRRIP/BRRIP: re-reference prediction per way
+    vector<uint64_t> state;  // FIFO: next way, PLRU: tree bits, NRU: reference bits
+    vector<uint64_t> evicted;// direct-mapped filter of (block << 1 | 1) evicted by prefetches
+    uint64_t wayMask;
+    uint32_t blockBits;
+    uint32_t setMask;
+    uint64_t clock;
+    CacheBase *next;
+    uint32_t memspeed;
+    vector<CacheBase *> above; // L1s to back-invalidate, inclusive only
+    bool victimsDown;        // every victim goes to 'next', a victim cache or exclusive L2
+    bool exclusive;          // hits move up, misses do not fill
 };
 
-enum class ReplacePolicy
-{
-    LRU,
-    FIFO,
-    PLRU
-};
+// Build a cache level, picking the specialized kernel for its shape when
+// one is instantiated and the generic kernel otherwise
+CacheBase *make_cache(uint32_t sets, uint32_t assoc, uint32_t blockSize, uint32_t hitTime, CacheType type,
+                      CacheBase *next, uint32_t memspeed, ReplacePolicy policy = ReplacePolicy::LRU);
 
-enum class PrefetchPolicy
+// The configuration of the command line without options: no caches, 16B
+// blocks, LRU everywhere, blocking levels, no prefetching and 50-cycle
+// memory. Set the levels wanted before building a CacheHierarchy.
+CacheConfig default_config();
+
+// Name of 'policy' as accepted on the command line
+const char *policy_name(ReplacePolicy policy);
+// Parse a policy name, returns false if 'name' is not one
+bool parse_policy(const char *name, ReplacePolicy &policy);
+
+class Prefetcher;
+class PrefetchQueue;
+class VictimCache;
+class WriteBuffer;
+class MissRecorder;
+class MissStreamWriter;
+
+// One independent I$/D$/L2$ hierarchy built from a CacheConfig. Instances
+// share nothing, so several can simulate side by side, one thread each.
+// The hierarchy is also the library interface of libcachesim.a; a bad
+// configuration stops the process, as it does the command line.
+class CacheHierarchy
 {
-    NEXT_LINE,
-    STRIDE,
-    STREAM
+public:
+    // With 'record', everything the L1s send the L2 is also written to it,
+    // see miss_stream.hpp
+    explicit CacheHierarchy(const CacheConfig &config, MissStreamWriter *record = NULL);
+    ~CacheHierarchy();
+    CacheHierarchy(const CacheHierarchy &) = delete;
+    CacheHierarchy &operator=(const CacheHierarchy &) = delete;
+
+    // Perform one trace access, 'i_or_d' selects the I$ or D$
+    // Return the access time for the memory operation
+    uint32_t access(uint32_t pc, uint32_t addr, char i_or_d, char r_or_w);
+
+    // Perform the accesses of 'batch' in order, as access() on each would
+    // Return their total access time
+    uint64_t access_batch(std::span<const MemAccess> batch);
+
+    // Warm the caches with one trace access, leaving the statistics, the
+    // clock and the prefetchers alone
+    void warm(uint32_t addr, char i_or_d, char r_or_w);
+
+    // Complete the recorded miss stream with the statistics of the L1s
+    void finish_record();
+    // Run the L2 on the miss stream at 'path', recorded with the same L1s,
+    // in place of a trace. stats() then reports what the recording run
+    // would have with this L2.
+    void replay(const char *path);
+
+    const CacheConfig &config() const { return cfg; }
+    CacheStats stats() const;
+    // Cycles simulated so far, the memory penalties of every access
+    uint64_t cycles() const { return totalPenalties; }
+
+    // Checkpoint every level, stage and prefetcher with the clock
+    void save_state(CheckpointWriter &out) const;
+    void load_state(CheckpointReader &in);
+
+private:
+    // Miss stream events replay() decodes at a time
+    static constexpr size_t REPLAY_BLOCK = 4096;
+
+    // access() with the L1s typed as 'ICache' and 'DCache': their kernels
+    // when access_batch() knows them, so their calls need no vtable, and
+    // CacheBase otherwise
+    template <class ICache, class DCache>
+    uint32_t access_as(ICache *l1i, DCache *l1d, uint32_t pc, uint32_t addr, bool data, bool write);
+    template <class ICache, class DCache>
+    uint64_t batch_as(ICache *l1i, DCache *l1d, std::span<const MemAccess> batch);
+    // batch_as() with the I-cache of the given kernel and the D-cache as
+    // the kernel of the same policy and block size it is, if it is one
+    template <uint32_t Assoc, uint32_t BlockBits, ReplacePolicy Policy>
+    uint64_t batch_dcache(CacheBase *l1i, std::span<const MemAccess> batch);
+    uint32_t l2cache_access(uint32_t addr, bool write, bool wait);
+    void set_mshrs(CacheBase *cache, uint32_t entries, uint32_t targets);
+    void set_inclusion();
+    // Access the first level 'cache', overlapping its misses when the MSHRs are on
+    template <class Cache>
+    uint32_t level_access(Cache *cache, uint32_t addr, bool write, bool wait);
+    uint32_t window_wait();
+    // Everything stats() reports but the L2's part, which the L1 penalties
+    // include the latencies of
+    CacheStats upper_stats() const;
+    // Access an L1 and let its prefetcher act on the outcome
+    template <class Cache>
+    uint32_t prefetch_access(Cache *cache, Prefetcher *prefetcher, PrefetchQueue *queue,
+                             PrefetchPolicy policy, uint32_t pc, uint32_t addr, bool write);
+
+    CacheConfig cfg;
+    CacheBase *icache;
+    CacheBase *dcache;
+    CacheBase *l2cache;
+    Prefetcher *iprefetcher;
+    Prefetcher *dprefetcher;
+    PrefetchQueue *iqueue;       // NULL when prefetches land at once
+    PrefetchQueue *dqueue;
+    VictimCache *ivictim;        // NULL without a victim cache
+    VictimCache *dvictim;
+    WriteBuffer *wbuffer;        // NULL without a write buffer
+    MissRecorder *irecorder;     // NULL unless recording a miss stream
+    MissRecorder *drecorder;
+    MissStreamWriter *record;
+    bool replayed;               // the L1 statistics come from a miss stream
+    CacheStats replayStats;
+    vector<uint32_t> prefetches; // addresses proposed by the last access
+    struct InFlight
+    {
+        uint64_t ready;          // cycle the access has its data
+        CacheBase *cache;        // cache it went to
+    };
+
+    bool overlap;                // misses go through the MSHRs
+    vector<InFlight> window;     // the last mshrWindow accesses, by trace position
+    size_t slot;                 // window entry of the current access
+    uint64_t totalRefs;
+    uint64_t totalPenalties;     // with the MSHRs on, also the clock of the core
 };
@@ -0,0 +1,171 @@
+//========================================================//
+//  checkpoint.cpp                                        //
+//  Checkpoint writer and mmap'd reader                   //
+//                                                        //
+//  See checkpoint.hpp for the on-disk layout             //
+//========================================================//
+
+#include "checkpoint.hpp"
+#include "parser.hpp"
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static_assert(sizeof(CheckpointHeader) == 72, "checkpoint header must stay 72 bytes");
+
+//------------------------------------//
+//         Checkpoint Writer          //
+//------------------------------------//
+
+CheckpointWriter::CheckpointWriter(const char *path, CheckpointKind kind, const void *config,
+                                   size_t configBytes)
+  : path(path), hdr{}
+{
+  out = fopen(path, "wb");
+  if (!out) {
+    fprintf(stderr, "Cannot create checkpoint '%s'\n", path);
+    exit(1);
+  }
+  setvbuf(out, NULL, _IOFBF, 1 << 20);
+  memcpy(hdr.magic, CHECKPOINT_MAGIC, 4);
+  hdr.version = CHECKPOINT_VERSION;
+  hdr.kind = kind;
+  hdr.configBytes = configBytes;
+  fwrite(&hdr, sizeof(hdr), 1, out);
+  fwrite(config, configBytes, 1, out);
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+  if (out) {
+    fclose(out);
+  }
+}
+
+void
+CheckpointWriter::put(const void *data, size_t bytes)
+{
+  fwrite(data, 1, bytes, out);
+  hdr.stateBytes += bytes;
+}
+
+void
+CheckpointWriter::finish(uint64_t offset, const TraceReader &trace)
+{
+  hdr.offset = offset;
+  hdr.trace = trace.position();
+  hdr.traceId = trace.identity();
+  fseek(out, 0, SEEK_SET);
+  fwrite(&hdr, sizeof(hdr), 1, out);
+  if (fclose(out)) {
+    fprintf(stderr, "Cannot write checkpoint '%s'\n", path);
+    exit(1);
+  }
+  out = NULL;
+}
+
+//------------------------------------//
+//         Checkpoint Reader          //
+//------------------------------------//
+
+CheckpointReader::CheckpointReader(const char *path, CheckpointKind kind, const void *config,
+                                   size_t configBytes)
+  : path(path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Cannot open checkpoint '%s'\n", path);
+    exit(1);
+  }
+  struct stat st;
+  fstat(fd, &st);
+  mapLen = st.st_size;
+  if (mapLen < sizeof(CheckpointHeader)) {
+    fprintf(stderr, "Checkpoint '%s' is too short for a header\n", path);
+    exit(1);
+  }
+  map = mmap(NULL, mapLen, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "Cannot map checkpoint '%s'\n", path);
+    exit(1);
+  }
+  madvise(map, mapLen, MADV_SEQUENTIAL);
+
+  hdr = (const CheckpointHeader *)map;
+  if (memcmp(hdr->magic, CHECKPOINT_MAGIC, 4) || hdr->version != CHECKPOINT_VERSION) {
+    fprintf(stderr, "'%s' is not a version %u checkpoint\n", path, CHECKPOINT_VERSION);
+    exit(1);
+  }
+  if (sizeof(CheckpointHeader) + hdr->configBytes + hdr->stateBytes != mapLen) {
+    corrupt();
+  }
+  cur = (const char *)(hdr + 1);
+  end = cur + hdr->configBytes + hdr->stateBytes;
+  if (hdr->kind != kind || hdr->configBytes != configBytes || memcmp(cur, config, configBytes)) {
+    fprintf(stderr, "Checkpoint '%s' was taken with another configuration\n", path);
+    exit(1);
+  }
+  cur += configBytes;
+}
+
+CheckpointReader::~CheckpointReader()
+{
+  munmap(map, mapLen);
+}
+
+void
+CheckpointReader::corrupt()
+{
+  fprintf(stderr, "Checkpoint '%s' is truncated or corrupt\n", path);
+  exit(1);
+}
+
+void
+CheckpointReader::get(void *data, size_t bytes)
+{
+  if ((size_t)(end - cur) < bytes) {
+    corrupt();
+  }
+  memcpy(data, cur, bytes);
+  cur += bytes;
+}
+
+uint64_t
+CheckpointReader::count(size_t size)
+{
+  uint64_t n;
+  get(n);
+  if (n > (uint64_t)(end - cur) / size) {
+    corrupt();
+  }
+  return n;
+}
+
+// A binary trace seeks straight to the position the checkpoint recorded,
+// a text trace is decoded up to it
+//
+void
+CheckpointReader::finish(TraceReader &trace)
+{
+  if (cur != end) {
+    corrupt();
+  }
+  if (hdr->traceId != trace.identity()) {
+    fprintf(stderr, "Checkpoint '%s' was taken on another trace\n", path);
+    exit(1);
+  }
+  if (hdr->trace.records && trace.seek(hdr->trace)) {
+    return;
+  }
+  MemAccess a;
+  for (uint64_t i = 0; i < hdr->offset; i++) {
+    if (!trace.next(a)) {
+      fprintf(stderr, "The trace ends before the %lu accesses of checkpoint '%s'\n", hdr->offset, path);
+      exit(1);
+    }
+  }
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <deque>
+#include <type_traits>
+#include "trace.hpp"
+
+//------------------------------------//
+//         Checkpoint Format          //
+//------------------------------------//
+//
+// A checkpoint is a 72-byte header, the configuration of the simulator that
+// wrote it and then the simulator state in the order it was saved. A vector
+// or deque is its 64-bit element count followed by the elements. Everything
+// is in host byte order: a checkpoint is restored on the host that took it.
+//
+
+enum class CheckpointKind : uint16_t
+{
+  HIERARCHY = 0, // cache: the whole CacheHierarchy
+  SIMPLE = 1     // simple: CacheSim
+};
+
+struct CheckpointHeader
+{
+  char     magic[4];       // "CCKP"
+  uint16_t version;
+  CheckpointKind kind;
+  uint64_t configBytes;    // length of the configuration after the header
+  uint64_t stateBytes;     // length of the state after the configuration
+  uint64_t offset;         // trace accesses simulated before the checkpoint
+  TracePosition trace;     // where a binary trace resumes
+  uint64_t traceId;        // TraceReader::identity() of the trace it was taken on
+};
+
+constexpr char     CHECKPOINT_MAGIC[4] = {'C', 'C', 'K', 'P'};
+constexpr uint16_t CHECKPOINT_VERSION  = 4;
+
+class TraceReader;
+
+// Writes a checkpoint of the simulator 'kind' configured by 'config'. The
+// header is completed by finish().
+class CheckpointWriter
+{
+public:
+  CheckpointWriter(const char *path, CheckpointKind kind, const void *config, size_t configBytes);
+  ~CheckpointWriter();
+  CheckpointWriter(const CheckpointWriter &) = delete;
+  CheckpointWriter &operator=(const CheckpointWriter &) = delete;
+
+  void put(const void *data, size_t bytes);
+
+  template <typename T>
+  void put(const T &v)
+  {
+    static_assert(std::is_trivially_copyable_v<T>, "only plain data goes into a checkpoint");
+    put(&v, sizeof(v));
+  }
+
+  template <typename T>
+  void put(const std::vector<T> &v)
+  {
+    static_assert(std::is_trivially_copyable_v<T>, "only plain data goes into a checkpoint");
+    put((uint64_t)v.size());
+    put(v.data(), v.size() * sizeof(T));
+  }
+
+  template <typename T>
+  void put(const std::deque<T> &v)
+  {
+    put((uint64_t)v.size());
+    for (const T &e : v) {
+      put(e);
+    }
+  }
+
+  // Record where the run stands in 'trace' and close the file
+  void finish(uint64_t offset, const TraceReader &trace);
+
+private:
+  FILE *out;
+  const char *path;
+  CheckpointHeader hdr;
+};
+
+// Maps a checkpoint and hands its state back in the order it was written.
+// Restoring into a simulator of another kind or configuration or onto
+// another trace is refused, as is a short or overlong state.
+class CheckpointReader
+{
+public:
+  CheckpointReader(const char *path, CheckpointKind kind, const void *config, size_t configBytes);
+  ~CheckpointReader();
+  CheckpointReader(const CheckpointReader &) = delete;
+  CheckpointReader &operator=(const CheckpointReader &) = delete;
+
+  const CheckpointHeader &header() const { return *hdr; }
+
+  void get(void *data, size_t bytes);
+
+  template <typename T>
+  void get(T &v)
+  {
+    static_assert(std::is_trivially_copyable_v<T>, "only plain data goes into a checkpoint");
+    get(&v, sizeof(v));
+  }
+
+  template <typename T>
+  void get(std::vector<T> &v)
+  {
+    v.resize(count(sizeof(T)));
+    get(v.data(), v.size() * sizeof(T));
+  }
+
+  template <typename T>
+  void get(std::deque<T> &v)
+  {
+    v.resize(count(sizeof(T)));
+    for (T &e : v) {
+      get(e);
+    }
+  }
+
+  // Check that the whole state was read and that 'trace' is the one the
+  // checkpoint was taken on, then move it just past the accesses covered
+  void finish(TraceReader &trace);
+
+private:
+  // Element count of the next vector, checked against what is left
+  uint64_t count(size_t size);
+  [[noreturn]] void corrupt();
+
+  const char *path;
+  void *map;
+  size_t mapLen;
+  const CheckpointHeader *hdr;
+  const char *cur;
+  const char *end;
+};
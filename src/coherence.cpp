@@ -0,0 +1,363 @@
+//========================================================//
+//  coherence.cpp                                         //
+//  Multi-core support for the Cache Simulator            //
+//                                                        //
+//  Private L1s per core kept coherent with MESI over     //
+//  a shared L2                                           //
+//========================================================//
+
+#include "coherence.hpp"
+#include <stdio.h>
+#include <algorithm>
+#include <bit>
+
+//------------------------------------//
+//          Coherence Bus             //
+//------------------------------------//
+
+CoherenceBus::CoherenceBus(uint32_t blockSize, CacheBase *l2, uint32_t transferTime)
+  : blockSize(blockSize), blockBits(countr_zero(blockSize)), l2(l2), transferTime(transferTime), counts{}
+{
+}
+
+uint32_t
+CoherenceBus::attach(CoherentPort *port)
+{
+  if (ports.size() == 64) {
+    fprintf(stderr,"At most 64 L1s can share the bus\n");
+    exit(1);
+  }
+  ports.push_back(port);
+  return ports.size() - 1;
+}
+
+bool
+CoherenceBus::read(uint32_t id, uint32_t addr, uint32_t &latency)
+{
+  uint32_t block = addr >> blockBits;
+  uint64_t self = 1ull << id;
+  Entry &e = dir[block];
+
+  // the line was taken away by a store, was that store to this word
+  if (e.lost & self) {
+    counts.coherenceMisses++;
+    if (!(e.written >> word_of(addr) & 1)) {
+      counts.falseSharing++;
+      falseMisses[block]++;
+    }
+    e.lost &= ~self;
+    if (!e.lost) {
+      e.written = 0;
+    }
+  }
+
+  // M -> S: the owner supplies the line and updates the L2
+  bool supplied = false;
+  for (uint64_t others = e.sharers & ~self; others; others &= others - 1) {
+    if (ports[countr_zero(others)]->l1()->cache_clean(addr)) {
+      l2->cache_writeback(addr, true);
+      supplied = true;
+    }
+  }
+  e.sharers |= self;
+  if (supplied) {
+    counts.transfers++;
+    latency = transferTime;
+  }
+  return supplied;
+}
+
+void
+CoherenceBus::upgrade(uint32_t id, uint32_t addr)
+{
+  uint64_t self = 1ull << id;
+  Entry &e = dir[addr >> blockBits];
+  uint64_t others = e.sharers & ~self;
+  e.sharers |= self;
+  if (!others) {
+    // E -> M
+    return;
+  }
+  // S -> M, every other copy goes
+  counts.upgrades++;
+  for (; others; others &= others - 1) {
+    uint32_t p = countr_zero(others);
+    bool dirty = false;
+    counts.invalidations += ports[p]->l1()->cache_invalidate(addr, blockSize, dirty);
+    if (dirty) {
+      l2->cache_writeback(addr, true);
+    }
+    e.lost |= 1ull << p;
+  }
+  e.sharers = self;
+}
+
+void
+CoherenceBus::evicted(uint32_t id, uint32_t addr)
+{
+  auto it = dir.find(addr >> blockBits);
+  if (it == dir.end()) {
+    return;
+  }
+  it->second.sharers &= ~(1ull << id);
+  if (!it->second.sharers && !it->second.lost) {
+    dir.erase(it);
+  }
+}
+
+void
+CoherenceBus::store(uint32_t addr)
+{
+  auto it = dir.find(addr >> blockBits);
+  if (it != dir.end() && it->second.lost) {
+    it->second.written |= 1ull << word_of(addr);
+  }
+}
+
+vector<HotBlock>
+CoherenceBus::hot_blocks(size_t n) const
+{
+  vector<HotBlock> hot;
+  for (const auto &[block, misses] : falseMisses) {
+    hot.push_back(HotBlock{block << blockBits, misses});
+  }
+  n = min(n, hot.size());
+  partial_sort(hot.begin(), hot.begin() + n, hot.end(), [](const HotBlock &a, const HotBlock &b) {
+    return a.misses != b.misses ? a.misses > b.misses : a.addr < b.addr;
+  });
+  hot.resize(n);
+  return hot;
+}
+
+//------------------------------------//
+//          Coherent Port             //
+//------------------------------------//
+
+CoherentPort::CoherentPort(CoherenceBus *bus, uint32_t blockSize, CacheType type, CacheBase *next)
+  : CacheStage(blockSize, 0, type, next), bus(bus)
+{
+  id = bus->attach(this);
+}
+
+uint32_t
+CoherentPort::cache_access(uint32_t addr, bool write)
+{
+  uint32_t latency;
+  refs++;
+  if (bus->read(id, addr, latency)) {
+    return latency;
+  }
+  misses++;
+  latency = next->cache_access(addr, false);
+  handedDirty = next->take_dirty();
+  return latency;
+}
+
+uint32_t
+CoherentPort::cache_access_nb(uint32_t addr, bool write, uint64_t now, bool wait, uint64_t &ready)
+{
+  uint32_t latency;
+  refs++;
+  if (bus->read(id, addr, latency)) {
+    ready = now + latency;
+    return latency;
+  }
+  misses++;
+  latency = next->cache_access_nb(addr, false, now, wait, ready);
+  handedDirty = next->take_dirty();
+  return latency;
+}
+
+void
+CoherentPort::cache_writeback(uint32_t addr, bool dirty)
+{
+  bus->evicted(id, addr);
+  if (dirty) {
+    next->cache_writeback(addr, true);
+  }
+}
+
+void
+CoherentPort::cache_write(uint32_t addr)
+{
+  next->cache_write(addr);
+}
+
+// An inclusive L2 dropped the line, so does the L1
+//
+uint32_t
+CoherentPort::cache_invalidate(uint32_t addr, uint32_t bytes, bool &dirty)
+{
+  uint32_t count = bytes > blockSize ? bytes / blockSize : 1;
+  for (uint32_t i = 0; i < count; i++) {
+    bus->evicted(id, addr + i * blockSize);
+  }
+  return up ? up->cache_invalidate(addr, bytes, dirty) : 0;
+}
+
+void
+CoherentPort::cache_upgrade(uint32_t addr)
+{
+  bus->upgrade(id, addr);
+}
+
+void
+CoherentPort::cache_prefetch(uint32_t addr, PrefetchPolicy policy)
+{
+  uint32_t latency;
+  if (!bus->read(id, addr, latency)) {
+    next->cache_prefetch(addr, policy);
+  }
+  handedDirty = false;
+}
+
+bool
+CoherentPort::cache_probe(uint32_t addr) const
+{
+  return next->cache_probe(addr);
+}
+
+//------------------------------------//
+//        Multi-Core Hierarchy        //
+//------------------------------------//
+
+MultiCoreHierarchy::MultiCoreHierarchy(const CacheConfig &config, uint32_t n)
+  : cfg(config), l2cache(NULL), bus(NULL)
+{
+  if (!cfg.icacheSets || !cfg.dcacheSets || !cfg.l2cacheSets) {
+    fprintf(stderr,"A multi-core run needs an I-cache and a D-cache per core and the shared L2\n");
+    exit(1);
+  }
+  if (cfg.icacheBlocksize != cfg.dcacheBlocksize || cfg.l2cacheBlocksize < cfg.dcacheBlocksize) {
+    fprintf(stderr,"Coherent L1s need the same blocksize, at most that of the L2\n");
+    exit(1);
+  }
+  l2cache = make_cache(cfg.l2cacheSets, cfg.l2cacheAssoc, cfg.l2cacheBlocksize, cfg.l2cacheHitTime,
+                       CacheType::L2_CACHE, NULL, cfg.memspeed, cfg.l2cachePolicy);
+  bus = new CoherenceBus(cfg.dcacheBlocksize, l2cache, cfg.transferTime ? cfg.transferTime : cfg.l2cacheHitTime);
+
+  vector<CacheBase *> ports;
+  for (uint32_t c = 0; c < n; c++) {
+    Core k = {};
+    k.iport = new CoherentPort(bus, cfg.icacheBlocksize, CacheType::L1_ICACHE, l2cache);
+    k.icache = make_cache(cfg.icacheSets, cfg.icacheAssoc, cfg.icacheBlocksize, cfg.icacheHitTime,
+                          CacheType::L1_ICACHE, k.iport, cfg.memspeed, cfg.icachePolicy);
+    k.dport = new CoherentPort(bus, cfg.dcacheBlocksize, CacheType::L1_DCACHE, l2cache);
+    k.dcache = make_cache(cfg.dcacheSets, cfg.dcacheAssoc, cfg.dcacheBlocksize, cfg.dcacheHitTime,
+                          CacheType::L1_DCACHE, k.dport, cfg.memspeed, cfg.dcachePolicy);
+    k.dcache->set_coherent(true);
+    if (cfg.classifyMisses) {
+      k.icache->classify_misses(cfg.classifySampled);
+      k.dcache->classify_misses(cfg.classifySampled);
+    }
+    ports.push_back(k.iport);
+    ports.push_back(k.dport);
+    cores.push_back(k);
+  }
+
+  // the L2 first, the L1s then see that their ports take every victim
+  l2cache->set_inclusion(cfg.inclusion, ports);
+  if (cfg.classifyMisses) {
+    l2cache->classify_misses(cfg.classifySampled);
+  }
+  for (Core &k : cores) {
+    k.iport->set_inclusion(cfg.inclusion, {k.icache});
+    k.dport->set_inclusion(cfg.inclusion, {k.dcache});
+    k.icache->set_inclusion(cfg.inclusion, {});
+    k.dcache->set_inclusion(cfg.inclusion, {});
+  }
+}
+
+MultiCoreHierarchy::~MultiCoreHierarchy()
+{
+  for (Core &k : cores) {
+    delete k.icache;
+    delete k.dcache;
+    delete k.iport;
+    delete k.dport;
+  }
+  delete l2cache;
+  delete bus;
+}
+
+uint32_t
+MultiCoreHierarchy::access(uint32_t core, uint32_t addr, char i_or_d, char r_or_w)
+{
+  Core &k = cores[core];
+  uint32_t penalty;
+  if (i_or_d == 'I') {
+    penalty = k.icache->cache_access(addr, false);
+  } else {
+    bool write = r_or_w == 'W';
+    penalty = k.dcache->cache_access(addr, write);
+    if (write) {
+      bus->store(addr);
+    }
+  }
+  k.refs++;
+  k.penalties += penalty;
+  return penalty;
+}
+
+CacheStats
+MultiCoreHierarchy::core_stats(uint32_t core) const
+{
+  const Core &k = cores[core];
+  CacheStats s = {};
+  s.icacheRefs = k.icache->get_refs();
+  s.icacheMisses = k.icache->get_misses();
+  s.icachePenalties = k.icache->get_penalties();
+  s.icacheWritebacks = k.icache->get_writebacks();
+  s.dcacheRefs = k.dcache->get_refs();
+  s.dcacheMisses = k.dcache->get_misses();
+  s.dcachePenalties = k.dcache->get_penalties();
+  s.dcacheWritebacks = k.dcache->get_writebacks();
+  s.compulsory_miss = k.icache->get_compulsory_miss() + k.dcache->get_compulsory_miss();
+  s.other_miss = k.icache->get_other_miss() + k.dcache->get_other_miss();
+  if (cfg.classifyMisses) {
+    s.icacheClasses = k.icache->get_classifier()->stats();
+    s.dcacheClasses = k.dcache->get_classifier()->stats();
+  }
+  s.totalRefs = k.refs;
+  s.totalPenalties = k.penalties;
+  return s;
+}
+
+CacheStats
+MultiCoreHierarchy::stats() const
+{
+  CacheStats s = {};
+  for (uint32_t c = 0; c < cores.size(); c++) {
+    CacheStats k = core_stats(c);
+    s.icacheRefs += k.icacheRefs;
+    s.icacheMisses += k.icacheMisses;
+    s.icachePenalties += k.icachePenalties;
+    s.icacheWritebacks += k.icacheWritebacks;
+    s.dcacheRefs += k.dcacheRefs;
+    s.dcacheMisses += k.dcacheMisses;
+    s.dcachePenalties += k.dcachePenalties;
+    s.dcacheWritebacks += k.dcacheWritebacks;
+    s.compulsory_miss += k.compulsory_miss;
+    s.other_miss += k.other_miss;
+    s.totalRefs += k.totalRefs;
+    s.totalPenalties += k.totalPenalties;
+    for (auto [sum, one] : {pair{&s.icacheClasses, &k.icacheClasses}, pair{&s.dcacheClasses, &k.dcacheClasses}}) {
+      sum->compulsory += one->compulsory;
+      sum->capacity += one->capacity;
+      sum->conflict += one->conflict;
+    }
+  }
+  if (cfg.classifyMisses) {
+    s.l2cacheClasses = l2cache->get_classifier()->stats();
+  }
+  s.l2cacheRefs = l2cache->get_refs();
+  s.l2cacheMisses = l2cache->get_misses();
+  s.l2cachePenalties = l2cache->get_penalties();
+  s.l2cacheWritebacks = l2cache->get_writebacks();
+  s.compulsory_miss += l2cache->get_compulsory_miss();
+  s.other_miss += l2cache->get_other_miss();
+  s.backInvalidations = l2cache->get_back_invalidations();
+  s.memoryReads = l2cache->get_fetches();
+  s.memoryWrites = l2cache->get_writebacks();
+  return s;
+}
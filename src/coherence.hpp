@@ -0,0 +1,146 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+#include "cache.hpp"
+#include "stages.hpp"
+
+using namespace std;
+
+//------------------------------------//
+//         MESI Coherence             //
+//------------------------------------//
+
+struct CoherenceStats
+{
+    uint64_t invalidations;    // L1 lines invalidated by another L1's store
+    uint64_t upgrades;         // Stores to shared lines that invalidated the other copies
+    uint64_t transfers;        // Misses served by another L1 holding the line modified
+    uint64_t coherenceMisses;  // Misses on lines lost to an invalidation
+    uint64_t falseSharing;     // Of those, misses on a word no other core wrote
+};
+
+struct HotBlock
+{
+    uint32_t addr;
+    uint64_t misses;           // false-sharing misses on the block
+};
+
+class CoherentPort;
+
+// Directory of the L1 lines above the shared L2, the bus every coherent L1
+// reaches the L2 through. It keeps the set of L1s holding each block; with
+// the L1 dirty bit that gives the MESI state of every copy: dirty is M, a
+// clean line is E when it is the only copy and S otherwise. A read miss
+// finds the line modified in another L1 and takes it from there (a
+// cache-to-cache transfer, the owner keeps a clean copy and the L2 is
+// updated). A store to a clean line invalidates every other copy; a store
+// to an E line does so silently.
+class CoherenceBus
+{
+public:
+    CoherenceBus(uint32_t blockSize, CacheBase *l2, uint32_t transferTime);
+
+    // Join the L1 behind 'port' to the bus
+    uint32_t attach(CoherentPort *port);
+    // A miss of L1 'id' on 'addr'. Returns true, with the transfer time in
+    // 'latency', when another L1 supplied the line.
+    bool read(uint32_t id, uint32_t addr, uint32_t &latency);
+    // L1 'id' wrote the clean line at 'addr'
+    void upgrade(uint32_t id, uint32_t addr);
+    // L1 'id' no longer holds 'addr'
+    void evicted(uint32_t id, uint32_t addr);
+    // A core stored to 'addr', remembered to tell true from false sharing
+    void store(uint32_t addr);
+
+    const CoherenceStats &stats() const { return counts; }
+    // The 'n' blocks with the most false-sharing misses
+    vector<HotBlock> hot_blocks(size_t n) const;
+
+private:
+    struct Entry
+    {
+        uint64_t sharers;  // L1s holding the block
+        uint64_t lost;     // L1s whose copy a store invalidated, until they miss on it
+        uint64_t written;  // words stored to while a copy was lost
+    };
+
+    uint32_t word_of(uint32_t addr) const { return (addr & (blockSize - 1)) >> 2 & 63; }
+
+    unordered_map<uint32_t, Entry> dir;
+    unordered_map<uint32_t, uint64_t> falseMisses;
+    vector<CoherentPort *> ports;
+    uint32_t blockSize;
+    uint32_t blockBits;
+    CacheBase *l2;
+    uint32_t transferTime;
+    CoherenceStats counts;
+};
+
+// Connects one L1 to the bus and the shared L2. It sees every miss and
+// victim of its L1 and the first store to each clean line.
+class CoherentPort final : public CacheStage
+{
+public:
+    CoherentPort(CoherenceBus *bus, uint32_t blockSize, CacheType type, CacheBase *next);
+
+    uint32_t cache_access(uint32_t addr, bool write) override;
+    uint32_t cache_access_nb(uint32_t addr, bool write, uint64_t now, bool wait, uint64_t &ready) override;
+    void cache_writeback(uint32_t addr, bool dirty) override;
+    void cache_write(uint32_t addr) override;
+    uint32_t cache_invalidate(uint32_t addr, uint32_t bytes, bool &dirty) override;
+    bool takes_victims() const override { return true; }
+    void cache_upgrade(uint32_t addr) override;
+    void cache_prefetch(uint32_t addr, PrefetchPolicy policy) override;
+    bool cache_probe(uint32_t addr) const override;
+
+    // The L1 this port serves
+    CacheBase *l1() const { return up; }
+
+private:
+    CoherenceBus *bus;
+    uint32_t id;
+};
+
+// Private I$/D$ per core over one shared L2, kept coherent by a
+// CoherenceBus. Accesses are blocking; the cores are interleaved by the
+// caller.
+class MultiCoreHierarchy
+{
+public:
+    MultiCoreHierarchy(const CacheConfig &config, uint32_t cores);
+    ~MultiCoreHierarchy();
+    MultiCoreHierarchy(const MultiCoreHierarchy &) = delete;
+    MultiCoreHierarchy &operator=(const MultiCoreHierarchy &) = delete;
+
+    // Perform one trace access of 'core'
+    // Return the access time for the memory operation
+    uint32_t access(uint32_t core, uint32_t addr, char i_or_d, char r_or_w);
+
+    // Cycles 'core' has spent on memory accesses
+    uint64_t cycles(uint32_t core) const { return cores[core].penalties; }
+
+    // All cores summed, with the shared L2
+    CacheStats stats() const;
+    // The L1s and totals of one core
+    CacheStats core_stats(uint32_t core) const;
+    const CoherenceStats &coherence() const { return bus->stats(); }
+    vector<HotBlock> hot_blocks(size_t n) const { return bus->hot_blocks(n); }
+
+private:
+    struct Core
+    {
+        CacheBase *icache;
+        CacheBase *dcache;
+        CoherentPort *iport;
+        CoherentPort *dport;
+        uint64_t refs;
+        uint64_t penalties;
+    };
+
+    CacheConfig cfg;
+    vector<Core> cores;
+    CacheBase *l2cache;
+    CoherenceBus *bus;
+};
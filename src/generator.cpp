@@ -0,0 +1,299 @@
+//========================================================//
+//  generator.cpp                                         //
+//  Synthetic trace generator                             //
+//                                                        //
+//  See generator.hpp for the patterns and the spec       //
+//========================================================//
+
+#include "generator.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <numeric>
+
+#define GEN_PREFIX "gen:"
+
+bool
+is_generated_trace(const char *path)
+{
+  return path && !strncmp(path, GEN_PREFIX, strlen(GEN_PREFIX));
+}
+
+//------------------------------------//
+//           Zipf Sampling            //
+//------------------------------------//
+
+// log1p(x)/x and expm1(x)/x, kept accurate around 0
+static double
+log1p_over(double x)
+{
+  return fabs(x) > 1e-8 ? log1p(x) / x : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+}
+
+static double
+expm1_over(double x)
+{
+  return fabs(x) > 1e-8 ? expm1(x) / x : 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
+}
+
+ZipfSampler::ZipfSampler(uint64_t n, double alpha)
+  : n(n), alpha(alpha), first(n > HEAD ? HEAD + 1 : n + 1)
+{
+  // Weights of the head ranks and of the whole tail, the tail summed by
+  // Euler-Maclaurin; its terms are small enough past HEAD for the first
+  // derivative term to leave a relative error near 1e-12
+  std::vector<double> weight;
+  for (uint64_t k = 1; k < first; k++) {
+    weight.push_back(h(k));
+  }
+  if (first <= n) {
+    double a = first, b = n;
+    weight.push_back(h_integral(b) - h_integral(a) + (h(a) + h(b)) / 2 +
+                     alpha * (h(a) / a - h(b) / b) / 12);
+  }
+
+  // Vose's alias method: every bucket holds one outcome's share of 1/size,
+  // topped up from an outcome with more than that
+  size_t size = weight.size();
+  double total = 0;
+  for (double w : weight) {
+    total += w;
+  }
+  std::vector<double> p(size);
+  std::vector<uint32_t> small, large;
+  for (size_t i = 0; i < size; i++) {
+    p[i] = weight[i] * size / total;
+    (p[i] < 1 ? small : large).push_back(i);
+  }
+  head.resize(size);
+  while (!small.empty() && !large.empty()) {
+    uint32_t l = small.back(), g = large.back();
+    small.pop_back();
+    head[l] = Bucket{(uint32_t)(p[l] * 0x1.0p32), g};
+    p[g] -= 1 - p[l];
+    if (p[g] < 1) {
+      large.pop_back();
+      small.push_back(g);
+    }
+  }
+  // what is left holds a whole bucket, up to rounding
+  for (uint32_t i : small) {
+    head[i] = Bucket{0, i};
+  }
+  for (uint32_t i : large) {
+    head[i] = Bucket{0, i};
+  }
+
+  // rejection-inversion over the tail ranks first .. n
+  hIntegralFirst = h_integral(first + 0.5) - h(first);
+  hIntegralN = h_integral(n + 0.5);
+  s = first + 1 - h_integral_inverse(h_integral(first + 1.5) - h(first + 1));
+}
+
+// The unnormalized probability of rank 'x'
+double
+ZipfSampler::h(double x) const
+{
+  return exp(-alpha * log(x));
+}
+
+// An integral of h(), which rejection-inversion samples under
+double
+ZipfSampler::h_integral(double x) const
+{
+  double logX = log(x);
+  return expm1_over((1 - alpha) * logX) * logX;
+}
+
+double
+ZipfSampler::h_integral_inverse(double x) const
+{
+  double t = x * (1 - alpha);
+  return exp(log1p_over(t < -1 ? -1 : t) * x);
+}
+
+//------------------------------------//
+//          Spec Parsing              //
+//------------------------------------//
+
+[[noreturn]] static void
+bad_spec(const char *path, const char *why)
+{
+  fprintf(stderr,"Trace '%s': %s\n", path, why);
+  exit(1);
+}
+
+// A number with an optional K, M or G suffix of powers of 'unit'
+//
+static bool
+parse_count(const char *s, uint64_t unit, uint64_t &v)
+{
+  char *end;
+  v = strtoull(s, &end, 0);
+  if (end == s) {
+    return false;
+  }
+  switch (*end) {
+  case 'G': case 'g': v *= unit;  // fall through
+  case 'M': case 'm': v *= unit;  // fall through
+  case 'K': case 'k': v *= unit; end++; break;
+  }
+  return *end == '\0';
+}
+
+static GeneratorConfig
+parse_generator(const char *path)
+{
+  static const char *patterns[] = { "seq", "stride", "uniform", "zipf", "chase", "mixed" };
+
+  GeneratorConfig cfg = {};
+  cfg.dialect = TraceDialect::CSE240;
+  cfg.records = 10000000;
+  cfg.footprint = 1 << 20;
+  cfg.base = 0x10000000;
+  cfg.stride = 64;
+  cfg.alpha = 0.99;
+  cfg.writes = 25;
+  cfg.ifetch = 50;
+  cfg.code = 64 << 10;
+  cfg.seed = 1;
+
+  char spec[256];
+  snprintf(spec, sizeof(spec), "%s", path + strlen(GEN_PREFIX));
+  char *save = NULL;
+  char *name = strtok_r(spec, ",", &save);
+  size_t p = 0;
+  while (name && p < sizeof(patterns) / sizeof(patterns[0]) && strcasecmp(name, patterns[p])) {
+    p++;
+  }
+  if (!name || p == sizeof(patterns) / sizeof(patterns[0])) {
+    bad_spec(path, "the pattern is seq, stride, uniform, zipf, chase or mixed");
+  }
+  cfg.pattern = (TracePattern)p;
+
+  for (char *kv; (kv = strtok_r(NULL, ",", &save));) {
+    char *value = strchr(kv, '=');
+    if (!value) {
+      bad_spec(path, "options are key=value");
+    }
+    *value++ = '\0';
+    uint64_t v = 0;
+    bool ok;
+    if (!strcmp(kv, "records")) {
+      ok = parse_count(value, 1000, cfg.records) && cfg.records;
+    } else if (!strcmp(kv, "footprint")) {
+      ok = parse_count(value, 1024, cfg.footprint);
+    } else if (!strcmp(kv, "base")) {
+      ok = parse_count(value, 1024, cfg.base);
+    } else if (!strcmp(kv, "stride")) {
+      ok = parse_count(value, 1024, cfg.stride) && cfg.stride;
+    } else if (!strcmp(kv, "alpha")) {
+      ok = sscanf(value, "%lf", &cfg.alpha) == 1 && cfg.alpha > 0;
+    } else if (!strcmp(kv, "writes")) {
+      ok = parse_count(value, 1, v) && v <= 100;
+      cfg.writes = v;
+    } else if (!strcmp(kv, "ifetch")) {
+      ok = parse_count(value, 1, v) && v <= 100;
+      cfg.ifetch = v;
+    } else if (!strcmp(kv, "code")) {
+      ok = parse_count(value, 1024, cfg.code) && cfg.code >= 4;
+    } else if (!strcmp(kv, "seed")) {
+      ok = parse_count(value, 1, cfg.seed);
+    } else if (!strcmp(kv, "dialect")) {
+      ok = true;
+      if (!strcasecmp(value, "simple")) {
+        cfg.dialect = TraceDialect::SIMPLE;
+      } else if (strcasecmp(value, "cse240")) {
+        ok = false;
+      }
+    } else {
+      bad_spec(path, "unknown option, see generator.hpp");
+    }
+    if (!ok) {
+      bad_spec(path, "bad option value");
+    }
+  }
+
+  if (cfg.footprint < (1u << 6) || cfg.stride > cfg.footprint) {
+    bad_spec(path, "the footprint needs at least one 64-byte block and a stride at most its size");
+  }
+  if (cfg.dialect == TraceDialect::CSE240 && cfg.base + cfg.footprint > 1ull << 32) {
+    bad_spec(path, "I/D traces have 32-bit addresses, base + footprint must stay below 4G");
+  }
+  if (cfg.dialect == TraceDialect::SIMPLE && cfg.pattern == TracePattern::MIXED) {
+    bad_spec(path, "simple traces have no instruction fetches to mix in");
+  }
+  return cfg;
+}
+
+//------------------------------------//
+//          Trace Generator           //
+//------------------------------------//
+
+TraceGenerator::TraceGenerator(const char *path)
+  : cfg(parse_generator(path)), n(0), walk(0), zipf(cfg.footprint >> NODE_BITS, cfg.alpha), node(0)
+{
+  // xorshift must not start at 0
+  state = cfg.seed * 0x9E3779B97F4A7C15ull | 1;
+  pc = CODE_BASE;
+  codeWords = cfg.code / 4;
+  words = cfg.footprint / 4;
+
+  // the golden-ratio point of the blocks, made coprime with their count so
+  // rank * scatter % blocks visits every block
+  blocks = cfg.footprint >> NODE_BITS;
+  scatter = (uint64_t)(blocks * 0.6180339887) | 1;
+  while (std::gcd(scatter, blocks) != 1) {
+    scatter += 2;
+  }
+
+  nodeMask = (1ull << (63 - __builtin_clzll(blocks))) - 1;
+  chaseShift = (64 - __builtin_clzll(nodeMask | 1)) / 2 + 1;
+}
+
+// A uniform integer below 'n'
+static inline uint64_t
+below(uint64_t r, uint64_t n)
+{
+  return (unsigned __int128)r * n >> 64;
+}
+
+uint64_t
+TraceGenerator::data_address(TracePattern pattern)
+{
+  switch (pattern) {
+  case TracePattern::SEQUENTIAL: {
+    uint64_t addr = cfg.base + walk;
+    walk = walk + 4 < cfg.footprint ? walk + 4 : 0;
+    return addr;
+  }
+  case TracePattern::STRIDED: {
+    uint64_t addr = cfg.base + walk;
+    walk += cfg.stride;
+    walk = walk < cfg.footprint ? walk : walk - cfg.footprint;
+    return addr;
+  }
+  case TracePattern::UNIFORM:
+    return cfg.base + below(random(), words) * 4;
+  case TracePattern::ZIPF: {
+    uint64_t rank = zipf.sample([this] { return random(); }) - 1;
+    uint64_t block = (unsigned __int128)rank * scatter % blocks;
+    return cfg.base + (block << NODE_BITS) + below(random(), 1 << (NODE_BITS - 2)) * 4;
+  }
+  case TracePattern::CHASE: {
+    // a full-period LCG over the nodes, scrambled by an odd multiply and
+    // an xorshift, both one-to-one on the node bits
+    node = (node * 0x5851F42D4C957F2Dull + 0x14057B7EF767814Full) & nodeMask;
+    uint64_t v = node * 0x9E3779B97F4A7C15ull & nodeMask;
+    v ^= v >> chaseShift;
+    return cfg.base + (v << NODE_BITS);
+  }
+  case TracePattern::MIXED: {
+    uint64_t mix = below(random(), 10);
+    return data_address(mix < 6 ? TracePattern::ZIPF : mix < 9 ? TracePattern::STRIDED : TracePattern::UNIFORM);
+  }
+  }
+  return cfg.base;
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "trace.hpp"
+
+//------------------------------------//
+//          Synthetic Traces          //
+//------------------------------------//
+//
+// A trace path 'gen:<pattern>[,<key>=<value>...]' reads a generated stream
+// instead of a file, for example
+//
+//   gen:zipf,records=1G,footprint=64M,alpha=0.9,seed=7
+//
+// The stream is a pure function of the spec, so the same spec replays the
+// same trace. Nothing is read from or written to disk; 'convert' saves a
+// stream in either format.
+//
+// Patterns of the data addresses, each over 'footprint' bytes from 'base':
+//   seq      consecutive words
+//   stride   every 'stride' bytes, wrapping around the footprint
+//   uniform  words picked uniformly at random
+//   zipf     64-byte blocks picked with Zipf(alpha) popularity, the hot
+//            blocks scattered over the footprint
+//   chase    a pointer chase visiting every 64-byte node once per round in
+//            a fixed random order; the node count is the footprint's
+//            rounded down to a power of two
+//   mixed    'ifetch' percent instruction fetches running through a
+//            'code'-byte text segment, a branch every 8 instructions or so;
+//            the data accesses are 60% zipf, 30% stride and 10% uniform
+//
+// Other keys: 'records' (default 10M), 'footprint' (1M), 'base'
+// (0x10000000), 'stride' (64), 'alpha' (0.99), 'writes' (percent of data
+// accesses that store, 25), 'ifetch' (50), 'code' (64K), 'seed' (1) and
+// 'dialect' (cse240, or simple for '# <rw> <addr> <insts>' records).
+// Sizes and counts take a K, M or G suffix (powers of 1024 for sizes, of
+// 1000 for 'records').
+//
+
+enum class TracePattern
+{
+  SEQUENTIAL,
+  STRIDED,
+  UNIFORM,
+  ZIPF,
+  CHASE,
+  MIXED
+};
+
+struct GeneratorConfig
+{
+  TracePattern pattern;
+  TraceDialect dialect;
+  uint64_t records;    // accesses in the trace
+  uint64_t footprint;  // bytes the data accesses spread over
+  uint64_t base;       // lowest data address
+  uint64_t stride;     // bytes between strided accesses
+  double   alpha;      // Zipf exponent, larger is more skewed
+  uint32_t writes;     // percent of data accesses that store
+  uint32_t ifetch;     // percent of mixed accesses that fetch instructions
+  uint64_t code;       // bytes of the mixed text segment
+  uint64_t seed;
+};
+
+// Returns true if 'path' names a generated trace
+bool is_generated_trace(const char *path);
+
+// Zipf(alpha) ranks 1..n in constant time and memory whatever n is. The
+// HEAD most popular ranks, and one outcome for all the others, come from an
+// alias table in a single lookup; the tail is sampled by rejection-inversion
+// (Hormann and Derflinger), which costs a few log() and exp() calls.
+class ZipfSampler
+{
+public:
+  ZipfSampler(uint64_t n, double alpha);
+
+  // Draw a rank, 'random' returns uniform 64-bit integers
+  template <typename Random>
+  uint64_t sample(Random random)
+  {
+    uint64_t r = random();
+    uint64_t i = (unsigned __int128)r * head.size() >> 64;
+    uint64_t k = (uint32_t)r < head[i].threshold ? i : head[i].alias;
+    if (k < first - 1) {
+      return k + 1;
+    }
+    for (;;) {
+      double u = hIntegralN + (random() >> 11) * 0x1.0p-53 * (hIntegralFirst - hIntegralN);
+      double x = h_integral_inverse(u);
+      k = x < first + 0.5 ? first : x + 0.5 > (double)n ? n : (uint64_t)(x + 0.5);
+      if (k - x <= s || u >= h_integral(k + 0.5) - h(k)) {
+        return k;
+      }
+    }
+  }
+
+private:
+  static constexpr uint32_t HEAD = 4096;
+
+  // Outcome 'alias' unless the low 32 random bits are below 'threshold'
+  struct Bucket
+  {
+    uint32_t threshold;
+    uint32_t alias;
+  };
+
+  double h(double x) const;
+  double h_integral(double x) const;
+  double h_integral_inverse(double x) const;
+
+  uint64_t n;
+  double alpha;
+  uint64_t first;            // first rank of the tail, n + 1 if there is none
+  std::vector<Bucket> head;  // ranks 1 .. first-1, then the tail
+  double hIntegralFirst;
+  double hIntegralN;
+  double s;                  // ranks this close to their x are always accepted
+};
+
+// Decodes a generated trace through the same next() as the readers
+class TraceGenerator
+{
+public:
+  // Parse the 'gen:' path, stopping the run on a bad spec
+  explicit TraceGenerator(const char *path);
+
+  TraceDialect dialect() const { return cfg.dialect; }
+  const GeneratorConfig &config() const { return cfg; }
+
+  bool next(MemAccess &a)
+  {
+    if (n == cfg.records) {
+      return false;
+    }
+    n++;
+    uint64_t r = random();
+    a.write = false;
+    if (cfg.pattern == TracePattern::MIXED && r % 100 < cfg.ifetch) {
+      pc = (r >> 8) % 8 == 0 ? CODE_BASE + (r >> 16) % codeWords * 4 : pc + 4;
+      if (pc >= CODE_BASE + codeWords * 4) {
+        pc = CODE_BASE;
+      }
+      a.pc = a.addr = pc;
+      a.data = false;
+      return true;
+    }
+    a.addr = data_address(cfg.pattern);
+    a.data = true;
+    a.write = (r >> 8) % 100 < cfg.writes;
+    a.pc = cfg.dialect == TraceDialect::SIMPLE ? 1 + (r >> 16) % 7 : pc;
+    return true;
+  }
+
+private:
+  static constexpr uint64_t CODE_BASE = 0x400000;
+  static constexpr uint32_t NODE_BITS = 6;   // zipf blocks and chase nodes
+
+  // xorshift64*
+  uint64_t random()
+  {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1Dull;
+  }
+  uint64_t data_address(TracePattern pattern);
+
+  GeneratorConfig cfg;
+  uint64_t n;           // accesses generated
+  uint64_t state;
+  uint64_t pc;          // last instruction fetched
+  uint64_t codeWords;
+  uint64_t words;       // data words in the footprint
+  uint64_t walk;        // offset of the last strided access
+  uint64_t blocks;      // zipf blocks in the footprint
+  uint64_t scatter;     // multiplier scattering zipf ranks over the blocks
+  ZipfSampler zipf;
+  uint64_t nodeMask;    // chase nodes - 1
+  uint64_t node;        // chase position, before scrambling
+  uint32_t chaseShift;  // xorshift of the scrambled chase position
+};
@@ -0,0 +1,127 @@
+//========================================================//
+//  interval.cpp                                          //
+//  Interval statistics writer                            //
+//                                                        //
+//  Formats the records of a run as CSV or JSON lines     //
+//  on a background thread                                //
+//========================================================//
+
+#include "interval.hpp"
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+// Records buffered before the simulation waits on the writer
+#define INTERVAL_BATCH 256
+
+bool
+parse_interval_format(const char *name, IntervalFormat &format)
+{
+  if (!strcasecmp(name, "csv")) {
+    format = IntervalFormat::CSV;
+  } else if (!strcasecmp(name, "json")) {
+    format = IntervalFormat::JSON;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+IntervalWriter::IntervalWriter(const char *path, IntervalFormat format, std::vector<const char *> columns)
+  : format(format), columns(std::move(columns)), idle(false), closed(false)
+{
+  out = strcmp(path, "-") ? fopen(path, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "Cannot create interval file '%s'\n", path);
+    exit(1);
+  }
+  batch = this->columns.size() * INTERVAL_BATCH;
+  fill.reserve(batch);
+  ready.reserve(batch);
+  if (format == IntervalFormat::CSV) {
+    for (size_t i = 0; i < this->columns.size(); i++) {
+      fprintf(out, "%s%s", i ? "," : "", this->columns[i]);
+    }
+    fputc('\n', out);
+  }
+  writer = std::thread(&IntervalWriter::run, this);
+}
+
+IntervalWriter::~IntervalWriter()
+{
+  close();
+}
+
+void
+IntervalWriter::hand_off()
+{
+  std::unique_lock<std::mutex> l(lock);
+  cond.wait(l, [&] { return ready.empty(); });
+  fill.swap(ready);
+  idle.store(false, std::memory_order_relaxed);
+  cond.notify_all();
+}
+
+void
+IntervalWriter::close()
+{
+  if (!writer.joinable()) {
+    return;
+  }
+  if (!fill.empty()) {
+    hand_off();
+  }
+  {
+    std::lock_guard<std::mutex> l(lock);
+    closed = true;
+    cond.notify_all();
+  }
+  writer.join();
+  if (out == stdout) {
+    fflush(out);
+  } else {
+    fclose(out);
+  }
+}
+
+void
+IntervalWriter::run()
+{
+  std::vector<uint64_t> records;
+  records.reserve(batch);
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> l(lock);
+      idle.store(true, std::memory_order_relaxed);
+      cond.wait(l, [&] { return !ready.empty() || closed; });
+      if (ready.empty()) {
+        return;
+      }
+      ready.swap(records);
+      cond.notify_all();
+    }
+    write(records);
+    records.clear();
+  }
+}
+
+void
+IntervalWriter::write(const std::vector<uint64_t> &records)
+{
+  size_t n = columns.size();
+  for (size_t r = 0; r < records.size(); r += n) {
+    if (format == IntervalFormat::CSV) {
+      for (size_t i = 0; i < n; i++) {
+        fprintf(out, "%s%" PRIu64, i ? "," : "", records[r + i]);
+      }
+      fputc('\n', out);
+    } else {
+      for (size_t i = 0; i < n; i++) {
+        fprintf(out, "%s\"%s\":%" PRIu64, i ? "," : "{", columns[i], records[r + i]);
+      }
+      fputs("}\n", out);
+    }
+  }
+  fflush(out);
+}
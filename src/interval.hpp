@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+//------------------------------------//
+//        Interval Statistics         //
+//------------------------------------//
+//
+// A run with intervals appends one record of counters every so many
+// accesses or cycles. The records are formatted and written on a thread of
+// their own: the simulation only copies the values into a buffer, which is
+// swapped with the writer's when the writer is idle or the buffer is full.
+//
+
+enum class IntervalFormat
+{
+  CSV,   // a header line with the column names, then one line per record
+  JSON   // one object per record and line, keyed by the column names
+};
+
+// Parse 'csv' or 'json', returns false on anything else
+bool parse_interval_format(const char *name, IntervalFormat &format);
+
+// Writes records of 'columns' 64-bit values to 'path', "-" being stdout
+class IntervalWriter
+{
+public:
+  IntervalWriter(const char *path, IntervalFormat format, std::vector<const char *> columns);
+  // Writes whatever is still buffered
+  ~IntervalWriter();
+  IntervalWriter(const IntervalWriter &) = delete;
+  IntervalWriter &operator=(const IntervalWriter &) = delete;
+
+  // Queue one record, 'values' holds a value for every column
+  void record(const uint64_t *values)
+  {
+    fill.insert(fill.end(), values, values + columns.size());
+    if (fill.size() >= batch || idle.load(std::memory_order_relaxed)) {
+      hand_off();
+    }
+  }
+
+  // Write every queued record and wait for the writer to finish
+  void close();
+
+private:
+  // Give the filled buffer to the writer, waiting while it still holds the
+  // previous one
+  void hand_off();
+  // The writer thread
+  void run();
+  void write(const std::vector<uint64_t> &records);
+
+  FILE *out;
+  IntervalFormat format;
+  std::vector<const char *> columns;
+  size_t batch;                      // values buffered before a forced hand-off
+  std::vector<uint64_t> fill;        // records of the simulation thread
+  std::vector<uint64_t> ready;       // records handed to the writer
+  std::atomic<bool> idle;            // the writer waits for records
+  bool closed;
+  std::mutex lock;
+  std::condition_variable cond;
+  std::thread writer;
+};
@@ -7,11 +7,50 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <random>
+#include <algorithm>
+#include <math.h>
+#include <cassert>
 #include "cache.hpp"
+#include "prefetch.hpp"
+#include "coherence.hpp"
+#include "checkpoint.hpp"
+#include "interval.hpp"
+#include "miss_stream.hpp"
+#include "trace.hpp"
+#include "parser.hpp"
 
-FILE *stream;
-char *buf = NULL;
-size_t len = 0;
+const char *traceFile;
+std::vector<const char *> coreTraces;
+TraceReader *trace = NULL;
+CacheConfig config;
+const char *sweepFile = NULL;
+unsigned sweepThreads = 0;
+uint64_t samplePeriod = 0;
+uint64_t sampleWindow = 0;
+uint64_t sampleWarmup = 0;
+bool functionalWarming = true;
+uint64_t warmingLength = 0;  // accesses warmed before each window, 0 to size it
+const char *simpointFile = NULL;
+uint64_t simpointInterval = 0;
+const char *checkpointFile = NULL;
+uint64_t checkpointAt = 0;
+const char *restoreFile = NULL;
+uint64_t intervalLength = 0;
+bool intervalCycles = false;
+IntervalFormat intervalFormat = IntervalFormat::CSV;
+const char *intervalFile = "-";
+const char *recordFile = NULL;
+const char *replayFile = NULL;
 
 // Print out the Usage information to stderr
 //
@@ -20,36 +59,200 @@ usage()
 {
   fprintf(stderr,"Usage: cache <options> [<trace>]\n");
   fprintf(stderr,"       bunzip -kc trace.bz2 | cache <options>\n");
+  fprintf(stderr,"       cache <options> trace.{bz2,gz,zst}\n");
+  fprintf(stderr,"       cache <options> trace.bin   (see 'convert')\n");
+  fprintf(stderr,"       cache <options> core0.trace core1.trace ...   (one core per trace)\n");
   fprintf(stderr," Options:\n");
   fprintf(stderr," --help                               Print this message\n");
-  fprintf(stderr," --icache=sets:assoc:blocksize:hit    I-cache Parameters\n");
-  fprintf(stderr," --dcache=sets:assoc:blocksize:hit    D-cache Parameters\n");
-  fprintf(stderr," --l2cache=sets:assoc:blocksize:hit   L2-cache Parameters\n");
+  fprintf(stderr," --icache=sets:assoc:blocksize:hit[:policy]  I-cache Parameters\n");
+  fprintf(stderr," --dcache=sets:assoc:blocksize:hit[:policy]  D-cache Parameters\n");
+  fprintf(stderr," --l2cache=sets:assoc:blocksize:hit[:policy] L2-cache Parameters\n");
+  fprintf(stderr,"                                      policy: lru (default), fifo, plru,\n");
+  fprintf(stderr,"                                      nru, srrip or brrip\n");
   fprintf(stderr," --inclusive                          Makes L2-cache be inclusive\n");
+  fprintf(stderr," --inclusion=nine|inclusive|exclusive  L2 contents relative to the L1s (default\n");
+  fprintf(stderr,"                                      nine), also prints writeback traffic\n");
+  fprintf(stderr," --victim=entries[:hit]               Fully-associative victim cache behind each L1,\n");
+  fprintf(stderr,"                                      hits swap back in 'hit' cycles (default 1)\n");
+  fprintf(stderr," --{i,d}cache-victim=entries          Victim cache behind one L1\n");
+  fprintf(stderr," --write-buffer=entries               Coalescing write buffer between D-cache and L2\n");
+  fprintf(stderr," --write-through                      D-cache writes through, no write-allocate\n");
+  fprintf(stderr," --3c                                 Split the misses of every level into compulsory,\n");
+  fprintf(stderr,"                                      capacity and conflict misses\n");
+  fprintf(stderr," --3c=sampled                         The same, capacity and conflict misses of\n");
+  fprintf(stderr,"                                      levels over 256 lines from a sample of sets\n");
   fprintf(stderr," --prefetch                           Enable Prefetching\n");
+  fprintf(stderr," --prefetch=kind[:degree[:distance]] D-cache prefetcher: nextline, stride (per-PC\n");
+  fprintf(stderr,"                                      stride table) or stream (default 1:1)\n");
+  fprintf(stderr," --iprefetch=kind[:degree]            I-cache prefetcher: nextline, discontinuity\n");
+  fprintf(stderr,"                                      or temporal (default degree 1)\n");
+  fprintf(stderr," --prefetch-queue=depth[:inflight]    Prefetches wait in a 'depth' entry queue and\n");
+  fprintf(stderr,"                                      take L2/memory latency to arrive, at most\n");
+  fprintf(stderr,"                                      'inflight' at a time (default 8)\n");
+  fprintf(stderr," --mshr=entries[:targets]             MSHRs on every level: misses overlap and only\n");
+  fprintf(stderr,"                                      I-cache misses block (default 4 targets)\n");
+  fprintf(stderr," --{i,d,l2}cache-mshr=entries[:targets]  MSHRs of one level\n");
+  fprintf(stderr," --window=n                           With MSHRs, accesses the core runs ahead\n");
+  fprintf(stderr,"                                      of a data miss (default 32)\n");
+  fprintf(stderr," --interleave=rr|random|cycle[:n]     Order of the core traces, 'n' accesses per\n");
+  fprintf(stderr,"                                      turn (default rr:1); cycle runs the core\n");
+  fprintf(stderr,"                                      with the fewest cycles so far\n");
+  fprintf(stderr," --c2c=cycles                         Cache-to-cache transfer time (default: L2 hit)\n");
   fprintf(stderr," --memspeed=latency                   Latency to Main Memory\n");
+  fprintf(stderr," --sweep=file                         Simulate every configuration in 'file'\n");
+  fprintf(stderr,"                                      (one '[name] <options>' per line) in parallel\n");
+  fprintf(stderr," --threads=n                          Sweep worker threads (default: all cores)\n");
+  fprintf(stderr," --sample=period:window[:warmup]      Measure 'window' accesses of every 'period',\n");
+  fprintf(stderr,"                                      after 'warmup' unmeasured ones (default 0),\n");
+  fprintf(stderr,"                                      and extrapolate the statistics\n");
+  fprintf(stderr," --simpoints=file:interval[:warmup]   Measure the 'interval'-access slices listed in\n");
+  fprintf(stderr,"                                      'file' ('<slice> <weight>' per line) instead\n");
+  fprintf(stderr," --warming=functional[:n]|none        Warm the caches on the 'n' accesses before each\n");
+  fprintf(stderr,"                                      window (default: enough for the largest level)\n");
+  fprintf(stderr,"                                      or leave them as the last window did\n");
+  fprintf(stderr," --checkpoint=file:offset             Stop after 'offset' accesses and save the whole\n");
+  fprintf(stderr,"                                      hierarchy state to 'file'\n");
+  fprintf(stderr," --restore=file                       Start from a checkpoint of the same hierarchy,\n");
+  fprintf(stderr,"                                      at the trace offset it was taken\n");
+  fprintf(stderr," --interval=n[:accesses|cycles]       Record the counters of every 'n' accesses\n");
+  fprintf(stderr,"                                      (default) or simulated cycles\n");
+  fprintf(stderr," --interval-format=csv|json           Interval records as CSV (default) or JSON lines\n");
+  fprintf(stderr," --interval-file=file                 Write the interval records to 'file' (default\n");
+  fprintf(stderr,"                                      stdout, ahead of the report)\n");
+  fprintf(stderr," --record-l2=file                     Also save what the L1s send the L2 to 'file'\n");
+  fprintf(stderr," --replay-l2=file                     Run only the L2, on a 'file' saved with the same\n");
+  fprintf(stderr,"                                      L1s, instead of a trace; with --sweep, the L2\n");
+  fprintf(stderr,"                                      of every configuration\n");
+}
+
+// Parse a 'sets:assoc:blocksize:hit[:policy]' cache specification, the
+// replacement policy is left alone when it is not given
+//
+// Returns True if Successful
+//
+int
+handle_cache_spec(const char *spec, uint32_t &sets, uint32_t &assoc, uint32_t &blocksize,
+                  uint32_t &hitTime, ReplacePolicy &policy)
+{
+  char name[16] = "";
+  sscanf(spec,"%u:%u:%u:%u:%15s", &sets, &assoc, &blocksize, &hitTime, name);
+  return !name[0] || parse_policy(name, policy);
+}
+
+// Parse an 'entries[:targets]' MSHR specification
+//
+// Returns True if Successful
+//
+int
+handle_mshr_spec(const char *spec, uint32_t &entries, uint32_t &targets)
+{
+  return sscanf(spec,"%u:%u", &entries, &targets) >= 1 && entries && targets;
 }
 
 // Process an option and update the cache
-// configuration variables accordingly
+// configuration 'cfg' accordingly
 //
 // Returns True if Successful
 //
 int
-handle_option(char *arg)
+handle_option(const char *arg, CacheConfig &cfg)
 {
   if (!strncmp(arg,"--icache=",9)) {
-    sscanf(arg+9,"%u:%u:%u:%u", &icacheSets, &icacheAssoc, &icacheBlocksize, &icacheHitTime);
+    return handle_cache_spec(arg+9, cfg.icacheSets, cfg.icacheAssoc, cfg.icacheBlocksize, cfg.icacheHitTime,
+                             cfg.icachePolicy);
   } else if (!strncmp(arg,"--dcache=",9)) {
-    sscanf(arg+9,"%u:%u:%u:%u", &dcacheSets, &dcacheAssoc, &dcacheBlocksize, &dcacheHitTime);
+    return handle_cache_spec(arg+9, cfg.dcacheSets, cfg.dcacheAssoc, cfg.dcacheBlocksize, cfg.dcacheHitTime,
+                             cfg.dcachePolicy);
   } else if (!strncmp(arg,"--l2cache=",10)) {
-    sscanf(arg+10,"%u:%u:%u:%u", &l2cacheSets, &l2cacheAssoc, &l2cacheBlocksize, &l2cacheHitTime);
+    return handle_cache_spec(arg+10, cfg.l2cacheSets, cfg.l2cacheAssoc, cfg.l2cacheBlocksize, cfg.l2cacheHitTime,
+                             cfg.l2cachePolicy);
   } else if (!strcmp(arg,"--inclusive")) {
-    inclusive = TRUE;
+    cfg.inclusion = InclusionPolicy::INCLUSIVE;
+  } else if (!strncmp(arg,"--inclusion=",12)) {
+    if (!strcasecmp(arg+12,"nine")) {
+      cfg.inclusion = InclusionPolicy::NINE;
+    } else if (!strcasecmp(arg+12,"inclusive")) {
+      cfg.inclusion = InclusionPolicy::INCLUSIVE;
+    } else if (!strcasecmp(arg+12,"exclusive")) {
+      cfg.inclusion = InclusionPolicy::EXCLUSIVE;
+    } else {
+      return 0;
+    }
+    cfg.trafficReport = TRUE;
+  } else if (!strncmp(arg,"--victim=",9)) {
+    if (sscanf(arg+9,"%u:%u", &cfg.icacheVictims, &cfg.victimHitTime) < 1 || !cfg.icacheVictims) {
+      return 0;
+    }
+    cfg.dcacheVictims = cfg.icacheVictims;
+  } else if (!strncmp(arg,"--icache-victim=",16)) {
+    return sscanf(arg+16,"%u", &cfg.icacheVictims) == 1 && cfg.icacheVictims;
+  } else if (!strncmp(arg,"--dcache-victim=",16)) {
+    return sscanf(arg+16,"%u", &cfg.dcacheVictims) == 1 && cfg.dcacheVictims;
+  } else if (!strncmp(arg,"--write-buffer=",15)) {
+    return sscanf(arg+15,"%u", &cfg.writeBuffer) == 1 && cfg.writeBuffer;
+  } else if (!strcmp(arg,"--write-through")) {
+    cfg.writeThrough = TRUE;
+  } else if (!strcmp(arg,"--3c")) {
+    cfg.classifyMisses = TRUE;
+  } else if (!strcmp(arg,"--3c=sampled")) {
+    cfg.classifyMisses = TRUE;
+    cfg.classifySampled = TRUE;
   } else if (!strcmp(arg,"--prefetch")) {
-    prefetch = TRUE;
+    cfg.prefetch = TRUE;
+  } else if (!strncmp(arg,"--prefetch=",11)) {
+    char name[16] = "";
+    sscanf(arg+11,"%15[^:]:%u:%u", name, &cfg.prefetchDegree, &cfg.prefetchDistance);
+    if (!parse_prefetch(name, false, cfg.prefetchPolicy) || !cfg.prefetchDegree || !cfg.prefetchDistance) {
+      return 0;
+    }
+    cfg.prefetch = TRUE;
+    cfg.prefetchReport = TRUE;
+  } else if (!strncmp(arg,"--iprefetch=",12)) {
+    char name[16] = "";
+    sscanf(arg+12,"%15[^:]:%u", name, &cfg.iprefetchDegree);
+    if (!parse_prefetch(name, true, cfg.iprefetchPolicy) || !cfg.iprefetchDegree) {
+      return 0;
+    }
+    cfg.prefetch = TRUE;
+    cfg.prefetchReport = TRUE;
+  } else if (!strncmp(arg,"--prefetch-queue=",17)) {
+    sscanf(arg+17,"%u:%u", &cfg.prefetchQueue, &cfg.prefetchInflight);
+    if (!cfg.prefetchQueue || !cfg.prefetchInflight) {
+      return 0;
+    }
+    cfg.prefetch = TRUE;
+    cfg.prefetchReport = TRUE;
+  } else if (!strncmp(arg,"--mshr=",7)) {
+    if (!handle_mshr_spec(arg+7, cfg.icacheMshrs, cfg.icacheMshrTargets)) {
+      return 0;
+    }
+    cfg.dcacheMshrs = cfg.l2cacheMshrs = cfg.icacheMshrs;
+    cfg.dcacheMshrTargets = cfg.l2cacheMshrTargets = cfg.icacheMshrTargets;
+  } else if (!strncmp(arg,"--icache-mshr=",14)) {
+    return handle_mshr_spec(arg+14, cfg.icacheMshrs, cfg.icacheMshrTargets);
+  } else if (!strncmp(arg,"--dcache-mshr=",14)) {
+    return handle_mshr_spec(arg+14, cfg.dcacheMshrs, cfg.dcacheMshrTargets);
+  } else if (!strncmp(arg,"--l2cache-mshr=",15)) {
+    return handle_mshr_spec(arg+15, cfg.l2cacheMshrs, cfg.l2cacheMshrTargets);
+  } else if (!strncmp(arg,"--window=",9)) {
+    return sscanf(arg+9,"%u", &cfg.mshrWindow) == 1 && cfg.mshrWindow;
+  } else if (!strncmp(arg,"--interleave=",13)) {
+    char name[16] = "";
+    sscanf(arg+13,"%15[^:]:%u", name, &cfg.quantum);
+    if (!strcasecmp(name,"rr")) {
+      cfg.interleave = Interleave::ROUND_ROBIN;
+    } else if (!strcasecmp(name,"random")) {
+      cfg.interleave = Interleave::RANDOM;
+    } else if (!strcasecmp(name,"cycle")) {
+      cfg.interleave = Interleave::CYCLE;
+    } else {
+      return 0;
+    }
+    return cfg.quantum != 0;
+  } else if (!strncmp(arg,"--c2c=",6)) {
+    return sscanf(arg+6,"%u", &cfg.transferTime) == 1;
   } else if (!strncmp(arg,"--memspeed=",11)) {
-    sscanf(arg+11,"%u", &memspeed);
+    sscanf(arg+11,"%u", &cfg.memspeed);
   } else {
     return 0;
   }
@@ -61,118 +264,385 @@ handle_option(char *arg)
 // Print out the memory hierarchy
 //
 void
-printCacheConfig()
+printCacheConfig(const CacheConfig &c)
 {
   printf("Simulator Memory Hierarchy:\n");
   // Print I$ Configuration
-  if (icacheSets) {
+  if (c.icacheSets) {
     printf("  I$ Configuration:\n");
-    printf("    Size:  %u KB\n", icacheSets * icacheAssoc * icacheBlocksize / 1024);
-    printf("    Sets:  %u\n", icacheSets);
-    printf("    Assoc: %u\n", icacheAssoc);
-    printf("Blocksize: %u B\n", icacheBlocksize);
-    printf("    Lat:   %u Cycles\n", icacheHitTime);
+    printf("    Size:  %u KB\n", c.icacheSets * c.icacheAssoc * c.icacheBlocksize / 1024);
+    printf("    Sets:  %u\n", c.icacheSets);
+    printf("    Assoc: %u\n", c.icacheAssoc);
+    printf("Blocksize: %u B\n", c.icacheBlocksize);
+    printf("    Lat:   %u Cycles\n", c.icacheHitTime);
+    if (c.icachePolicy != ReplacePolicy::LRU) {
+      printf("    Policy: %s\n", policy_name(c.icachePolicy));
+    }
+    if (c.icacheMshrs) {
+      printf("    MSHRs: %u, %u targets\n", c.icacheMshrs, c.icacheMshrTargets);
+    }
+    if (c.icacheVictims) {
+      printf("    Victim cache: %u entries, %u Cycles\n", c.icacheVictims, c.victimHitTime);
+    }
   }
   // Print D$ Configuration
-  if (dcacheSets) {
+  if (c.dcacheSets) {
     printf("  D$ Configuration:\n");
-    printf("    Size:  %u KB\n", dcacheSets * dcacheAssoc * dcacheBlocksize / 1024);
-    printf("    Sets:  %u\n", dcacheSets);
-    printf("    Assoc: %u\n", dcacheAssoc);
-    printf("Blocksize: %u B\n", dcacheBlocksize);
-    printf("    Lat:   %u Cycles\n", dcacheHitTime);
+    printf("    Size:  %u KB\n", c.dcacheSets * c.dcacheAssoc * c.dcacheBlocksize / 1024);
+    printf("    Sets:  %u\n", c.dcacheSets);
+    printf("    Assoc: %u\n", c.dcacheAssoc);
+    printf("Blocksize: %u B\n", c.dcacheBlocksize);
+    printf("    Lat:   %u Cycles\n", c.dcacheHitTime);
+    if (c.dcachePolicy != ReplacePolicy::LRU) {
+      printf("    Policy: %s\n", policy_name(c.dcachePolicy));
+    }
+    if (c.dcacheMshrs) {
+      printf("    MSHRs: %u, %u targets\n", c.dcacheMshrs, c.dcacheMshrTargets);
+    }
+    if (c.dcacheVictims) {
+      printf("    Victim cache: %u entries, %u Cycles\n", c.dcacheVictims, c.victimHitTime);
+    }
+    if (c.writeThrough) {
+      printf("    Write-through: Yes\n");
+    }
+    if (c.writeBuffer) {
+      printf("    Write buffer: %u entries\n", c.writeBuffer);
+    }
   }
   // Print L2$ Configuration
-  if (l2cacheSets) {
+  if (c.l2cacheSets) {
     printf("  L2$ Configuration:\n");
-    printf("    Size:  %u KB\n", l2cacheSets * l2cacheAssoc * l2cacheBlocksize / 1024);
-    printf("    Sets:  %u\n", l2cacheSets);
-    printf("    Assoc: %u\n", l2cacheAssoc);
-    printf("Blocksize: %u B\n", l2cacheBlocksize);
-    printf("    Lat:   %u Cycles\n", l2cacheHitTime);
-    printf("    Inclusive: %s\n", inclusive ? "Yes" : "No");
+    printf("    Size:  %u KB\n", c.l2cacheSets * c.l2cacheAssoc * c.l2cacheBlocksize / 1024);
+    printf("    Sets:  %u\n", c.l2cacheSets);
+    printf("    Assoc: %u\n", c.l2cacheAssoc);
+    printf("Blocksize: %u B\n", c.l2cacheBlocksize);
+    printf("    Lat:   %u Cycles\n", c.l2cacheHitTime);
+    if (c.l2cachePolicy != ReplacePolicy::LRU) {
+      printf("    Policy: %s\n", policy_name(c.l2cachePolicy));
+    }
+    if (c.l2cacheMshrs) {
+      printf("    MSHRs: %u, %u targets\n", c.l2cacheMshrs, c.l2cacheMshrTargets);
+    }
+    printf("    Inclusive: %s\n", c.inclusion == InclusionPolicy::INCLUSIVE ? "Yes" : "No");
+    if (c.inclusion == InclusionPolicy::EXCLUSIVE) {
+      printf("    Exclusive: Yes\n");
+    }
+  }
+  printf("  Prefetch:   %s\n", c.prefetch ? "Yes" : "No");
+  if (c.prefetch && c.iprefetchPolicy != PrefetchPolicy::NEXT_LINE) {
+    printf("    I$ Prefetcher: %s, degree %u\n", prefetch_name(c.iprefetchPolicy), c.iprefetchDegree);
+  }
+  if (c.prefetch && c.prefetchPolicy != PrefetchPolicy::NEXT_LINE) {
+    printf("    D$ Prefetcher: %s, degree %u, distance %u\n", prefetch_name(c.prefetchPolicy),
+           c.prefetchDegree, c.prefetchDistance);
   }
-  printf("  Prefetch:   %s\n", prefetch ? "Yes" : "No");
-  printf("  Memspeed:   %u Cycles\n", memspeed);
+  if (c.prefetch && c.prefetchQueue) {
+    printf("    Prefetch queue: %u entries, %u in flight\n", c.prefetchQueue, c.prefetchInflight);
+  }
+  if (c.cores > 1) {
+    static const char *orders[] = { "rr", "random", "cycle" };
+    printf("  Cores:      %u, MESI, interleave %s:%u\n", c.cores, orders[(int)c.interleave], c.quantum);
+  }
+  printf("  Memspeed:   %u Cycles\n", c.memspeed);
 }
 
-// Print out the Cache Statistics
+// Print out the Cache Statistics. Misses into empty sets are not estimated
+// from 'sampled' windows, they all come before the first.
 //
 void
-printCacheStats()
+printCacheStats(const CacheConfig &c, const CacheStats &s, bool sampled = false)
 {
   printf("Cache Statistics:\n");
-  if (icacheSets) {
-    printf("  total I-cache accesses:  %10lu\n", icacheRefs);
-    printf("  total I-cache misses:    %10lu\n", icacheMisses);
-    printf("  total I-cache penalties: %10lu\n", icachePenalties);
-    if (icacheRefs > 0) {
+  if (c.icacheSets) {
+    printf("  total I-cache accesses:  %10lu\n", s.icacheRefs);
+    printf("  total I-cache misses:    %10lu\n", s.icacheMisses);
+    printf("  total I-cache penalties: %10lu\n", s.icachePenalties);
+    if (s.icacheRefs > 0) {
       printf("  I-cache miss rate:   %17.2f%%\n",
-          100.0*(double)icacheMisses/(double)icacheRefs);
+          100.0*(double)s.icacheMisses/(double)s.icacheRefs);
       printf("  avg I-cache access time: %13.2f cycles\n",
-          (double)((icachePenalties + icacheRefs * icacheHitTime))/icacheRefs);
+          (double)((s.icachePenalties + s.icacheRefs * c.icacheHitTime))/s.icacheRefs);
     } else {
       printf("  I-cache miss rate:                -\n");
       printf("  avg I-cache access time:          -\n");
     }
   }
-  if (dcacheSets) {
-    printf("  total D-cache accesses:  %10lu\n", dcacheRefs);
-    printf("  total D-cache misses:    %10lu\n", dcacheMisses);
-    printf("  total D-cache penalties: %10lu\n", dcachePenalties);
-    if (dcacheRefs > 0) {
+  if (c.dcacheSets) {
+    printf("  total D-cache accesses:  %10lu\n", s.dcacheRefs);
+    printf("  total D-cache misses:    %10lu\n", s.dcacheMisses);
+    printf("  total D-cache penalties: %10lu\n", s.dcachePenalties);
+    if (s.dcacheRefs > 0) {
       printf("  D-cache miss rate:   %17.2f%%\n",
-          100.0*(double)dcacheMisses/(double)dcacheRefs);
+          100.0*(double)s.dcacheMisses/(double)s.dcacheRefs);
       printf("  avg D-cache access time: %13.2f cycles\n",
-          (double)((dcachePenalties + dcacheRefs * dcacheHitTime))/dcacheRefs);
+          (double)((s.dcachePenalties + s.dcacheRefs * c.dcacheHitTime))/s.dcacheRefs);
     } else {
       printf("  D-cache miss rate:                -\n");
       printf("  avg D-cache access time:          -\n");
     }
   }
-  if (l2cacheSets) {
-    printf("  total L2-cache accesses: %10lu\n", l2cacheRefs);
-    printf("  total L2-cache misses:   %10lu\n", l2cacheMisses);
-    printf("  total L2-cache penalties:%10lu\n", l2cachePenalties);
-    if (l2cacheRefs > 0) {
+  if (c.l2cacheSets) {
+    printf("  total L2-cache accesses: %10lu\n", s.l2cacheRefs);
+    printf("  total L2-cache misses:   %10lu\n", s.l2cacheMisses);
+    printf("  total L2-cache penalties:%10lu\n", s.l2cachePenalties);
+    if (s.l2cacheRefs > 0) {
       printf("  L2-cache miss rate:  %17.2f%%\n",
-          100.0*(double)l2cacheMisses/(double)l2cacheRefs);
+          100.0*(double)s.l2cacheMisses/(double)s.l2cacheRefs);
       printf("  avg L2-cache access time:%13.2f cycles\n",
-          (double)((l2cachePenalties + l2cacheHitTime * l2cacheRefs))
-          / l2cacheRefs);
+          (double)((s.l2cachePenalties + c.l2cacheHitTime * s.l2cacheRefs))
+          / s.l2cacheRefs);
     } else {
       printf("  L2-cache miss rate:               -\n");
       printf("  avg L2-cache access time:         -\n");
     }
   }
-  printf("  total compulsory misses: %10lu\n", compulsory_miss);
-  printf("  total other misses:      %10lu\n", other_miss);
+  if (sampled) {
+    printf("  total compulsory misses:          -\n");
+  } else {
+    printf("  total compulsory misses: %10lu\n", s.compulsory_miss);
+  }
+  printf("  total other misses:      %10lu\n", s.other_miss);
+}
+
+// Print the coverage, accuracy and timeliness of one L1 prefetcher
+//
+void
+printPrefetcher(const char *cache, PrefetchPolicy policy, uint64_t misses, const PrefetchStats &p,
+                bool timed)
+{
+  printf("  %s prefetcher: %s\n", cache, prefetch_name(policy));
+  printf("    prefetched lines:      %10lu\n", p.fills);
+  printf("    useful prefetches:     %10lu\n", p.used);
+  if (timed) {
+    printf("    late prefetches:       %10lu\n", p.late);
+    printf("    dropped prefetches:    %10lu\n", p.dropped);
+  }
+  printf("    useless prefetches:    %10lu\n", p.useless);
+  printf("    pollution misses:      %10lu\n", p.pollution);
+  if (p.fills > 0) {
+    printf("    accuracy:          %17.2f%%\n", 100.0*(double)p.used/(double)p.fills);
+  } else {
+    printf("    accuracy:                       -\n");
+  }
+  // the misses left plus the ones the prefetcher removed
+  if (misses + p.used > 0) {
+    printf("    coverage:          %17.2f%%\n", 100.0*(double)p.used/(double)(misses + p.used));
+  } else {
+    printf("    coverage:                       -\n");
+  }
+}
+
+// Print out the prefetcher statistics
+//
+void
+printPrefetchStats(const CacheConfig &c, const CacheStats &s)
+{
+  printf("Prefetch Statistics:\n");
+  if (c.icacheSets) {
+    printPrefetcher("I-cache", c.iprefetchPolicy, s.icacheMisses, s.icachePrefetch, c.prefetchQueue);
+  }
+  if (c.dcacheSets) {
+    printPrefetcher("D-cache", c.prefetchPolicy, s.dcacheMisses, s.dcachePrefetch, c.prefetchQueue);
+  }
+}
+
+// Print out the writebacks and the memory traffic
+//
+void
+printTrafficStats(const CacheConfig &c, const CacheStats &s)
+{
+  printf("Traffic Statistics:\n");
+  if (c.dcacheSets) {
+    printf("  D-cache writebacks:      %10lu\n", s.dcacheWritebacks);
+  }
+  if (c.l2cacheSets) {
+    printf("  L2-cache writebacks:     %10lu\n", s.l2cacheWritebacks);
+    printf("  L1 back-invalidations:   %10lu\n", s.backInvalidations);
+  }
+  printf("  memory lines read:       %10lu\n", s.memoryReads);
+  printf("  memory lines written:    %10lu\n", s.memoryWrites);
+}
+
+bool
+has_stages(const CacheConfig &c)
+{
+  return c.icacheVictims || c.dcacheVictims || c.writeBuffer || c.writeThrough;
+}
+
+// Print the counters of one victim cache
+//
+void
+printVictim(const char *cache, const VictimStats &v)
+{
+  printf("  %s victim cache:\n", cache);
+  printf("    probes:                %10lu\n", v.probes);
+  printf("    hits (swapped back):   %10lu\n", v.hits);
+  printf("    evictions:             %10lu\n", v.evictions);
+  printf("    dirty evictions:       %10lu\n", v.writebacks);
+  if (v.probes > 0) {
+    printf("    hit rate:          %17.2f%%\n", 100.0*(double)v.hits/(double)v.probes);
+  } else {
+    printf("    hit rate:                       -\n");
+  }
+}
+
+// Print out the victim cache and write buffer statistics
+//
+void
+printStageStats(const CacheConfig &c, const CacheStats &s)
+{
+  printf("Stage Statistics:\n");
+  if (c.icacheSets && c.icacheVictims) {
+    printVictim("I-cache", s.icacheVictim);
+  }
+  if (c.dcacheSets && c.dcacheVictims) {
+    printVictim("D-cache", s.dcacheVictim);
+  }
+  if (c.dcacheSets && c.writeThrough) {
+    printf("  D-cache stores written:  %10lu\n", s.dcacheWritebacks);
+  }
+  if (c.dcacheSets && c.writeBuffer) {
+    const WriteBufferStats &w = s.writeBuffer;
+    printf("  Write buffer:\n");
+    printf("    writes buffered:       %10lu\n", w.writes);
+    printf("    writes merged:         %10lu\n", w.merges);
+    printf("    entries drained:       %10lu\n", w.drains);
+    printf("    drained early by reads:%10lu\n", w.readFlushes);
+    printf("    full-buffer stalls:    %10lu\n", w.fullStalls);
+    printf("    cycles stalled:        %10lu\n", w.stallCycles);
+  }
+}
+
+// Print one level's misses by cause
+//
+void
+printMissClasses(const char *cache, const MissClassStats &m)
+{
+  uint64_t misses = m.compulsory + m.capacity + m.conflict;
+  printf("  %s misses:%*s%10lu\n", cache, (int)(15 - strlen(cache)), "", misses);
+  for (auto [name, n] : {pair{"compulsory:", m.compulsory}, pair{"capacity:", m.capacity},
+                         pair{"conflict:", m.conflict}}) {
+    if (misses > 0) {
+      printf("    %-20s%10lu %6.2f%%\n", name, n, 100.0*(double)n/(double)misses);
+    } else {
+      printf("    %-20s%10lu      -\n", name, n);
+    }
+  }
+}
+
+// Print out the compulsory, capacity and conflict misses of every level
+//
+void
+printMissClassStats(const CacheConfig &c, const CacheStats &s)
+{
+  printf("Miss Classification%s:\n", c.classifySampled ? " (capacity and conflict from sampled sets)" : "");
+  if (c.icacheSets) {
+    printMissClasses("I-cache", s.icacheClasses);
+  }
+  if (c.dcacheSets) {
+    printMissClasses("D-cache", s.dcacheClasses);
+  }
+  if (c.l2cacheSets) {
+    printMissClasses("L2-cache", s.l2cacheClasses);
+  }
+}
+
+// Print the accesses, miss rates and average access time of every core
+//
+void
+printCoreStats(const MultiCoreHierarchy &h, uint32_t cores)
+{
+  printf("Core Statistics:\n");
+  printf("  core   accesses  I-cache miss  D-cache miss  avg access time\n");
+  for (uint32_t c = 0; c < cores; c++) {
+    CacheStats s = h.core_stats(c);
+    printf("  %4u %10lu %12.2f%% %12.2f%% %9.2f cycles  %s\n", c, s.totalRefs,
+           s.icacheRefs ? 100.0*(double)s.icacheMisses/(double)s.icacheRefs : 0.0,
+           s.dcacheRefs ? 100.0*(double)s.dcacheMisses/(double)s.dcacheRefs : 0.0,
+           s.totalRefs ? (double)s.totalPenalties/(double)s.totalRefs : 0.0, coreTraces[c]);
+  }
+}
+
+// Print out the MESI counters and the blocks with the most false sharing
+//
+void
+printCoherenceStats(const MultiCoreHierarchy &h)
+{
+  const CoherenceStats &s = h.coherence();
+  printf("Coherence Statistics:\n");
+  printf("  invalidations:           %10lu\n", s.invalidations);
+  printf("  upgrades (S -> M):       %10lu\n", s.upgrades);
+  printf("  cache-to-cache transfers:%10lu\n", s.transfers);
+  printf("  coherence misses:        %10lu\n", s.coherenceMisses);
+  printf("  false-sharing misses:    %10lu\n", s.falseSharing);
+  std::vector<HotBlock> hot = h.hot_blocks(10);
+  if (!hot.empty()) {
+    printf("  false-sharing hot blocks:\n");
+    for (const HotBlock &b : hot) {
+      printf("    0x%08x             %10lu\n", b.addr, b.misses);
+    }
+  }
+}
+
+bool
+has_mshrs(const CacheConfig &c)
+{
+  return c.icacheMshrs || c.dcacheMshrs || c.l2cacheMshrs;
+}
+
+// Print the MSHR counters of one level
+//
+void
+printMshr(const char *cache, const MshrStats &m)
+{
+  printf("  %s MSHRs:\n", cache);
+  printf("    merged secondary misses:%9lu\n", m.merged);
+  printf("    out of targets:        %10lu\n", m.targetStalls);
+  printf("    all MSHRs busy:        %10lu\n", m.fullStalls);
+  printf("    cycles waiting for one:%10lu\n", m.stallCycles);
+}
+
+// Print out the MSHR statistics, levels without MSHRs are blocking
+//
+void
+printMshrStats(const CacheConfig &c, const CacheStats &s)
+{
+  printf("MSHR Statistics (window %u):\n", c.mshrWindow);
+  if (c.icacheSets) {
+    printMshr("I-cache", s.icacheMshr);
+  }
+  if (c.dcacheSets) {
+    printMshr("D-cache", s.dcacheMshr);
+  }
+  if (c.l2cacheSets) {
+    printMshr("L2-cache", s.l2cacheMshr);
+  }
 }
 
-// Set the defaults for the Cache Simulator
+// Print out the memory access totals
 //
 void
-set_defaults()
-{
-  // Set default input stream
-  stream = stdin;
-
-  // Set default Cache Parameters
-  icacheSets      = 0;
-  icacheAssoc     = 0;
-  icacheHitTime   = 0;
-  dcacheSets      = 0;
-  dcacheAssoc     = 0;
-  dcacheHitTime   = 0;
-  l2cacheSets     = 0;
-  l2cacheAssoc    = 0;
-  l2cacheHitTime  = 0;
-  inclusive       = 0;
-  prefetch        = 0;
-  icacheBlocksize = 16;
-  dcacheBlocksize = 16;
-  l2cacheBlocksize= 16;
-  memspeed        = 50;
+printTotals(const CacheStats &s)
+{
+  printf("Total Memory accesses:  %lu\n", s.totalRefs);
+  printf("Total Memory penalties: %lu\n", s.totalPenalties);
+  if (s.totalRefs > 0) {
+    printf("avg Memory access time: %13.2f cycles\n",
+        (double)s.totalPenalties / s.totalRefs);
+  } else {
+    printf("avg Memory access time:             -\n");
+  }
+}
+
+// The configuration a checkpoint has to match, without the report options
+//
+CacheConfig
+checkpoint_key(const CacheConfig &cfg)
+{
+  CacheConfig key = cfg;
+  key.trafficReport = 0;
+  key.prefetchReport = 0;
+  return key;
 }
 
 // Reads a line from the input stream and extracts the
@@ -183,81 +653,930 @@ set_defaults()
 int
 read_mem_access(uint32_t *pc, uint32_t *addr, char *i_or_d, char *r_or_w)
 {
-  if (getline(&buf, &len, stream) == -1) {
+  MemAccess a;
+  if (!trace->next(a)) {
     return 0;
   }
-
-  sscanf(buf,"0x%x\t0x%x\t%c\t%c\n", pc, addr, i_or_d, r_or_w);
+  *pc = a.pc;
+  *addr = a.addr;
+  *i_or_d = a.data ? 'D' : 'I';
+  *r_or_w = a.write ? 'W' : 'R';
 
   return 1;
 }
 
+//------------------------------------//
+//        Configuration Sweep         //
+//------------------------------------//
+
+struct SweepConfig
+{
+  std::string name;
+  CacheConfig cfg;
+};
+
+// One access of the shared, decoded sweep trace
+struct SweepAccess
+{
+  uint32_t pc;
+  uint32_t addr;
+  char i_or_d;
+  char r_or_w;
+};
+
+// Read the sweep file: one configuration per line, an optional name
+// followed by the usual cache options. '#' starts a comment.
+//
+std::vector<SweepConfig>
+read_sweep_file(const char *path)
+{
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    fprintf(stderr,"Cannot open sweep file '%s'\n", path);
+    exit(1);
+  }
+
+  std::vector<SweepConfig> configs;
+  char *line = NULL;
+  size_t len = 0;
+  unsigned lineno = 0;
+  while (getline(&line, &len, f) != -1) {
+    lineno++;
+    if (char *hash = strchr(line, '#')) {
+      *hash = '\0';
+    }
+    SweepConfig sc;
+    sc.cfg = default_config();
+    bool empty = true;
+    for (char *tok = strtok(line, " \t\r\n"); tok; tok = strtok(NULL, " \t\r\n")) {
+      if (strncmp(tok,"--",2)) {
+        sc.name = tok;
+      } else if (!handle_option(tok, sc.cfg)) {
+        fprintf(stderr,"%s:%u: unrecognized option %s\n", path, lineno, tok);
+        exit(1);
+      }
+      empty = false;
+    }
+    if (!empty) {
+      if (sc.name.empty()) {
+        sc.name = "config " + std::to_string(configs.size() + 1);
+      }
+      configs.push_back(sc);
+    }
+  }
+  free(line);
+  fclose(f);
+  return configs;
+}
+
+// Decode the trace once into a shared read-only buffer, then simulate each
+// configuration on its own hierarchy instance across a pool of workers.
+// With --replay-l2 there is no trace, each instance replays the stream.
+//
+void
+run_sweep(const std::vector<SweepConfig> &configs, unsigned threads)
+{
+  std::vector<SweepAccess> accesses;
+  uint32_t pc, addr;
+  char i_or_d, r_or_w;
+  while (trace && read_mem_access(&pc, &addr, &i_or_d, &r_or_w)) {
+    accesses.push_back({pc, addr, i_or_d, r_or_w});
+  }
+
+  if (threads == 0) {
+    threads = std::thread::hardware_concurrency();
+  }
+  threads = std::max(1u, std::min<unsigned>(threads, configs.size()));
+
+  std::vector<CacheStats> results(configs.size());
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < threads; t++) {
+    workers.emplace_back([&] {
+      for (size_t i; (i = next++) < configs.size(); ) {
+        CacheHierarchy hierarchy(configs[i].cfg);
+        if (replayFile) {
+          hierarchy.replay(replayFile);
+        }
+        for (const SweepAccess &a : accesses) {
+          hierarchy.access(a.pc, a.addr, a.i_or_d, a.r_or_w);
+        }
+        results[i] = hierarchy.stats();
+      }
+    });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+
+  for (size_t i = 0; i < configs.size(); i++) {
+    printf("==================== %s ====================\n", configs[i].name.c_str());
+    printCacheConfig(configs[i].cfg);
+    printCacheStats(configs[i].cfg, results[i]);
+    if (configs[i].cfg.prefetchReport) {
+      printPrefetchStats(configs[i].cfg, results[i]);
+    }
+    if (configs[i].cfg.trafficReport) {
+      printTrafficStats(configs[i].cfg, results[i]);
+    }
+    if (configs[i].cfg.classifyMisses) {
+      printMissClassStats(configs[i].cfg, results[i]);
+    }
+    if (has_stages(configs[i].cfg)) {
+      printStageStats(configs[i].cfg, results[i]);
+    }
+    if (has_mshrs(configs[i].cfg)) {
+      printMshrStats(configs[i].cfg, results[i]);
+    }
+    printTotals(results[i]);
+  }
+}
+
+//------------------------------------//
+//        Sampled Simulation          //
+//------------------------------------//
+
+// One measured window of a sampled run
+struct SampleWindow
+{
+  uint64_t start;     // first measured access
+  double weight;      // share of the trace the window stands for
+  CacheStats delta;   // what the window added to the statistics
+};
+
+// A statistic estimated from the windows, with its 95% confidence interval
+struct Estimate
+{
+  double value;
+  double bound;       // half-width of the interval, negative when unknown
+};
+
+// Read a SimPoint file: one '<slice> <weight>' per line, slices counted in
+// 'interval' accesses from the start of the trace. '#' starts a comment.
+//
+std::vector<SampleWindow>
+read_simpoints(const char *path, uint64_t interval)
+{
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    fprintf(stderr,"Cannot open simpoint file '%s'\n", path);
+    exit(1);
+  }
+
+  std::vector<SampleWindow> windows;
+  char *line = NULL;
+  size_t len = 0;
+  unsigned lineno = 0;
+  while (getline(&line, &len, f) != -1) {
+    lineno++;
+    if (char *hash = strchr(line, '#')) {
+      *hash = '\0';
+    }
+    unsigned long slice;
+    double weight;
+    int n = sscanf(line, "%lu %lf", &slice, &weight);
+    if (n == EOF) {
+      continue;
+    }
+    if (n != 2 || weight <= 0) {
+      fprintf(stderr,"%s:%u: expected '<slice> <weight>'\n", path, lineno);
+      exit(1);
+    }
+    windows.push_back(SampleWindow{slice * interval, weight, {}});
+  }
+  free(line);
+  fclose(f);
+
+  std::sort(windows.begin(), windows.end(), [](const SampleWindow &a, const SampleWindow &b) {
+    return a.start < b.start;
+  });
+  for (size_t i = 1; i < windows.size(); i++) {
+    if (windows[i].start == windows[i-1].start) {
+      fprintf(stderr,"%s: slice %lu is listed twice\n", path, windows[i].start / interval);
+      exit(1);
+    }
+  }
+  return windows;
+}
+
+// The counters of 'after' the window added to 'before'
+//
+static CacheStats
+stats_delta(const CacheStats &after, const CacheStats &before)
+{
+  CacheStats d = {};
+  d.icacheRefs = after.icacheRefs - before.icacheRefs;
+  d.icacheMisses = after.icacheMisses - before.icacheMisses;
+  d.icachePenalties = after.icachePenalties - before.icachePenalties;
+  d.dcacheRefs = after.dcacheRefs - before.dcacheRefs;
+  d.dcacheMisses = after.dcacheMisses - before.dcacheMisses;
+  d.dcachePenalties = after.dcachePenalties - before.dcachePenalties;
+  d.l2cacheRefs = after.l2cacheRefs - before.l2cacheRefs;
+  d.l2cacheMisses = after.l2cacheMisses - before.l2cacheMisses;
+  d.l2cachePenalties = after.l2cachePenalties - before.l2cachePenalties;
+  d.compulsory_miss = after.compulsory_miss - before.compulsory_miss;
+  d.other_miss = after.other_miss - before.other_miss;
+  d.totalRefs = after.totalRefs - before.totalRefs;
+  d.totalPenalties = after.totalPenalties - before.totalPenalties;
+  return d;
+}
+
+// Two-sided 95% quantile of Student's t with 'df' degrees of freedom
+//
+static double
+t_quantile(uint64_t df)
+{
+  static const double t[] = { 0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+                              2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+                              2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045,
+                              2.042 };
+  if (df <= 30) {
+    return t[df];
+  }
+  return df <= 60 ? 2.000 : df <= 120 ? 1.980 : 1.960;
+}
+
+// Ratio estimate sum(w*num)/sum(w*den) over the windows. Its variance is
+// that of the residuals num - R*den (the delta method), which with equal
+// weights is the usual standard error of a ratio estimator.
+//
+static Estimate
+ratio_estimate(const std::vector<SampleWindow> &windows, uint64_t CacheStats::*num,
+               uint64_t CacheStats::*den)
+{
+  double wnum = 0, wden = 0, wsum = 0;
+  for (const SampleWindow &w : windows) {
+    wnum += w.weight * w.delta.*num;
+    wden += w.weight * w.delta.*den;
+    wsum += w.weight;
+  }
+  if (wden == 0) {
+    return Estimate{0, -1};
+  }
+  double r = wnum / wden;
+  size_t n = windows.size();
+  if (n < 2) {
+    return Estimate{r, -1};
+  }
+  double var = 0;
+  for (const SampleWindow &w : windows) {
+    double e = (w.weight / wsum) * (w.delta.*num - r * w.delta.*den);
+    var += e * e;
+  }
+  if (var == 0) {
+    // every window agrees, as when none saw a miss, which bounds nothing
+    return Estimate{r, -1};
+  }
+  var *= (double)n / (n - 1) / ((wden / wsum) * (wden / wsum));
+  return Estimate{r, t_quantile(n - 1) * sqrt(var)};
+}
+
+// Scale the windows up to the whole trace of 'irefs' I-cache and 'drefs'
+// D-cache accesses: each counter is estimated per access of the cache it
+// belongs to, the shared ones per memory access
+//
+static CacheStats
+extrapolate(const std::vector<SampleWindow> &windows, uint64_t irefs, uint64_t drefs)
+{
+  typedef uint64_t CacheStats::*Field;
+  static const Field ifields[] = { &CacheStats::icacheMisses, &CacheStats::icachePenalties };
+  static const Field dfields[] = { &CacheStats::dcacheMisses, &CacheStats::dcachePenalties };
+  static const Field fields[] = { &CacheStats::l2cacheRefs, &CacheStats::l2cacheMisses,
+                                  &CacheStats::l2cachePenalties, &CacheStats::other_miss,
+                                  &CacheStats::totalPenalties };
+
+  CacheStats s = {};
+  s.icacheRefs = irefs;
+  s.dcacheRefs = drefs;
+  s.totalRefs = irefs + drefs;
+  for (Field f : ifields) {
+    s.*f = llround(ratio_estimate(windows, f, &CacheStats::icacheRefs).value * s.icacheRefs);
+  }
+  for (Field f : dfields) {
+    s.*f = llround(ratio_estimate(windows, f, &CacheStats::dcacheRefs).value * s.dcacheRefs);
+  }
+  for (Field f : fields) {
+    s.*f = llround(ratio_estimate(windows, f, &CacheStats::totalRefs).value * s.totalRefs);
+  }
+  return s;
+}
+
+// Print one estimate, in percent when 'percent'
+//
+static void
+printEstimate(const char *name, const Estimate &e, bool percent)
+{
+  double scale = percent ? 100.0 : 1.0;
+  const char *unit = percent ? "%" : " cycles";
+  if (e.bound < 0) {
+    printf("  %-23s %10.2f%s\n", name, scale * e.value, unit);
+  } else {
+    printf("  %-23s %10.2f%s +- %.2f%s\n", name, scale * e.value, unit, scale * e.bound, unit);
+  }
+}
+
+// Print out how much of the trace was measured and the 95% confidence
+// intervals of the main estimates
+//
+void
+printSampleStats(const CacheConfig &c, const std::vector<SampleWindow> &windows, uint64_t total,
+                 uint64_t warmed)
+{
+  uint64_t measured = 0;
+  for (const SampleWindow &w : windows) {
+    measured += w.delta.totalRefs;
+  }
+  printf("Sampled Statistics:\n");
+  printf("  windows measured:        %10lu\n", (uint64_t)windows.size());
+  printf("  accesses measured:       %10lu (%.2f%%)\n", measured, total ? 100.0 * measured / total : 0.0);
+  if (functionalWarming) {
+    printf("  accesses warmed:         %10lu (%.2f%%)\n", warmed, total ? 100.0 * warmed / total : 0.0);
+  } else {
+    printf("  warming:                       none\n");
+  }
+  if (c.icacheSets) {
+    printEstimate("I-cache miss rate:",
+                  ratio_estimate(windows, &CacheStats::icacheMisses, &CacheStats::icacheRefs), true);
+  }
+  if (c.dcacheSets) {
+    printEstimate("D-cache miss rate:",
+                  ratio_estimate(windows, &CacheStats::dcacheMisses, &CacheStats::dcacheRefs), true);
+  }
+  if (c.l2cacheSets) {
+    printEstimate("L2-cache miss rate:",
+                  ratio_estimate(windows, &CacheStats::l2cacheMisses, &CacheStats::l2cacheRefs), true);
+  }
+  printEstimate("avg Memory access time:",
+                ratio_estimate(windows, &CacheStats::totalPenalties, &CacheStats::totalRefs), false);
+}
+
+// How many accesses to warm before the next window, given the statistics
+// of the detailed accesses so far 's'. Unless set, enough for every level
+// to take as many references as it has lines at the rate the windows
+// referenced it; everything before the first window.
+//
+static uint64_t
+warming_length(const CacheConfig &c, const CacheStats &s)
+{
+  if (!functionalWarming) {
+    return 0;
+  }
+  if (warmingLength) {
+    return warmingLength;
+  }
+  if (!s.totalRefs) {
+    return UINT64_MAX;
+  }
+  uint64_t n = 0;
+  for (auto [lines, refs] : {pair{(uint64_t)c.icacheSets * c.icacheAssoc, s.icacheRefs},
+                             pair{(uint64_t)c.dcacheSets * c.dcacheAssoc, s.dcacheRefs},
+                             pair{(uint64_t)c.l2cacheSets * c.l2cacheAssoc, s.l2cacheRefs}}) {
+    if (refs) {
+      n = std::max(n, lines * s.totalRefs / refs);
+    }
+  }
+  return n;
+}
+
+// Simulate only the sampled windows in detail, each after 'sampleWarmup'
+// detailed but unmeasured accesses. Before that the caches are warmed
+// functionally, tags and replacement state only, on warming_length()
+// accesses; the rest of the trace is skipped, without decoding it where the
+// trace has a seek index. The statistics are extrapolated from the windows
+// to the whole trace.
+//
+void
+run_sampled(const CacheConfig &cfg)
+{
+  CacheHierarchy hierarchy(cfg);
+  std::vector<SampleWindow> windows;
+  uint64_t length = sampleWindow;
+  size_t planned = 0;
+  if (simpointFile) {
+    windows = read_simpoints(simpointFile, simpointInterval);
+    length = simpointInterval;
+  }
+  const uint64_t none = UINT64_MAX;
+  uint64_t next = simpointFile ? (windows.empty() ? none : windows[0].start) : samplePeriod - sampleWindow;
+
+  uint32_t pc = 0;
+  uint32_t addr = 0;
+  char i_or_d = '\0';
+  char r_or_w = '\0';
+  uint64_t n = 0, drefs = 0, warmed = 0;
+
+  while (next != none) {
+    uint64_t detailed = std::max(n, next - std::min(next, sampleWarmup));
+    uint64_t warm = std::max(n, detailed - std::min(detailed, warming_length(cfg, hierarchy.stats())));
+    n += trace->skip(warm - n, drefs);
+    for (; n < detailed && read_mem_access(&pc, &addr, &i_or_d, &r_or_w); n++) {
+      hierarchy.warm(addr, i_or_d, r_or_w);
+      drefs += i_or_d == 'D';
+      warmed++;
+    }
+    for (; n < next && read_mem_access(&pc, &addr, &i_or_d, &r_or_w); n++) {
+      hierarchy.access(pc, addr, i_or_d, r_or_w);
+      drefs += i_or_d == 'D';
+    }
+    CacheStats before = hierarchy.stats();
+    for (; n < next + length && read_mem_access(&pc, &addr, &i_or_d, &r_or_w); n++) {
+      hierarchy.access(pc, addr, i_or_d, r_or_w);
+      drefs += i_or_d == 'D';
+    }
+    if (n < next + length) {
+      break;
+    }
+    CacheStats delta = stats_delta(hierarchy.stats(), before);
+    if (simpointFile) {
+      windows[planned++].delta = delta;
+      next = planned < windows.size() ? windows[planned].start : none;
+    } else {
+      windows.push_back(SampleWindow{next, 1.0, delta});
+      next += samplePeriod;
+    }
+  }
+  // the whole trace is still counted
+  n += trace->skip(UINT64_MAX, drefs);
+  uint64_t irefs = n - drefs;
+
+  if (simpointFile && planned < windows.size()) {
+    fprintf(stderr,"%s: %lu slices lie past the end of the trace\n", simpointFile,
+            (uint64_t)(windows.size() - planned));
+    windows.resize(planned);
+  }
+  if (windows.empty()) {
+    fprintf(stderr,"The trace of %lu accesses ends before the first window\n", n);
+    exit(1);
+  }
+
+  CacheStats stats = extrapolate(windows, irefs, drefs);
+  printCacheConfig(cfg);
+  printCacheStats(cfg, stats, true);
+  printSampleStats(cfg, windows, n, warmed);
+  printTotals(stats);
+}
+
+//------------------------------------//
+//             Multi-Core             //
+//------------------------------------//
+
+// Decodes one core's trace on its own thread, a batch at a time, so the
+// simulation thread only merges the cores
+class CoreFeed
+{
+public:
+  explicit CoreFeed(const char *path)
+    : reader(path), pos(0), done(false)
+  {
+    if (reader.dialect() != TraceDialect::CSE240) {
+      fprintf(stderr,"Trace '%s' is not an I/D trace\n", path);
+      exit(1);
+    }
+    worker = std::thread([this] { run(); });
+  }
+
+  ~CoreFeed()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m);
+      done = true;
+    }
+    cv.notify_all();
+    worker.join();
+  }
+
+  // Next access of this core, false at the end of its trace
+  bool next(SweepAccess &a)
+  {
+    if (pos == batch.size()) {
+      std::unique_lock<std::mutex> lock(m);
+      cv.wait(lock, [this] { return !ready.empty(); });
+      batch = std::move(ready.front());
+      ready.pop_front();
+      pos = 0;
+      cv.notify_all();
+      if (batch.empty()) {
+        // the end marker, leave it for any later call
+        ready.push_front({});
+        return false;
+      }
+    }
+    a = batch[pos++];
+    return true;
+  }
+
+private:
+  static constexpr size_t BATCH = 16384;
+  static constexpr size_t DEPTH = 4;
+
+  void run()
+  {
+    MemAccess a;
+    bool more = true;
+    while (more) {
+      std::vector<SweepAccess> b;
+      b.reserve(BATCH);
+      while (b.size() < BATCH && (more = reader.next(a))) {
+        b.push_back({(uint32_t)a.pc, (uint32_t)a.addr, a.data ? 'D' : 'I', a.write ? 'W' : 'R'});
+      }
+      std::unique_lock<std::mutex> lock(m);
+      cv.wait(lock, [this] { return ready.size() < DEPTH || done; });
+      if (done) {
+        return;
+      }
+      if (!b.empty()) {
+        ready.push_back(std::move(b));
+      }
+      if (!more) {
+        ready.push_back({});
+      }
+      cv.notify_all();
+    }
+  }
+
+  TraceReader reader;
+  std::thread worker;
+  std::mutex m;
+  std::condition_variable cv;
+  std::deque<std::vector<SweepAccess>> ready;  // an empty batch marks the end
+  std::vector<SweepAccess> batch;
+  size_t pos;
+  bool done;
+};
+
+// Simulate one core per trace over the shared L2, merging the traces in
+// the configured order until every one has ended
+//
+void
+run_multicore(const CacheConfig &cfg)
+{
+  if (cfg.prefetch || has_mshrs(cfg) || has_stages(cfg) || cfg.inclusion == InclusionPolicy::EXCLUSIVE) {
+    fprintf(stderr,"Multi-core runs support neither prefetching, MSHRs, the L1 stages nor an exclusive L2\n");
+    exit(1);
+  }
+  uint32_t n = cfg.cores;
+  std::vector<std::unique_ptr<CoreFeed>> feeds;
+  for (const char *path : coreTraces) {
+    feeds.emplace_back(new CoreFeed(path));
+  }
+  MultiCoreHierarchy hierarchy(cfg, n);
+
+  std::vector<uint32_t> live(n);
+  for (uint32_t c = 0; c < n; c++) {
+    live[c] = c;
+  }
+  std::mt19937 rng(1);
+  size_t turn = 0;
+  SweepAccess a;
+  while (!live.empty()) {
+    size_t pick = 0;
+    if (cfg.interleave == Interleave::ROUND_ROBIN) {
+      pick = turn++ % live.size();
+    } else if (cfg.interleave == Interleave::RANDOM) {
+      pick = rng() % live.size();
+    } else {
+      for (size_t i = 1; i < live.size(); i++) {
+        if (hierarchy.cycles(live[i]) < hierarchy.cycles(live[pick])) {
+          pick = i;
+        }
+      }
+    }
+    uint32_t core = live[pick];
+    for (uint32_t q = 0; q < cfg.quantum; q++) {
+      if (!feeds[core]->next(a)) {
+        live.erase(live.begin() + pick);
+        // the next core in turn has moved into this slot
+        turn = pick;
+        break;
+      }
+      hierarchy.access(core, a.addr, a.i_or_d, a.r_or_w);
+    }
+  }
+
+  CacheStats stats = hierarchy.stats();
+  printCacheConfig(cfg);
+  printCacheStats(cfg, stats);
+  printCoreStats(hierarchy, n);
+  printCoherenceStats(hierarchy);
+  if (cfg.classifyMisses) {
+    printMissClassStats(cfg, stats);
+  }
+  if (cfg.trafficReport) {
+    printTrafficStats(cfg, stats);
+  }
+  printTotals(stats);
+}
+
+//------------------------------------//
+//        Interval Statistics         //
+//------------------------------------//
+
+// Where the interval ends, then the counters of the accesses in it
+static const char *const intervalColumns[] = {
+  "interval", "accesses", "cycles",
+  "icache_refs", "icache_misses", "icache_penalties", "icache_writebacks",
+  "dcache_refs", "dcache_misses", "dcache_penalties", "dcache_writebacks",
+  "l2cache_refs", "l2cache_misses", "l2cache_penalties", "l2cache_writebacks",
+  "memory_reads", "memory_writes",
+  "icache_prefetch_fills", "icache_prefetch_used", "icache_prefetch_late",
+  "icache_prefetch_useless", "icache_prefetch_pollution", "icache_prefetch_dropped",
+  "dcache_prefetch_fills", "dcache_prefetch_used", "dcache_prefetch_late",
+  "dcache_prefetch_useless", "dcache_prefetch_pollution", "dcache_prefetch_dropped",
+};
+
+// Append the prefetcher counters of 'after' less those of 'before' to 'v'
+//
+static uint64_t *
+prefetch_delta(uint64_t *v, const PrefetchStats &after, const PrefetchStats &before)
+{
+  *v++ = after.fills - before.fills;
+  *v++ = after.used - before.used;
+  *v++ = after.late - before.late;
+  *v++ = after.useless - before.useless;
+  *v++ = after.pollution - before.pollution;
+  *v++ = after.dropped - before.dropped;
+  return v;
+}
+
+// Record interval 'n', from the counters in 'last' to those of 'h' at trace
+// access 'offset'. 'last' moves on to the end of the interval.
+//
+static void
+take_interval(IntervalWriter &out, uint64_t n, const CacheHierarchy &h, uint64_t offset, CacheStats &last)
+{
+  CacheStats s = h.stats();
+  uint64_t v[std::size(intervalColumns)];
+  uint64_t *p = v;
+  *p++ = n;
+  *p++ = offset;
+  *p++ = h.cycles();
+  *p++ = s.icacheRefs - last.icacheRefs;
+  *p++ = s.icacheMisses - last.icacheMisses;
+  *p++ = s.icachePenalties - last.icachePenalties;
+  *p++ = s.icacheWritebacks - last.icacheWritebacks;
+  *p++ = s.dcacheRefs - last.dcacheRefs;
+  *p++ = s.dcacheMisses - last.dcacheMisses;
+  *p++ = s.dcachePenalties - last.dcachePenalties;
+  *p++ = s.dcacheWritebacks - last.dcacheWritebacks;
+  *p++ = s.l2cacheRefs - last.l2cacheRefs;
+  *p++ = s.l2cacheMisses - last.l2cacheMisses;
+  *p++ = s.l2cachePenalties - last.l2cachePenalties;
+  *p++ = s.l2cacheWritebacks - last.l2cacheWritebacks;
+  *p++ = s.memoryReads - last.memoryReads;
+  *p++ = s.memoryWrites - last.memoryWrites;
+  p = prefetch_delta(p, s.icachePrefetch, last.icachePrefetch);
+  p = prefetch_delta(p, s.dcachePrefetch, last.dcachePrefetch);
+  // record() reads one value per column
+  assert(p == v + std::size(intervalColumns));
+  out.record(v);
+  last = s;
+}
+
 int
 main(int argc, char *argv[])
 {
   // Set defaults
-  set_defaults();
+  config = default_config();
+  traceFile = "-";
 
   // Process cmdline Arguments
   for (int i = 1; i < argc; ++i) {
     if (!strcmp(argv[i],"--help")) {
       usage();
       exit(0);
+    } else if (!strncmp(argv[i],"--sweep=",8)) {
+      sweepFile = argv[i] + 8;
+    } else if (!strncmp(argv[i],"--threads=",10)) {
+      sscanf(argv[i]+10,"%u", &sweepThreads);
+    } else if (!strncmp(argv[i],"--sample=",9)) {
+      if (sscanf(argv[i]+9,"%lu:%lu:%lu", &samplePeriod, &sampleWindow, &sampleWarmup) < 2 ||
+          !sampleWindow || sampleWindow + sampleWarmup > samplePeriod) {
+        fprintf(stderr,"--sample needs 0 < window, window + warmup <= period\n");
+        exit(1);
+      }
+    } else if (!strncmp(argv[i],"--simpoints=",12)) {
+      // the file name runs up to the first ':'
+      char *colon = strchr(argv[i]+12, ':');
+      if (!colon || sscanf(colon+1,"%lu:%lu", &simpointInterval, &sampleWarmup) < 1 || !simpointInterval ||
+          sampleWarmup > simpointInterval) {
+        fprintf(stderr,"--simpoints needs file:interval[:warmup], warmup <= interval\n");
+        exit(1);
+      }
+      *colon = '\0';
+      simpointFile = argv[i]+12;
+    } else if (!strncmp(argv[i],"--checkpoint=",13)) {
+      // the file name runs up to the last ':'
+      char *colon = strrchr(argv[i]+13, ':');
+      if (!colon || sscanf(colon+1,"%lu", &checkpointAt) != 1 || !checkpointAt) {
+        fprintf(stderr,"--checkpoint needs file:offset, offset > 0\n");
+        exit(1);
+      }
+      *colon = '\0';
+      checkpointFile = argv[i]+13;
+    } else if (!strncmp(argv[i],"--restore=",10)) {
+      restoreFile = argv[i]+10;
+    } else if (!strncmp(argv[i],"--interval=",11)) {
+      char unit[16] = "accesses";
+      if (sscanf(argv[i]+11,"%lu:%15s", &intervalLength, unit) < 1 || !intervalLength ||
+          (strcasecmp(unit,"accesses") && strcasecmp(unit,"cycles"))) {
+        fprintf(stderr,"--interval needs n[:accesses|cycles], n > 0\n");
+        exit(1);
+      }
+      intervalCycles = !strcasecmp(unit,"cycles");
+    } else if (!strncmp(argv[i],"--interval-format=",18)) {
+      if (!parse_interval_format(argv[i]+18, intervalFormat)) {
+        fprintf(stderr,"--interval-format is csv or json\n");
+        exit(1);
+      }
+    } else if (!strncmp(argv[i],"--interval-file=",16)) {
+      intervalFile = argv[i]+16;
+    } else if (!strncmp(argv[i],"--record-l2=",12)) {
+      recordFile = argv[i]+12;
+    } else if (!strncmp(argv[i],"--replay-l2=",12)) {
+      replayFile = argv[i]+12;
+    } else if (!strncmp(argv[i],"--warming=",10)) {
+      if (!strcasecmp(argv[i]+10,"none")) {
+        functionalWarming = false;
+      } else if (!strcasecmp(argv[i]+10,"functional")) {
+        functionalWarming = true;
+        warmingLength = 0;
+      } else if (sscanf(argv[i]+10,"functional:%lu", &warmingLength) == 1 && warmingLength) {
+        functionalWarming = true;
+      } else {
+        printf("Unrecognized option %s\n", argv[i]);
+        usage();
+        exit(1);
+      }
     } else if (!strncmp(argv[i],"--",2)) {
-      if (!handle_option(argv[i])) {
+      if (!handle_option(argv[i], config)) {
         printf("Unrecognized option %s\n", argv[i]);
         usage();
         exit(1);
       }
     } else {
-      // Use as input file
-      stream = fopen(argv[i], "r");
+      // Use as input file, one per core
+      traceFile = argv[i];
+      coreTraces.push_back(argv[i]);
+    }
+  }
+
+  bool sampled = samplePeriod || simpointFile;
+  if (samplePeriod && simpointFile) {
+    fprintf(stderr,"Sample periodically or at simpoints, not both\n");
+    exit(1);
+  }
+  if (sampled && sweepFile) {
+    fprintf(stderr,"A sweep simulates the whole trace\n");
+    exit(1);
+  }
+  if ((checkpointFile || restoreFile) && (sampled || sweepFile || coreTraces.size() > 1)) {
+    fprintf(stderr,"Checkpoints are taken of a single hierarchy on a single trace\n");
+    exit(1);
+  }
+  if (intervalLength && (sampled || sweepFile || coreTraces.size() > 1)) {
+    fprintf(stderr,"Intervals are recorded of a single hierarchy on a single trace\n");
+    exit(1);
+  }
+  if ((recordFile || replayFile) && (sampled || coreTraces.size() > 1 || checkpointFile || restoreFile ||
+                                     intervalLength || (recordFile && (sweepFile || replayFile)))) {
+    fprintf(stderr,"An L1 miss stream is recorded by one whole run of a single trace and replayed\n"
+                   "by whole runs, on their own or in a sweep\n");
+    exit(1);
+  }
+
+  if (coreTraces.size() > 1) {
+    if (sweepFile) {
+      fprintf(stderr,"A sweep takes a single trace\n");
+      exit(1);
     }
+    if (sampled) {
+      fprintf(stderr,"A multi-core run simulates the whole traces\n");
+      exit(1);
+    }
+    config.cores = coreTraces.size();
+    run_multicore(config);
+    return 0;
+  }
+
+  // Binary traces are mapped, text traces are decompressed on their own
+  // thread and parsed in place. A replay reads no trace.
+  if (!replayFile) {
+    trace = new TraceReader(traceFile);
+    if (trace->dialect() != TraceDialect::CSE240) {
+      fprintf(stderr,"Trace '%s' is not an I/D trace\n", traceFile);
+      exit(1);
+    }
+  }
+
+  if (sweepFile) {
+    run_sweep(read_sweep_file(sweepFile), sweepThreads);
+    delete trace;
+    return 0;
+  }
+
+  if (sampled) {
+    run_sampled(config);
+    delete trace;
+    return 0;
   }
 
   // Initialize the cache
-  init_cache();
+  std::unique_ptr<MissStreamWriter> record;
+  if (recordFile) {
+    record.reset(new MissStreamWriter(recordFile, l1_config_key(config)));
+  }
+  CacheHierarchy hierarchy(config, record.get());
+  if (replayFile) {
+    hierarchy.replay(replayFile);
+  }
+  CacheConfig key = checkpoint_key(config);
+  uint64_t offset = 0;
+  if (restoreFile) {
+    CheckpointReader in(restoreFile, CheckpointKind::HIERARCHY, &key, sizeof(key));
+    hierarchy.load_state(in);
+    in.finish(*trace);
+    offset = in.header().offset;
+  }
+  uint64_t stop = checkpointFile ? checkpointAt : UINT64_MAX;
+  if (offset >= stop) {
+    fprintf(stderr,"Checkpoint '%s' is already at access %lu\n", restoreFile, offset);
+    exit(1);
+  }
+
+  // The counters at the start of the interval, recorded at 'nextInterval'
+  // accesses or cycles
+  std::unique_ptr<IntervalWriter> intervals;
+  CacheStats intervalStart = {};
+  uint64_t intervalCount = 0;
+  uint64_t nextInterval = UINT64_MAX;
+  if (intervalLength) {
+    intervals.reset(new IntervalWriter(intervalFile, intervalFormat,
+                                       {std::begin(intervalColumns), std::end(intervalColumns)}));
+    intervalStart = hierarchy.stats();
+    nextInterval = ((intervalCycles ? hierarchy.cycles() : offset) / intervalLength + 1) * intervalLength;
+  }
 
-  uint64_t totalRefs = 0;
-  uint64_t totalPenalties = 0;
   uint32_t pc = 0;
   uint32_t addr = 0;
   char i_or_d = '\0';
   char r_or_w = '\0';
 
   // Read each memory access from the trace
-  while (read_mem_access(&pc, &addr, &i_or_d, &r_or_w)) {
-    totalRefs++;
-    // Direct the memory access to the appropriate cache
-    if (i_or_d == 'I') {
-      totalPenalties += icache_access(addr);
-      if(prefetch == TRUE)
-        icache_prefetch(icache_prefetch_addr(pc, addr, r_or_w));
-    } else if (i_or_d == 'D') {
-      totalPenalties += dcache_access(addr);
-      if(prefetch == TRUE)
-        dcache_prefetch(dcache_prefetch_addr(pc, addr, r_or_w));
-    } else {
-      fprintf(stderr,"Input Error '%c' must be either 'I' or 'D'\n", i_or_d);
+  while (trace && offset < stop && read_mem_access(&pc, &addr, &i_or_d, &r_or_w)) {
+    hierarchy.access(pc, addr, i_or_d, r_or_w);
+    offset++;
+    if ((intervalCycles ? hierarchy.cycles() : offset) >= nextInterval) {
+      take_interval(*intervals, intervalCount++, hierarchy, offset, intervalStart);
+      nextInterval = ((intervalCycles ? hierarchy.cycles() : offset) / intervalLength + 1) * intervalLength;
+    }
+  }
+  if (intervals) {
+    // the last, partial interval
+    if (hierarchy.stats().totalRefs != intervalStart.totalRefs) {
+      take_interval(*intervals, intervalCount++, hierarchy, offset, intervalStart);
+    }
+    intervals->close();
+  }
+
+  if (recordFile) {
+    hierarchy.finish_record();
+  }
+
+  if (checkpointFile) {
+    if (offset < stop) {
+      fprintf(stderr,"The trace ends after %lu accesses, before the checkpoint\n", offset);
       exit(1);
     }
+    CheckpointWriter out(checkpointFile, CheckpointKind::HIERARCHY, &key, sizeof(key));
+    hierarchy.save_state(out);
+    out.finish(offset, *trace);
   }
 
-  printCacheConfig();
-  printCacheStats();
-  printf("Total Memory accesses:  %lu\n", totalRefs);
-  printf("Total Memory penalties: %lu\n", totalPenalties);
-  if (totalRefs > 0) {
-    printf("avg Memory access time: %13.2f cycles\n",
-        (double)totalPenalties / totalRefs);
-  } else {
-    printf("avg Memory access time:             -\n");
+  CacheStats stats = hierarchy.stats();
+  printCacheConfig(config);
+  printCacheStats(config, stats);
+  if (config.prefetchReport) {
+    printPrefetchStats(config, stats);
+  }
+  if (config.trafficReport) {
+    printTrafficStats(config, stats);
+  }
+  if (config.classifyMisses) {
+    printMissClassStats(config, stats);
+  }
+  if (has_stages(config)) {
+    printStageStats(config, stats);
+  }
+  if (has_mshrs(config)) {
+    printMshrStats(config, stats);
+  }
+  printTotals(stats);
+  if (checkpointFile) {
+    printf("Checkpoint '%s' taken after %lu accesses\n", checkpointFile, offset);
   }
 
   // Cleanup
-  clean_cache();
-  fclose(stream);
-  free(buf);
+  delete trace;
 
   return 0;
 }
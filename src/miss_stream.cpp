@@ -0,0 +1,197 @@
+//========================================================//
+//  miss_stream.cpp                                       //
+//  L1 miss stream writer and mmap'd reader               //
+//                                                        //
+//  See miss_stream.hpp for the on-disk layout            //
+//========================================================//
+
+#include "miss_stream.hpp"
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <bit>
+
+static_assert(sizeof(MissStreamHeader) == 64, "miss stream header must stay 64 bytes");
+
+uint64_t
+l1_config_key(const CacheConfig &cfg)
+{
+  CacheConfig key = cfg;
+  key.l2cacheSets = 0;
+  key.l2cacheAssoc = 0;
+  key.l2cacheBlocksize = 0;
+  key.l2cacheHitTime = 0;
+  key.l2cachePolicy = ReplacePolicy::LRU;
+  key.l2cacheMshrs = 0;
+  key.l2cacheMshrTargets = 0;
+  key.memspeed = 0;
+  key.trafficReport = 0;
+  key.prefetchReport = 0;
+
+  return fnv1a(&key, sizeof(key));
+}
+
+//------------------------------------//
+//       Miss Stream Writer           //
+//------------------------------------//
+
+MissStreamWriter::MissStreamWriter(const char *path, uint64_t key)
+  : path(path), hdr{}, last(0), used(0)
+{
+  out = fopen(path, "wb");
+  if (!out) {
+    fprintf(stderr, "Cannot create miss stream '%s'\n", path);
+    exit(1);
+  }
+  memcpy(hdr.magic, MISS_STREAM_MAGIC, 4);
+  hdr.version = MISS_STREAM_VERSION;
+  hdr.key = key;
+  fwrite(&hdr, sizeof(hdr), 1, out);
+}
+
+MissStreamWriter::~MissStreamWriter()
+{
+  if (out) {
+    fclose(out);
+  }
+}
+
+void
+MissStreamWriter::flush()
+{
+  fwrite(buf, 1, used, out);
+  hdr.eventBytes += used;
+  used = 0;
+}
+
+void
+MissStreamWriter::finish(const CacheStats &upper)
+{
+  flush();
+  hdr.statsBytes = sizeof(upper);
+  fwrite(&upper, sizeof(upper), 1, out);
+  fseek(out, 0, SEEK_SET);
+  fwrite(&hdr, sizeof(hdr), 1, out);
+  if (fclose(out)) {
+    fprintf(stderr, "Cannot write miss stream '%s'\n", path);
+    exit(1);
+  }
+  out = NULL;
+}
+
+//------------------------------------//
+//       Miss Stream Reader           //
+//------------------------------------//
+
+MissStreamReader::MissStreamReader(const char *path, uint64_t key)
+  : path(path), last(0)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Cannot open miss stream '%s'\n", path);
+    exit(1);
+  }
+  struct stat st;
+  fstat(fd, &st);
+  mapLen = st.st_size;
+  if (mapLen < sizeof(MissStreamHeader)) {
+    fprintf(stderr, "Miss stream '%s' is too short for a header\n", path);
+    exit(1);
+  }
+  map = mmap(NULL, mapLen, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "Cannot map miss stream '%s'\n", path);
+    exit(1);
+  }
+  madvise(map, mapLen, MADV_SEQUENTIAL);
+
+  hdr = (const MissStreamHeader *)map;
+  if (memcmp(hdr->magic, MISS_STREAM_MAGIC, 4) || hdr->version != MISS_STREAM_VERSION) {
+    fprintf(stderr, "'%s' is not a version %u miss stream\n", path, MISS_STREAM_VERSION);
+    exit(1);
+  }
+  if (hdr->statsBytes != sizeof(CacheStats) ||
+      sizeof(MissStreamHeader) + hdr->eventBytes + hdr->statsBytes != mapLen) {
+    corrupt();
+  }
+  if (hdr->key != key) {
+    fprintf(stderr, "Miss stream '%s' was recorded with other L1s\n", path);
+    exit(1);
+  }
+  cur = (const uint8_t *)(hdr + 1);
+  end = cur + hdr->eventBytes;
+  memcpy(&stats, end, sizeof(stats));
+}
+
+MissStreamReader::~MissStreamReader()
+{
+  munmap(map, mapLen);
+}
+
+// The 7-bit groups of the varint that ends in byte 'last' of 'w', counting
+// from the low end, packed into one value
+//
+static inline uint64_t
+varint_word(uint64_t w, unsigned last)
+{
+  uint64_t x = last == 7 ? w : w & ((1ull << (8 * last + 8)) - 1);
+  x = (x & 0x007f007f007f007full) | (x & 0x7f007f007f007f00ull) >> 1;
+  x = (x & 0x00003fff00003fffull) | (x & 0x3fff00003fff0000ull) >> 2;
+  return (x & 0x000000000fffffffull) | (x & 0x0fffffff00000000ull) >> 4;
+}
+
+inline void
+MissStreamReader::decode(uint64_t v, MissRecord &out)
+{
+  if ((v & 7) > (uint64_t)MissEvent::PREFETCH) {
+    corrupt();
+  }
+  uint64_t z = v >> 3;
+  last += (uint32_t)(z >> 1 ^ -(z & 1));
+  out = MissRecord{last, (MissEvent)(v & 7)};
+}
+
+size_t
+MissStreamReader::read(MissRecord *out, size_t n)
+{
+  size_t i = 0;
+  for (; i < n && cur != end; i++) {
+    uint64_t v = 0;
+    uint64_t w = 0;
+    uint64_t stops = 0;
+    if (end - cur >= 8) {
+      memcpy(&w, cur, 8);
+      stops = ~w & 0x8080808080808080ull;
+    }
+    if (stops && std::endian::native == std::endian::little) {
+      // the whole event is in the 8 bytes loaded, most take 2 or 3
+      unsigned stop = countr_zero(stops) / 8;
+      v = varint_word(w, stop);
+      cur += stop + 1;
+    } else {
+      for (unsigned shift = 0;; shift += 7) {
+        if (cur == end || shift > 63) {
+          corrupt();
+        }
+        uint8_t b = *cur++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (b < 0x80) {
+          break;
+        }
+      }
+    }
+    decode(v, out[i]);
+  }
+  return i;
+}
+
+void
+MissStreamReader::corrupt()
+{
+  fprintf(stderr, "Miss stream '%s' is truncated or corrupt\n", path);
+  exit(1);
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include "cache.hpp"
+
+//------------------------------------//
+//        L1 Miss Stream Format       //
+//------------------------------------//
+//
+// What the L1s of a non-inclusive, blocking hierarchy send the L2 does not
+// depend on the L2: it only sends back latencies, which add up. A miss
+// stream records that traffic once so any number of L2s can be run on it
+// without the trace or the L1s.
+//
+// The file is a 64-byte header, the events and then the CacheStats of the
+// recording run without anything the L2 contributed. An event is one LEB128
+// varint of
+//
+//   bits 0-2   : the MissEvent
+//   bits 3-    : zigzag delta of the address against the previous event
+//
+// Everything is in host byte order, as in a checkpoint. The header keys the
+// stream to the L1 side of the configuration, see l1_config_key().
+//
+
+enum class MissEvent : uint8_t
+{
+  IREAD = 0,      // I-side demand read, its latency charged to the I$
+  DREAD = 1,      // D-side demand read, its latency charged to the D$
+  WRITEBACK = 2,  // clean victim
+  DIRTY_WRITEBACK = 3,
+  WRITE = 4,      // store written through the D$
+  PREFETCH = 5    // line an L1 prefetcher brings in
+};
+
+// One decoded event
+struct MissRecord
+{
+  uint32_t addr;
+  MissEvent event;
+};
+
+struct MissStreamHeader
+{
+  char     magic[4];       // "CMSS"
+  uint16_t version;
+  uint16_t reserved;
+  uint64_t key;            // l1_config_key() of the recording run
+  uint64_t events;
+  uint64_t eventBytes;     // length of the events after the header
+  uint64_t statsBytes;     // sizeof(CacheStats) after the events
+  uint64_t unused[3];
+};
+
+constexpr char     MISS_STREAM_MAGIC[4] = {'C', 'M', 'S', 'S'};
+constexpr uint16_t MISS_STREAM_VERSION  = 1;
+
+// Hash of the configuration with the L2, memory and report fields cleared:
+// two runs with the same key send their L2s the same stream
+uint64_t l1_config_key(const CacheConfig &cfg);
+
+// Writes a miss stream keyed by 'key'. The statistics and the header are
+// completed by finish().
+class MissStreamWriter
+{
+public:
+  MissStreamWriter(const char *path, uint64_t key);
+  ~MissStreamWriter();
+  MissStreamWriter(const MissStreamWriter &) = delete;
+  MissStreamWriter &operator=(const MissStreamWriter &) = delete;
+
+  void put(MissEvent e, uint32_t addr)
+  {
+    if (used + MAX_EVENT_BYTES > sizeof(buf)) {
+      flush();
+    }
+    int64_t delta = (int64_t)addr - last;
+    uint64_t v = ((uint64_t)delta << 1 ^ (uint64_t)(delta >> 63)) << 3 | (uint64_t)e;
+    while (v >= 0x80) {
+      buf[used++] = (uint8_t)v | 0x80;
+      v >>= 7;
+    }
+    buf[used++] = (uint8_t)v;
+    last = addr;
+    hdr.events++;
+  }
+
+  // Append the statistics the L2 had no part in and close the file
+  void finish(const CacheStats &upper);
+
+private:
+  static constexpr size_t MAX_EVENT_BYTES = 10;
+
+  void flush();
+
+  FILE *out;
+  const char *path;
+  MissStreamHeader hdr;
+  uint32_t last;           // address of the previous event
+  size_t used;
+  uint8_t buf[1 << 16];
+};
+
+// Maps a miss stream and hands its events back in order. A stream recorded
+// with other L1s is refused.
+class MissStreamReader
+{
+public:
+  MissStreamReader(const char *path, uint64_t key);
+  ~MissStreamReader();
+  MissStreamReader(const MissStreamReader &) = delete;
+  MissStreamReader &operator=(const MissStreamReader &) = delete;
+
+  const MissStreamHeader &header() const { return *hdr; }
+  // The statistics of the recording run without the L2's part
+  const CacheStats &upper() const { return stats; }
+
+  // Decode the next events into 'out', up to 'n' of them. Returns how
+  // many, 0 at the end of the stream.
+  size_t read(MissRecord *out, size_t n);
+
+private:
+  // Check and apply the varint 'v' of one event
+  void decode(uint64_t v, MissRecord &out);
+  [[noreturn]] void corrupt();
+
+  const char *path;
+  void *map;
+  size_t mapLen;
+  const MissStreamHeader *hdr;
+  const uint8_t *cur;
+  const uint8_t *end;
+  uint32_t last;
+  CacheStats stats;
+};
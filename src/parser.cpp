@@ -0,0 +1,78 @@
+//========================================================//
+//  parser.cpp                                            //
+//  Block-oriented parser for both text trace dialects    //
+//========================================================//
+
+#include "parser.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+TraceParser::TraceParser(const char *path)
+  : path(path && strcmp(path, "-") ? path : "<stdin>"), stream(path), dia(TraceDialect::CSE240)
+{
+  // The first block is the whole trace or a full ring slot, it holds the
+  // bytes the identity is taken over whatever the source
+  if (refill()) {
+    id = fnv1a(p, std::min<size_t>(end - p, TRACE_IDENTITY_BYTES));
+  } else {
+    id = fnv1a(NULL, 0);
+  }
+  // The first non-blank character picks the dialect
+  for (;;) {
+    while (p != end && (*p == '\n' || *p == '\r')) {
+      line += *p++ == '\n';
+    }
+    if (p != end) {
+      dia = *p == '#' ? TraceDialect::SIMPLE : TraceDialect::CSE240;
+      break;
+    }
+    if (!refill()) {
+      break;
+    }
+  }
+}
+
+bool
+TraceParser::refill()
+{
+  size_t size;
+  if (!stream.next_block(p, size)) {
+    p = end;
+    return false;
+  }
+  end = p + size;
+  return true;
+}
+
+void
+TraceParser::malformed(const char *start)
+{
+  const char *nl = (const char *)memchr(start, '\n', end - start);
+  int n = (nl ? nl : end) - start;
+  fprintf(stderr, "%s:%lu: malformed trace line '%.*s'\n", path, line + 1, n > 80 ? 80 : n, start);
+  if (dia == TraceDialect::CSE240) {
+    fprintf(stderr, "  expected '0x<pc>\\t0x<addr>\\t<I|D>\\t<R|W>'\n");
+  } else {
+    fprintf(stderr, "  expected '# <rw> <hexaddr> <insts>'\n");
+  }
+  exit(1);
+}
+
+TraceReader::TraceReader(const char *path)
+{
+  if (is_generated_trace(path)) {
+    generated = std::make_unique<TraceGenerator>(path);
+    dia = generated->dialect();
+    id = fnv1a(path, strlen(path));
+  } else if (path && strcmp(path, "-") && is_binary_trace(path)) {
+    binary = std::make_unique<BinaryTrace>(path);
+    dia = binary->header().dialect;
+    id = binary->identity();
+  } else {
+    text = std::make_unique<TraceParser>(path);
+    dia = text->dialect();
+    id = text->identity();
+  }
+}
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <stdint.h>
+#include "trace.hpp"
+#include "stream.hpp"
+#include "generator.hpp"
+
+//------------------------------------//
+//         Text Trace Parsing         //
+//------------------------------------//
+//
+// Decodes text traces block by block straight out of the TraceStream
+// buffers. Hex digits go through a lookup table and no stdio or locale
+// code runs per line. A line that does not match its dialect stops the
+// run with its line number.
+//
+
+// Value of every hex digit character, -1 for everything else
+struct HexTable
+{
+  int8_t v[256];
+  constexpr HexTable() : v{}
+  {
+    for (int c = 0; c < 256; c++) {
+      v[c] = c >= '0' && c <= '9' ? c - '0'
+           : c >= 'a' && c <= 'f' ? c - 'a' + 10
+           : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+    }
+  }
+};
+
+class TraceParser
+{
+public:
+  // Open 'path' ("-" for stdin), the dialect is detected from the first line
+  explicit TraceParser(const char *path);
+
+  TraceDialect dialect() const { return dia; }
+  // Hash of the first bytes of the text
+  uint64_t identity() const { return id; }
+
+  // Decode the next access into 'a', returns false at the end of the trace
+  bool next(MemAccess &a)
+  {
+    for (;;) {
+      if (p == end) {
+        if (!refill()) {
+          return false;
+        }
+      } else if (*p == '\n') {
+        p++;
+        line++;
+      } else if (*p == '\r') {
+        p++;
+      } else {
+        break;
+      }
+    }
+
+    const char *start = p;
+    bool ok = dia == TraceDialect::CSE240 ? parse_cse240(a) : parse_simple(a);
+    if (!ok) {
+      malformed(start);
+    }
+    line++;
+    return true;
+  }
+
+private:
+  static constexpr HexTable HEX{};
+
+  bool refill();
+  [[noreturn]] void malformed(const char *start);
+
+  // 0x<pc>\t0x<addr>\t<I|D>\t<R|W>
+  bool parse_cse240(MemAccess &a)
+  {
+    if (p[0] != '0' || p[1] != 'x') {
+      return false;
+    }
+    p += 2;
+    if (!hex(a.pc) || *p++ != '\t') {
+      return false;
+    }
+    if (p[0] != '0' || p[1] != 'x') {
+      return false;
+    }
+    p += 2;
+    if (!hex(a.addr) || *p++ != '\t') {
+      return false;
+    }
+    char i_or_d = *p++;
+    if ((i_or_d != 'I' && i_or_d != 'D') || *p++ != '\t') {
+      return false;
+    }
+    char r_or_w = *p++;
+    if (r_or_w != 'R' && r_or_w != 'W') {
+      return false;
+    }
+    a.data = i_or_d == 'D';
+    a.write = r_or_w == 'W';
+    return end_of_line();
+  }
+
+  // # <rw> <hexaddr> <insts>
+  bool parse_simple(MemAccess &a)
+  {
+    uint64_t type;
+    if (*p++ != '#' || !blank() || !dec(type) || !blank()) {
+      return false;
+    }
+    if (p[0] == '0' && p[1] == 'x') {
+      p += 2;
+    }
+    if (!hex(a.addr) || !blank() || !dec(a.pc)) {
+      return false;
+    }
+    a.data = true;
+    a.write = type != 0;
+    return end_of_line();
+  }
+
+  // The NUL sentinel behind every block stops all of the scanners below
+  bool hex(uint64_t &v)
+  {
+    const char *s = p;
+    int d;
+    v = 0;
+    while ((d = HEX.v[(uint8_t)*p]) >= 0) {
+      v = v << 4 | d;
+      p++;
+    }
+    return p != s && p - s <= 16;
+  }
+
+  bool dec(uint64_t &v)
+  {
+    const char *s = p;
+    v = 0;
+    while ((unsigned)(*p - '0') < 10) {
+      v = v * 10 + (*p - '0');
+      p++;
+    }
+    return p != s && p - s <= 19;
+  }
+
+  bool blank()
+  {
+    const char *s = p;
+    while (*p == ' ' || *p == '\t') {
+      p++;
+    }
+    return p != s;
+  }
+
+  bool end_of_line()
+  {
+    while (*p == ' ' || *p == '\t' || *p == '\r') {
+      p++;
+    }
+    if (*p == '\n') {
+      p++;
+      return true;
+    }
+    return p == end;
+  }
+
+  const char *path;
+  TraceStream stream;
+  TraceDialect dia;
+  const char *p = NULL;
+  const char *end = NULL;
+  uint64_t line = 0;  // lines fully consumed
+  uint64_t id = 0;
+};
+
+// Any kind of trace behind one next() call: binary traces are mapped,
+// 'gen:' paths are generated and everything else goes through the text
+// parser
+class TraceReader
+{
+public:
+  explicit TraceReader(const char *path);
+
+  TraceDialect dialect() const { return dia; }
+  // Tells traces apart for checkpoints: a hash of the first
+  // TRACE_IDENTITY_BYTES of the text, of the binary header and payload or
+  // of the 'gen:' spec. A trace keeps its identity when compressed, but not
+  // when converted.
+  uint64_t identity() const { return id; }
+
+  bool next(MemAccess &a)
+  {
+    return binary ? binary->next(a) : text ? text->next(a) : generated->next(a);
+  }
+
+  // Move past the next 'n' accesses, adding the D-side ones to 'data'.
+  // Returns how many there were. Only a binary trace skips them undecoded.
+  uint64_t skip(uint64_t n, uint64_t &data)
+  {
+    if (binary) {
+      return binary->skip(n, data);
+    }
+    MemAccess a;
+    uint64_t i = 0;
+    for (; i < n && next(a); i++) {
+      data += a.data;
+    }
+    return i;
+  }
+
+  // Where a binary trace stands, 'records' is 0 for a text trace
+  TracePosition position() const { return binary ? binary->position() : TracePosition{}; }
+  // Jump to 'pos' of a binary trace, returns false if it cannot
+  bool seek(const TracePosition &pos) { return binary && binary->seek(pos); }
+
+private:
+  std::unique_ptr<BinaryTrace> binary;
+  std::unique_ptr<TraceParser> text;
+  std::unique_ptr<TraceGenerator> generated;
+  TraceDialect dia;
+  uint64_t id;
+};
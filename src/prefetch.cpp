@@ -0,0 +1,425 @@
+//========================================================//
+//  prefetch.cpp                                          //
+//  Prefetchers for the Cache Simulator                   //
+//                                                        //
+//  Next-line, PC-indexed stride (RPT) and stream         //
+//  prefetchers for the D$, discontinuity and temporal    //
+//  streaming prefetchers for the I$, and the queue that  //
+//  gives their prefetches a latency                      //
+//========================================================//
+
+#include "prefetch.hpp"
+#include "checkpoint.hpp"
+#include <stdio.h>
+#include <strings.h>
+#include <bit>
+
+//------------------------------------//
+//        Next Line Prefetcher        //
+//------------------------------------//
+
+void
+NextLinePrefetcher::observe(uint32_t pc, uint32_t addr, bool miss, bool used, vector<uint32_t> &out)
+{
+  out.push_back(addr + blockSize);
+}
+
+//------------------------------------//
+//          Stride Prefetcher         //
+//------------------------------------//
+
+StridePrefetcher::StridePrefetcher(uint32_t degree, uint32_t distance)
+  : table(ENTRIES, Entry{0, 0, 0, 0, false}), degree(degree), distance(distance)
+{
+}
+
+void
+StridePrefetcher::observe(uint32_t pc, uint32_t addr, bool miss, bool used, vector<uint32_t> &out)
+{
+  Entry &e = table[(pc >> 2) % ENTRIES];
+  if (!e.valid || e.pc != pc) {
+    e = Entry{pc, addr, 0, 0, true};
+    return;
+  }
+
+  int32_t stride = (int32_t)(addr - e.last);
+  if (stride == e.stride) {
+    if (e.conf < CONF_MAX) {
+      e.conf++;
+    }
+  } else {
+    // keep a trained stride through one irregular access
+    if (e.conf > 0) {
+      e.conf--;
+    }
+    if (e.conf == 0) {
+      e.stride = stride;
+    }
+  }
+  e.last = addr;
+
+  if (e.conf >= CONF_ISSUE && e.stride != 0) {
+    for (uint32_t k = 0; k < degree; k++) {
+      out.push_back(addr + (uint32_t)e.stride * (distance + k));
+    }
+  }
+}
+
+//------------------------------------//
+//          Stream Prefetcher         //
+//------------------------------------//
+
+StreamPrefetcher::StreamPrefetcher(uint32_t blockSize, uint32_t degree, uint32_t distance)
+  : streams(STREAMS, Stream{0, 0, 0, false}), blockBits(countr_zero(blockSize)),
+    degree(degree), distance(distance), clock(0)
+{
+}
+
+void
+StreamPrefetcher::observe(uint32_t pc, uint32_t addr, bool miss, bool used, vector<uint32_t> &out)
+{
+  uint32_t block = addr >> blockBits;
+  clock++;
+
+  // A trained stream advances on any access just ahead of it, so the
+  // prefetched blocks it turns into hits keep it running
+  for (Stream &s : streams) {
+    if (!s.valid || !s.dir) {
+      continue;
+    }
+    int32_t ahead = (int32_t)(block - s.last) * s.dir;
+    if (ahead > 0 && ahead <= WINDOW) {
+      s.last = block;
+      s.lru = clock;
+      for (uint32_t k = 0; k < degree; k++) {
+        out.push_back((block + s.dir * (int32_t)(distance + k)) << blockBits);
+      }
+      return;
+    }
+  }
+  if (!miss) {
+    return;
+  }
+
+  // A second miss near a new stream gives it a direction
+  Stream *victim = &streams[0];
+  for (Stream &s : streams) {
+    if (s.valid && !s.dir) {
+      int32_t delta = (int32_t)(block - s.last);
+      if (delta != 0 && delta >= -WINDOW && delta <= WINDOW) {
+        s.dir = delta > 0 ? 1 : -1;
+        s.last = block;
+        s.lru = clock;
+        return;
+      }
+    }
+    if (!s.valid || (victim->valid && s.lru < victim->lru)) {
+      victim = &s;
+    }
+  }
+  *victim = Stream{block, 0, clock, true};
+}
+
+//------------------------------------//
+//     Discontinuity Prefetcher       //
+//------------------------------------//
+
+DiscontinuityPrefetcher::DiscontinuityPrefetcher(uint32_t blockSize, uint32_t degree)
+  : table(ENTRIES, Entry{0, 0, false}), blockBits(countr_zero(blockSize)), degree(degree), lastLine(0)
+{
+}
+
+void
+DiscontinuityPrefetcher::observe(uint32_t pc, uint32_t addr, bool miss, bool used, vector<uint32_t> &out)
+{
+  uint32_t line = addr >> blockBits;
+  if (line == lastLine) {
+    return;
+  }
+  // learn the jumps that cost, or would have cost, a miss
+  if ((miss || used) && line != lastLine + 1) {
+    table[lastLine % ENTRIES] = Entry{lastLine, line, true};
+  }
+  lastLine = line;
+
+  for (uint32_t k = 1; k <= degree; k++) {
+    out.push_back((line + k) << blockBits);
+  }
+  const Entry &e = table[line % ENTRIES];
+  if (e.valid && e.line == line) {
+    for (uint32_t k = 0; k <= degree; k++) {
+      out.push_back((e.target + k) << blockBits);
+    }
+  }
+}
+
+//------------------------------------//
+//  Temporal Instruction Streaming    //
+//------------------------------------//
+
+TemporalPrefetcher::TemporalPrefetcher(uint32_t blockSize, uint32_t degree)
+  : history(HISTORY, 0), index(INDEX, IndexEntry{0, 0}), head(0), replay(0), active(false),
+    blockBits(countr_zero(blockSize)), degree(degree)
+{
+}
+
+void
+TemporalPrefetcher::replay_one(vector<uint32_t> &out)
+{
+  if (!active || replay >= head || head - replay > HISTORY) {
+    active = false;
+    return;
+  }
+  out.push_back(history[replay++ % HISTORY] << blockBits);
+}
+
+void
+TemporalPrefetcher::observe(uint32_t pc, uint32_t addr, bool miss, bool used, vector<uint32_t> &out)
+{
+  if (!miss && !used) {
+    return;
+  }
+  uint32_t line = addr >> blockBits;
+  IndexEntry &e = index[line % INDEX];
+
+  if (miss) {
+    // restart from where this line missed last time
+    active = e.pos && e.line == line && head - (e.pos - 1) <= HISTORY;
+    replay = e.pos;
+    for (uint32_t k = 0; k < degree; k++) {
+      replay_one(out);
+    }
+  } else {
+    replay_one(out);
+  }
+
+  history[head % HISTORY] = line;
+  e = IndexEntry{line, ++head};
+}
+
+//------------------------------------//
+//           Prefetch Queue           //
+//------------------------------------//
+
+PrefetchQueue::PrefetchQueue(CacheBase *cache, CacheBase *next, uint32_t blockSize, uint32_t nextHitTime,
+                             uint32_t memspeed, uint32_t depth, uint32_t entries)
+  : cache(cache), next(next), blockBits(countr_zero(blockSize)), nextHitTime(nextHitTime),
+    memspeed(memspeed), depth(depth), slots(entries), late(0), dropped(0)
+{
+  inflight.reserve(slots);
+}
+
+bool
+PrefetchQueue::pending(uint32_t block) const
+{
+  for (const Request &r : inflight) {
+    if (r.block == block) {
+      return true;
+    }
+  }
+  for (uint32_t b : queue) {
+    if (b == block) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void
+PrefetchQueue::retire(uint64_t now)
+{
+  for (size_t i = 0; i < inflight.size();) {
+    if (inflight[i].ready <= now) {
+      cache->cache_install(inflight[i].block << blockBits, inflight[i].dirty);
+      inflight[i] = inflight.back();
+      inflight.pop_back();
+    } else {
+      i++;
+    }
+  }
+}
+
+uint32_t
+PrefetchQueue::claim(uint32_t addr, uint64_t now)
+{
+  uint32_t block = addr >> blockBits;
+  for (size_t i = 0; i < inflight.size(); i++) {
+    if (inflight[i].block == block) {
+      uint32_t wait = inflight[i].ready - now;
+      cache->cache_install(addr, inflight[i].dirty);
+      inflight[i] = inflight.back();
+      inflight.pop_back();
+      late++;
+      return wait;
+    }
+  }
+  // not issued yet, the demand miss fetches it instead
+  for (auto it = queue.begin(); it != queue.end(); ++it) {
+    if (*it == block) {
+      queue.erase(it);
+      late++;
+      break;
+    }
+  }
+  return 0;
+}
+
+void
+PrefetchQueue::push(uint32_t addr)
+{
+  uint32_t block = addr >> blockBits;
+  if (cache->cache_probe(addr) || pending(block)) {
+    return;
+  }
+  if (queue.size() == depth) {
+    dropped++;
+    return;
+  }
+  queue.push_back(block);
+}
+
+void
+PrefetchQueue::issue(uint64_t now)
+{
+  while (!queue.empty() && inflight.size() < slots) {
+    uint32_t addr = queue.front() << blockBits;
+    uint32_t latency = memspeed;
+    bool dirty = false;
+    if (next) {
+      latency = next->cache_probe(addr) ? nextHitTime : nextHitTime + memspeed;
+      next->cache_prefetch(addr, PrefetchPolicy::NEXT_LINE);
+      dirty = next->take_dirty();
+    }
+    inflight.push_back(Request{queue.front(), now + latency, dirty});
+    queue.pop_front();
+  }
+}
+
+//------------------------------------//
+//        Prefetcher Selection        //
+//------------------------------------//
+
+Prefetcher *
+make_prefetcher(PrefetchPolicy policy, uint32_t blockSize, uint32_t degree, uint32_t distance)
+{
+  switch (policy) {
+  case PrefetchPolicy::STRIDE:
+    return new StridePrefetcher(degree, distance);
+  case PrefetchPolicy::STREAM:
+    return new StreamPrefetcher(blockSize, degree, distance);
+  case PrefetchPolicy::DISCONTINUITY:
+    return new DiscontinuityPrefetcher(blockSize, degree);
+  case PrefetchPolicy::TEMPORAL:
+    return new TemporalPrefetcher(blockSize, degree);
+  default:
+    return new NextLinePrefetcher(blockSize);
+  }
+}
+
+static const char *prefetchNames[] = { "nextline", "stride", "stream", "discontinuity", "temporal" };
+
+const char *
+prefetch_name(PrefetchPolicy policy)
+{
+  return prefetchNames[(int)policy];
+}
+
+bool
+parse_prefetch(const char *name, bool icache, PrefetchPolicy &policy)
+{
+  for (size_t i = 0; i < sizeof(prefetchNames) / sizeof(prefetchNames[0]); i++) {
+    if (!strcasecmp(name, prefetchNames[i])) {
+      PrefetchPolicy p = (PrefetchPolicy)i;
+      bool ionly = p == PrefetchPolicy::DISCONTINUITY || p == PrefetchPolicy::TEMPORAL;
+      bool donly = p == PrefetchPolicy::STRIDE || p == PrefetchPolicy::STREAM;
+      if ((icache && donly) || (!icache && ionly)) {
+        return false;
+      }
+      policy = p;
+      return true;
+    }
+  }
+  return false;
+}
+
+//------------------------------------//
+//            Checkpoints             //
+//------------------------------------//
+
+void
+StridePrefetcher::save_state(CheckpointWriter &out) const
+{
+  out.put(table);
+}
+
+void
+StridePrefetcher::load_state(CheckpointReader &in)
+{
+  in.get(table);
+}
+
+void
+StreamPrefetcher::save_state(CheckpointWriter &out) const
+{
+  out.put(streams);
+  out.put(clock);
+}
+
+void
+StreamPrefetcher::load_state(CheckpointReader &in)
+{
+  in.get(streams);
+  in.get(clock);
+}
+
+void
+DiscontinuityPrefetcher::save_state(CheckpointWriter &out) const
+{
+  out.put(table);
+  out.put(lastLine);
+}
+
+void
+DiscontinuityPrefetcher::load_state(CheckpointReader &in)
+{
+  in.get(table);
+  in.get(lastLine);
+}
+
+void
+TemporalPrefetcher::save_state(CheckpointWriter &out) const
+{
+  out.put(history);
+  out.put(index);
+  out.put(head);
+  out.put(replay);
+  out.put(active);
+}
+
+void
+TemporalPrefetcher::load_state(CheckpointReader &in)
+{
+  in.get(history);
+  in.get(index);
+  in.get(head);
+  in.get(replay);
+  in.get(active);
+}
+
+void
+PrefetchQueue::save_state(CheckpointWriter &out) const
+{
+  out.put(queue);
+  out.put(inflight);
+  out.put(late);
+  out.put(dropped);
+}
+
+void
+PrefetchQueue::load_state(CheckpointReader &in)
+{
+  in.get(queue);
+  in.get(inflight);
+  in.get(late);
+  in.get(dropped);
+}
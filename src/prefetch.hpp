@@ -0,0 +1,234 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include "cache.hpp"
+
+using namespace std;
+
+//------------------------------------//
+//            Prefetchers             //
+//------------------------------------//
+
+// Watches the demand accesses of one cache and proposes addresses to
+// prefetch into it
+class Prefetcher
+{
+public:
+    virtual ~Prefetcher() = default;
+
+    // Observe a demand access to 'addr' by the instruction at 'pc'. 'miss'
+    // tells whether it missed in the cache and 'used' whether it was the
+    // first use of a prefetched line. Addresses to prefetch are appended
+    // to 'out'.
+    virtual void observe(uint32_t pc, uint32_t addr, bool miss, bool used, vector<uint32_t> &out) = 0;
+
+    // Checkpoint the prediction tables, a stateless prefetcher has none
+    virtual void save_state(CheckpointWriter &out) const {}
+    virtual void load_state(CheckpointReader &in) {}
+};
+
+// The next block after every access
+class NextLinePrefetcher : public Prefetcher
+{
+public:
+    explicit NextLinePrefetcher(uint32_t blockSize) : blockSize(blockSize) {}
+
+    void observe(uint32_t pc, uint32_t addr, bool miss, bool used, vector<uint32_t> &out) override;
+
+private:
+    uint32_t blockSize;
+};
+
+// Reference prediction table: one entry per load/store PC holding its last
+// address, stride and a 2-bit confidence counter. The first new delta only
+// sets the stride and every repeat of it raises the confidence, so from the
+// third equal delta in a row (the fourth access of the PC) on, 'degree'
+// prefetches are issued starting 'distance' strides ahead.
+class StridePrefetcher : public Prefetcher
+{
+public:
+    StridePrefetcher(uint32_t degree, uint32_t distance);
+
+    void observe(uint32_t pc, uint32_t addr, bool miss, bool used, vector<uint32_t> &out) override;
+    void save_state(CheckpointWriter &out) const override;
+    void load_state(CheckpointReader &in) override;
+
+private:
+    static constexpr uint32_t ENTRIES = 256;
+    static constexpr uint8_t CONF_MAX = 3;
+    static constexpr uint8_t CONF_ISSUE = 2;
+
+    struct Entry
+    {
+        uint32_t pc;
+        uint32_t last;   // last address
+        int32_t stride;
+        uint8_t conf;
+        bool valid;
+    };
+
+    vector<Entry> table;
+    uint32_t degree;
+    uint32_t distance;
+};
+
+// Tracks up to STREAMS ascending or descending block streams. A miss that
+// matches no stream allocates one, a second miss within WINDOW blocks sets
+// its direction, and from then on every access that moves the stream
+// forward prefetches 'degree' blocks starting 'distance' blocks ahead.
+class StreamPrefetcher : public Prefetcher
+{
+public:
+    StreamPrefetcher(uint32_t blockSize, uint32_t degree, uint32_t distance);
+
+    void observe(uint32_t pc, uint32_t addr, bool miss, bool used, vector<uint32_t> &out) override;
+    void save_state(CheckpointWriter &out) const override;
+    void load_state(CheckpointReader &in) override;
+
+private:
+    static constexpr uint32_t STREAMS = 16;
+    static constexpr int32_t WINDOW = 8;
+
+    struct Stream
+    {
+        uint32_t last;  // last block of the stream
+        int32_t dir;    // +1 ascending, -1 descending, 0 not trained yet
+        uint64_t lru;   // last use, larger is more recent
+        bool valid;
+    };
+
+    vector<Stream> streams;
+    uint32_t blockBits;
+    uint32_t degree;
+    uint32_t distance;
+    uint64_t clock;
+};
+
+// Discontinuity prefetcher for the I$: remembers, per fetch line, the
+// non-sequential line that followed it the last time that transition
+// missed. Every new fetch line prefetches the next 'degree' lines and,
+// when the line has a recorded discontinuity, its target and the
+// 'degree' lines after the target.
+class DiscontinuityPrefetcher : public Prefetcher
+{
+public:
+    DiscontinuityPrefetcher(uint32_t blockSize, uint32_t degree);
+
+    void observe(uint32_t pc, uint32_t addr, bool miss, bool used, vector<uint32_t> &out) override;
+    void save_state(CheckpointWriter &out) const override;
+    void load_state(CheckpointReader &in) override;
+
+private:
+    static constexpr uint32_t ENTRIES = 1024;
+
+    struct Entry
+    {
+        uint32_t line;
+        uint32_t target;
+        bool valid;
+    };
+
+    vector<Entry> table;
+    uint32_t blockBits;
+    uint32_t degree;
+    uint32_t lastLine;
+};
+
+// Temporal instruction streaming for the I$: the lines that missed, or
+// would have missed without a prefetch, are logged in a circular history
+// with an index from line to its latest position. A miss that is found in
+// the index replays the 'degree' lines that followed it last time, and
+// each use of a replayed line pulls in one more.
+class TemporalPrefetcher : public Prefetcher
+{
+public:
+    TemporalPrefetcher(uint32_t blockSize, uint32_t degree);
+
+    void observe(uint32_t pc, uint32_t addr, bool miss, bool used, vector<uint32_t> &out) override;
+    void save_state(CheckpointWriter &out) const override;
+    void load_state(CheckpointReader &in) override;
+
+private:
+    static constexpr uint32_t HISTORY = 1 << 16;
+    static constexpr uint32_t INDEX = 1 << 14;
+
+    struct IndexEntry
+    {
+        uint32_t line;
+        uint64_t pos;   // position in the history + 1, 0 = empty
+    };
+
+    // Prefetch the next line of the active stream, if it is still recorded
+    void replay_one(vector<uint32_t> &out);
+
+    vector<uint32_t> history;
+    vector<IndexEntry> index;
+    uint64_t head;      // next history position to write
+    uint64_t replay;    // next history position to prefetch
+    bool active;        // a stream is being replayed
+    uint32_t blockBits;
+    uint32_t degree;
+};
+
+// Timing model for one L1 prefetcher. Proposed prefetches wait in a FIFO
+// issue queue of 'depth' entries, and are issued as one of 'entries'
+// in-flight slots frees up. An issued line is filled into the level below at once
+// but reaches the L1 only after the L2 hit time, plus 'memspeed' when it
+// missed there. A demand access to a line that is still queued or in flight
+// is a late prefetch; an in-flight line is installed and the access waits
+// only for the cycles left.
+class PrefetchQueue
+{
+public:
+    PrefetchQueue(CacheBase *cache, CacheBase *next, uint32_t blockSize, uint32_t nextHitTime,
+                  uint32_t memspeed, uint32_t depth, uint32_t entries);
+
+    // Install the lines that have arrived by cycle 'now'
+    void retire(uint64_t now);
+    // A demand access to 'addr' at cycle 'now', returns the cycles it still
+    // has to wait for a prefetch in flight
+    uint32_t claim(uint32_t addr, uint64_t now);
+    // Queue a prefetch of 'addr' unless its line is present, queued or in flight
+    void push(uint32_t addr);
+    // Issue queued prefetches into the free in-flight entries at cycle 'now'
+    void issue(uint64_t now);
+
+    uint64_t get_late() const { return late; }
+    uint64_t get_dropped() const { return dropped; }
+
+    void save_state(CheckpointWriter &out) const;
+    void load_state(CheckpointReader &in);
+
+private:
+    struct Request
+    {
+        uint32_t block;
+        uint64_t ready;  // cycle the line reaches the L1
+        bool dirty;      // moved up dirty out of an exclusive L2
+    };
+
+    bool pending(uint32_t block) const;
+
+    CacheBase *cache;
+    CacheBase *next;
+    deque<uint32_t> queue;    // blocks waiting to issue
+    vector<Request> inflight;
+    uint32_t blockBits;
+    uint32_t nextHitTime;
+    uint32_t memspeed;
+    uint32_t depth;
+    uint32_t slots;
+    uint64_t late;
+    uint64_t dropped;
+};
+
+// Build the prefetcher 'policy' for a cache with 'blockSize' byte lines
+Prefetcher *make_prefetcher(PrefetchPolicy policy, uint32_t blockSize, uint32_t degree, uint32_t distance);
+
+// Name of 'policy' as accepted by --prefetch= and --iprefetch=
+const char *prefetch_name(PrefetchPolicy policy);
+// Parse a prefetcher name, returns false if 'name' is not one or does not
+// work on the 'icache' or D$ side
+bool parse_prefetch(const char *name, bool icache, PrefetchPolicy &policy);
@@ -0,0 +1,151 @@
+#include "set_simd.hpp"
+#include <bit>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SET_SIMD_X86 1
+#endif
+
+namespace {
+
+uint64_t match_scalar(const uint64_t *tags, unsigned ways, uint64_t tag)
+{
+  uint64_t hits = 0;
+  for (unsigned i = 0; i < ways; i++) hits |= (uint64_t)(tags[i] == tag) << i;
+  return hits;
+}
+
+unsigned oldest_scalar(const uint8_t *priority, unsigned ways)
+{
+  unsigned way = 0;
+  for (unsigned i = 1; i < ways; i++) {
+    if (priority[i] > priority[way]) way = i;
+  }
+  return way;
+}
+
+void age_scalar(uint8_t *priority, unsigned ways, unsigned accessed)
+{
+  for (unsigned i = 0; i < ways; i++) {
+    priority[i] += priority[i] <= accessed && priority[i] < ways;
+  }
+}
+
+#ifdef SET_SIMD_X86
+
+// Lanes 0..15 of a priority chunk, to mask off the ways past the set
+__attribute__((target("sse4.2")))
+inline __m128i lane_index()
+{
+  return _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+}
+
+// Unsigned a <= b for every byte
+__attribute__((target("sse4.2")))
+inline __m128i le_epu8(__m128i a, __m128i b)
+{
+  return _mm_cmpeq_epi8(_mm_max_epu8(a, b), b);
+}
+
+__attribute__((target("sse4.2")))
+uint64_t match_sse42(const uint64_t *tags, unsigned ways, uint64_t tag)
+{
+  __m128i key = _mm_set1_epi64x(tag);
+  uint64_t hits = 0;
+  for (unsigned i = 0; i < ways; i += 2) {
+    __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tags + i));
+    uint64_t m = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(t, key)));
+    hits |= m << i;
+  }
+  return hits & (~0ull >> (64 - ways));
+}
+
+__attribute__((target("sse4.2")))
+unsigned oldest_sse42(const uint8_t *priority, unsigned ways)
+{
+  // reduce to the largest priority, then find its first lane
+  __m128i idx = lane_index();
+  __m128i top = _mm_setzero_si128();
+  for (unsigned i = 0; i < ways; i += 16) {
+    __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(priority + i));
+    __m128i live = le_epu8(idx, _mm_set1_epi8((char)(ways - 1 - i < 15 ? ways - 1 - i : 15)));
+    top = _mm_max_epu8(top, _mm_and_si128(p, live));
+  }
+  top = _mm_max_epu8(top, _mm_srli_si128(top, 8));
+  top = _mm_max_epu8(top, _mm_srli_si128(top, 4));
+  top = _mm_max_epu8(top, _mm_srli_si128(top, 2));
+  top = _mm_max_epu8(top, _mm_srli_si128(top, 1));
+  __m128i max = _mm_set1_epi8((char)_mm_cvtsi128_si32(top));
+
+  for (unsigned i = 0;; i += 16) {
+    __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(priority + i));
+    unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(p, max));
+    if (m) return i + std::countr_zero(m);
+  }
+}
+
+__attribute__((target("sse4.2")))
+void age_sse42(uint8_t *priority, unsigned ways, unsigned accessed)
+{
+  __m128i idx = lane_index();
+  __m128i acc = _mm_set1_epi8((char)accessed);
+  __m128i below = _mm_set1_epi8((char)(ways - 1));
+  for (unsigned i = 0; i < ways; i += 16) {
+    auto *chunk = reinterpret_cast<__m128i *>(priority + i);
+    __m128i p = _mm_loadu_si128(chunk);
+    __m128i live = le_epu8(idx, _mm_set1_epi8((char)(ways - 1 - i < 15 ? ways - 1 - i : 15)));
+    __m128i inc = _mm_and_si128(_mm_and_si128(le_epu8(p, acc), le_epu8(p, below)), live);
+    // the compare masks are -1, so subtracting adds one
+    _mm_storeu_si128(chunk, _mm_sub_epi8(p, inc));
+  }
+}
+
+__attribute__((target("avx2")))
+uint64_t match_avx2(const uint64_t *tags, unsigned ways, uint64_t tag)
+{
+  __m256i key = _mm256_set1_epi64x(tag);
+  uint64_t hits = 0;
+  for (unsigned i = 0; i < ways; i += 4) {
+    __m256i t = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(tags + i));
+    uint64_t m = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(t, key)));
+    hits |= m << i;
+  }
+  return hits & (~0ull >> (64 - ways));
+}
+
+#endif
+
+const SetOps ops[] = {
+  {match_scalar, oldest_scalar, age_scalar},
+#ifdef SET_SIMD_X86
+  {match_sse42, oldest_sse42, age_sse42},
+  // priorities are at most 64 bytes, the 16-byte versions are already one or
+  // a few instructions per set
+  {match_avx2, oldest_sse42, age_sse42},
+#endif
+};
+
+} // namespace
+
+SimdLevel simd_detect()
+{
+#ifdef SET_SIMD_X86
+  if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+  if (__builtin_cpu_supports("sse4.2")) return SimdLevel::SSE42;
+#endif
+  return SimdLevel::SCALAR;
+}
+
+const char *simd_name(SimdLevel level)
+{
+  switch (level) {
+  case SimdLevel::AVX2: return "avx2";
+  case SimdLevel::SSE42: return "sse4.2";
+  default: return "scalar";
+  }
+}
+
+const SetOps &set_ops(SimdLevel level)
+{
+  return ops[(int)level];
+}
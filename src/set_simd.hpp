@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Whole-set operations for the CacheSim set records, in a scalar version and
+ * SSE4.2 / AVX2 versions picked at runtime from what the host supports.
+ *
+ * The vector versions read whole vectors, so callers must keep the tags
+ * followed by at least three more words and the priority bytes padded to a
+ * multiple of 16. Bytes past 'ways' are never written.
+ */
+enum class SimdLevel
+{
+  SCALAR,
+  SSE42,
+  AVX2
+};
+
+struct SetOps
+{
+  // Bit i is set when tags[i] == tag, for i < ways
+  uint64_t (*match)(const uint64_t *tags, unsigned ways, uint64_t tag);
+  // Index of the first largest priority, the LRU way
+  unsigned (*oldest)(const uint8_t *priority, unsigned ways);
+  // Age every way with a priority at most 'accessed' (and below 'ways') by one
+  void (*age)(uint8_t *priority, unsigned ways, unsigned accessed);
+};
+
+// Best level the host supports
+SimdLevel simd_detect();
+const char *simd_name(SimdLevel level);
+// The operations for 'level', which must not exceed simd_detect()
+const SetOps &set_ops(SimdLevel level);
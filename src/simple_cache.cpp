@@ -3,12 +3,23 @@
 #include <string>
 #include <fstream>
 #include <vector>
-#include <bitset>
 #include <tuple>
 #include <bit>
 #include <ranges>
 #include <span>
+#include <string_view>
 #include <cassert>
+#include <memory>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "trace.hpp"
+#include "parser.hpp"
+#include "stack_distance.hpp"
+#include "set_simd.hpp"
+#include "checkpoint.hpp"
+#include "interval.hpp"
 using namespace std;
 
 /**
@@ -18,24 +29,87 @@ using namespace std;
  *  ****** TAG ******|**** SET ****|** OFFSET **|
  */
 
+/*
+ * Bounded queue handing batches of accesses from the trace front end to one
+ * shard worker
+ */
+template <typename T>
+class BatchQueue
+{
+public:
+  void push(std::vector<T> &&batch)
+  {
+    std::unique_lock<std::mutex> l(lock);
+    cond.wait(l, [&] { return batches.size() < DEPTH; });
+    batches.push_back(std::move(batch));
+    cond.notify_all();
+  }
+
+  // Returns false once the queue is closed and drained
+  bool pop(std::vector<T> &batch)
+  {
+    std::unique_lock<std::mutex> l(lock);
+    cond.wait(l, [&] { return !batches.empty() || closed; });
+    if (batches.empty()) return false;
+    batch = std::move(batches.front());
+    batches.pop_front();
+    cond.notify_all();
+    return true;
+  }
+
+  void close()
+  {
+    std::lock_guard<std::mutex> l(lock);
+    closed = true;
+    cond.notify_all();
+  }
+
+private:
+  static constexpr size_t DEPTH = 8;
+  std::mutex lock;
+  std::condition_variable cond;
+  std::deque<std::vector<T>> batches;
+  bool closed = false;
+};
+
 class CacheSim
 {
 public:
-  CacheSim(std::string input, unsigned block_sz, unsigned asso, unsigned capacity, unsigned miss_penalty, unsigned dirty_wb_penalty)
+  CacheSim(std::string input, unsigned block_sz, unsigned asso, unsigned capacity, unsigned miss_penalty, unsigned dirty_wb_penalty,
+           SimdLevel simd = simd_detect())
       : block_size(block_sz), associativity(asso), capacity(capacity), miss_penalty(miss_penalty), dirty_wb_penalty(dirty_wb_penalty)
   {
 
-    auto num_blocks = capacity / block_size;
     auto sets = capacity / (block_size * associativity);
 
-    infile.open(input);
+    trace = std::make_unique<TraceReader>(input.c_str());
+    if (trace->dialect() != TraceDialect::SIMPLE) {
+      std::cerr << input << " is not a '# <rw> <addr> <insts>' trace\n";
+      exit(1);
+    }
 
-    tags.resize(num_blocks);
-    dirty.resize(num_blocks);
-    valid.resize(num_blocks);
-    priority.resize(num_blocks);
+    if (associativity == 0 || associativity > 64) {
+      std::cerr << "associativity must be between 1 and 64\n";
+      exit(1);
+    }
+    way_mask = ~0ull >> (64 - associativity);
+    set_words = record_words(associativity);
+    layout.resize(sets * set_words / 8);
+
+    ops = &set_ops(simd);
+    // wide sets compare and age all ways at once when the host has vectors,
+    // the common narrow associativities get the way loops unrolled
+    if (simd != SimdLevel::SCALAR && associativity >= 8) {
+      probe_fn = &CacheSim::probe_vector;
+    } else switch (associativity) {
+    case 2: probe_fn = &CacheSim::probe_ways<2>; break;
+    case 4: probe_fn = &CacheSim::probe_ways<4>; break;
+    case 8: probe_fn = &CacheSim::probe_ways<8>; break;
+    case 16: probe_fn = &CacheSim::probe_ways<16>; break;
+    default: probe_fn = &CacheSim::probe_ways<0>; break;
+    }
 
-    auto set_offset = std::popcount(block_size - 1); // bits of Z
+    set_offset = std::popcount(block_size - 1); // bits of Z
     set_mask = sets - 1;
     auto set_bits = std::popcount(set_mask); // bits of Y
     tag_offset = set_bits + set_offset;
@@ -43,29 +117,156 @@ public:
 
   ~CacheSim()
   {
-    infile.close();
     dump_stats();
   }
 
-  void run()
+  /*
+   * @brief simulate the trace up to access 'limit' (all of it by default)
+   */
+  void run(unsigned threads = 1, uint64_t limit = UINT64_MAX)
   {
-    string line;
-    while (getline(infile, line))
+    if (intervals) {
+      run_intervals(limit);
+      return;
+    }
+    if (threads > 1 && set_mask > 0) {
+      run_sharded(threads, limit);
+      return;
+    }
+
+    MemAccess a;
+    while (offset < limit && trace->next(a))
     {
-      auto [type, addr, insts] = parse_line(line);
-      auto [hit, dirty_wb] = probe(type, addr);
+      offset++;
+      auto [hit, dirty_wb] = probe(a.write, a.addr);
       // Update the cache statistics
-      update_statistics(insts, type, hit, dirty_wb);
+      update_statistics(stats_, a.pc, a.write, hit, dirty_wb);
     }
   }
 
-  tuple<bool, uint64_t, int> parse_line(string access)
+  /*
+   * @brief record the statistics of every 'length' accesses (or cycles) to
+   * 'path' while running; intervals need the accesses in trace order, so the
+   * run is serial
+   */
+  void record_intervals(const char *path, IntervalFormat format, uint64_t length, bool cycles)
   {
-    int type;
-    uint64_t addr;
-    int insts;
-    sscanf(access.c_str(), "# %d %lx %d", &type, &addr, &insts);
-    return std::make_tuple(!!type, addr, insts);
+    intervals = std::make_unique<IntervalWriter>(
+        path, format, std::vector<const char *>{"interval", "accesses", "cycles", "reads", "writes",
+                                                "misses", "dirty_wb", "instructions"});
+    interval_length = length;
+    interval_cycles = cycles;
+  }
+
+  void run_intervals(uint64_t limit)
+  {
+    Stats start = stats_;
+    uint64_t count = 0;
+    auto clock = [&] { return interval_cycles ? cycles(stats_) : offset; };
+    auto record = [&] {
+      Stats d = stats_;
+      d -= start;
+      uint64_t v[] = {count++, offset, cycles(stats_), d.mem_refs - d.writes, d.writes,
+                      d.misses, d.dirty_wb, d.inst_nums};
+      intervals->record(v);
+      start = stats_;
+    };
+    auto next = (clock() / interval_length + 1) * interval_length;
+
+    MemAccess a;
+    while (offset < limit && trace->next(a)) {
+      offset++;
+      auto [hit, dirty_wb] = probe(a.write, a.addr);
+      update_statistics(stats_, a.pc, a.write, hit, dirty_wb);
+      if (clock() >= next) {
+        record();
+        next = (clock() / interval_length + 1) * interval_length;
+      }
+    }
+    // the last, partial interval
+    if (stats_.mem_refs != start.mem_refs) {
+      record();
+    }
+    intervals->close();
+  }
+
+  /*
+   * @brief sets are independent, so each worker owns a contiguous range of
+   * sets and the calling thread routes every access to its owner by
+   * get_set(). Every set still sees its accesses in trace order and the
+   * statistics are plain sums, so the result equals the serial run.
+   */
+  void run_sharded(unsigned threads, uint64_t limit)
+  {
+    struct Access
+    {
+      uint64_t addr;
+      uint64_t insts;
+      bool type;
+    };
+    constexpr size_t BATCH = 4096;
+
+    uint64_t sets = set_mask + 1ull;
+    threads = std::min<uint64_t>(threads, sets);
+    vector<BatchQueue<Access>> queues(threads);
+    vector<Stats> shard_stats(threads);
+    vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; t++) {
+      workers.emplace_back([&, t] {
+        vector<Access> batch;
+        while (queues[t].pop(batch)) {
+          for (auto &a : batch) {
+            auto [hit, dirty_wb] = probe(a.type, a.addr);
+            update_statistics(shard_stats[t], a.insts, a.type, hit, dirty_wb);
+          }
+        }
+      });
+    }
+
+    vector<vector<Access>> pending(threads);
+    MemAccess a;
+    while (offset < limit && trace->next(a)) {
+      offset++;
+      auto shard = get_set(a.addr) * threads / sets;
+      pending[shard].push_back({a.addr, a.pc, a.write});
+      if (pending[shard].size() == BATCH) {
+        queues[shard].push(std::move(pending[shard]));
+        pending[shard] = {};
+        pending[shard].reserve(BATCH);
+      }
+    }
+    for (unsigned t = 0; t < threads; t++) {
+      if (!pending[t].empty()) queues[t].push(std::move(pending[t]));
+      queues[t].close();
+    }
+    for (auto &w : workers) w.join();
+    for (auto &s : shard_stats) stats_ += s;
+  }
+
+  // trace accesses simulated so far
+  uint64_t position() const { return offset; }
+
+  /*
+   * @brief save the set records and the statistics; a restore continues
+   * from the same trace offset
+   */
+  void checkpoint(const char *path)
+  {
+    auto key = checkpoint_key();
+    CheckpointWriter out(path, CheckpointKind::SIMPLE, &key, sizeof(key));
+    out.put(layout);
+    out.put(stats_);
+    out.finish(offset, *trace);
+  }
+
+  void restore(const char *path)
+  {
+    auto key = checkpoint_key();
+    CheckpointReader in(path, CheckpointKind::SIMPLE, &key, sizeof(key));
+    in.get(layout);
+    in.get(stats_);
+    in.finish(*trace);
+    offset = in.header().offset;
   }
 
   int get_set(uint64_t addr)
@@ -83,61 +284,60 @@ public:
    */
   tuple<bool, bool> probe(bool type, uint64_t addr)
   {
+    return (this->*probe_fn)(type, addr);
+  }
+
+  /*
+   * @brief probe() for a fixed associativity 'Assoc' (0 = the runtime
+   * associativity), so the way loops and record offsets are constants
+   */
+  template <unsigned Assoc>
+  tuple<bool, bool> probe_ways(bool type, uint64_t addr)
+  {
+    constexpr unsigned fixed_words = Assoc ? record_words(Assoc) : 0;
+    const unsigned ways = Assoc ? Assoc : associativity;
+    const uint64_t mask = Assoc ? ~0ull >> (64 - Assoc) : way_mask;
     auto set = get_set(addr);
     auto tag = get_tag(addr);
 
-    auto base = set * associativity;
-
     // current set responding to the access
-    std::span<uint32_t>   local_tags{tags.data() + base, associativity};
-    std::span<bitset<1>>  local_dirty{dirty.data() + base, associativity};
-    std::span<bitset<1>>  local_valid{valid.data() + base, associativity};
-    std::span<uint8_t>    local_priority{priority.data() + base, associativity};
+    auto local = set_at(set, ways, Assoc ? fixed_words : set_words);
+    std::span<uint64_t>   local_tags{local.tags, ways};
+    std::span<uint8_t>    local_priority{local.priority, ways};
 
-        // Check each cache line in the set
+    // Check each valid cache line in the set
     auto hit = false;
-    int invalid_index = -1;
-    int index;
-    for (auto i = 0u; i < local_valid.size(); i++) {
-      // Check if the block is invalid
-      if (!local_valid[i][0]) {
-        // Keep track of invalid entries in case we need them
-        invalid_index = i;
-        continue;
+    int index = -1;
+    for (auto i = 0u; i < ways; i++) {
+      if ((*local.valid >> i & 1) && local_tags[i] == tag) {
+        // We found the line, so mark it as a hit
+        hit = true;
+        index = i;
+        // Update dirty flag
+        *local.dirty |= (uint64_t)type << index;
+        break;
       }
-
-      // Check if the tag matches
-      if (tag != local_tags[i]) continue;
-
-      // We found the line, so mark it as a hit
-      hit = true;
-      index = i;
-
-      // Update dirty flag
-      local_dirty[index] |= type;
-
-      // Break out of the loop
-      break;
     }
 
     // Find an element to replace if it wasn't a hit
     auto dirty_wb = false;
     if (!hit) {
-      // First try and use an invalid line (if available)
-      if (invalid_index >= 0) {
-        index = invalid_index;
-        local_valid[index] = 1;
+      // First try and use an invalid line (if available), the highest one
+      uint64_t invalid = ~*local.valid & mask;
+      if (invalid) {
+        index = 63 - std::countl_zero(invalid);
+        *local.valid |= 1ull << index;
       }
       // Otherwise, evict the lowest-priority cache block (largest value)
       else {
         auto max_element = std::ranges::max_element(local_priority);
         index = std::distance(begin(local_priority), max_element);
-        dirty_wb = local_dirty[index][0];
+        dirty_wb = *local.dirty >> index & 1;
       }
 
       // Update the tag and dirty state
       local_tags[index] = tag;
-      local_dirty[index] = type;
+      *local.dirty = (*local.dirty & ~(1ull << index)) | (uint64_t)type << index;
     }
 
     // Update the priority
@@ -145,9 +345,11 @@ public:
     // Increase the priority of all the blocks with a lower priority than the
     // one we are accessing
     // High priority -> Low priority = 0 -> associativity - 1
+    // (read the accessed block's priority first, the transform is in place)
+    unsigned accessed = local_priority[index];
     std::transform(begin(local_priority), end(local_priority),
-                   begin(local_priority), [&](int p) {
-                     if (p <= local_priority[index] && p < associativity)
+                   begin(local_priority), [&](unsigned p) {
+                     if (p <= accessed && p < ways)
                        return p + 1;
                      else
                        return p;
@@ -159,13 +361,83 @@ public:
     return {hit, dirty_wb};
   }
 
-  void update_statistics(int insts, bool type, bool hit, bool dirty_wb)
+  /*
+   * @brief probe() through the vector set operations: one compare for all
+   * tags, one max for the victim and one pass to age the set
+   */
+  tuple<bool, bool> probe_vector(bool type, uint64_t addr)
   {
-    mem_refs_++;
-    writes_ += type;
-    misses_ += !hit;
-    dirty_wb_ += dirty_wb;
-    inst_nums_ += insts;
+    auto local = set_at(get_set(addr), associativity, set_words);
+    auto tag = get_tag(addr);
+
+    uint64_t hits = ops->match(local.tags, associativity, tag) & *local.valid;
+    uint64_t invalid = ~*local.valid & way_mask;
+    auto hit = hits != 0;
+    auto dirty_wb = false;
+    unsigned index;
+    if (hit) {
+      index = std::countr_zero(hits);
+      *local.dirty |= (uint64_t)type << index;
+    } else {
+      if (invalid) {
+        index = 63 - std::countl_zero(invalid);
+        *local.valid |= 1ull << index;
+      } else {
+        index = ops->oldest(local.priority, associativity);
+        dirty_wb = *local.dirty >> index & 1;
+      }
+      local.tags[index] = tag;
+      *local.dirty = (*local.dirty & ~(1ull << index)) | (uint64_t)type << index;
+    }
+
+    ops->age(local.priority, associativity, local.priority[index]);
+    local.priority[index] = 0;
+    return {hit, dirty_wb};
+  }
+
+  // statistics info, one set per shard in the sharded run
+  struct Stats
+  {
+    uint64_t writes = 0;
+    uint64_t mem_refs = 0;
+    uint64_t misses = 0;
+    uint64_t dirty_wb = 0;
+    uint64_t inst_nums = 0;
+
+    Stats &operator+=(const Stats &o)
+    {
+      writes += o.writes;
+      mem_refs += o.mem_refs;
+      misses += o.misses;
+      dirty_wb += o.dirty_wb;
+      inst_nums += o.inst_nums;
+      return *this;
+    }
+
+    Stats &operator-=(const Stats &o)
+    {
+      writes -= o.writes;
+      mem_refs -= o.mem_refs;
+      misses -= o.misses;
+      dirty_wb -= o.dirty_wb;
+      inst_nums -= o.inst_nums;
+      return *this;
+    }
+  };
+
+  // cycles of the accesses in 's': the instructions plus the penalties
+  uint64_t cycles(const Stats &s) const
+  {
+    return (uint64_t)miss_penalty * s.misses + (uint64_t)dirty_wb_penalty * s.dirty_wb + s.inst_nums;
+  }
+
+  static void update_statistics(Stats &s, uint64_t insts, bool type, bool hit, bool dirty_wb)
+  {
+    s.mem_refs++;
+    s.writes += type;
+    s.misses += !hit;
+    s.dirty_wb += dirty_wb;
+    s.inst_nums += insts;
   }
 
   // Dump the statistics from simulation
@@ -182,34 +454,32 @@ public:
 
     // Print the access breakdown
     std::cout << "CACHE ACCESS STATS\n";
-    std::cout << "TOTAL ACCESSES: " << mem_refs_ << '\n';
-    std::cout << "         READS: " << mem_refs_ - writes_ << '\n';
-    std::cout << "        WRITES: " << writes_ << '\n';
+    std::cout << "TOTAL ACCESSES: " << stats_.mem_refs << '\n';
+    std::cout << "         READS: " << stats_.mem_refs - stats_.writes << '\n';
+    std::cout << "        WRITES: " << stats_.writes << '\n';
     std::cout << '\n';
 
     // Print the miss-rate breakdown
     std::cout << "CACHE MISS-RATE STATS\n";
-    double miss_rate = (double)misses_ / (double)mem_refs_ * 100.0;
-    auto hits = mem_refs_ - misses_;
+    double miss_rate = (double)stats_.misses / (double)stats_.mem_refs * 100.0;
+    auto hits = stats_.mem_refs - stats_.misses;
     std::cout << "     MISS-RATE: " << miss_rate << "%" << '\n';
-    std::cout << "        MISSES: " << misses_ << '\n';
+    std::cout << "        MISSES: " << stats_.misses << '\n';
     std::cout << "          HITS: " << hits << '\n';
     std::cout << '\n';
 
     // Print the instruction breakdown
     std::cout << "CACHE IPC STATS\n";
-    auto cycles = miss_penalty * misses_;
-    cycles += dirty_wb_penalty * dirty_wb_;
-    cycles += inst_nums_;
-    double ipc = (double)inst_nums_ / (double)cycles;
+    auto cycles = this->cycles(stats_);
+    double ipc = (double)stats_.inst_nums / (double)cycles;
     std::cout << "           IPC: " << ipc << '\n';
-    std::cout << "  INSTRUCTIONS: " << inst_nums_ << '\n';
+    std::cout << "  INSTRUCTIONS: " << stats_.inst_nums << '\n';
     std::cout << "        CYCLES: " << cycles << '\n';
-    std::cout << "      DIRTY WB: " << dirty_wb_ << '\n';
+    std::cout << "      DIRTY WB: " << stats_.dirty_wb << '\n';
   }
 
 private:
-  std::ifstream infile;
+  std::unique_ptr<TraceReader> trace;
   // configurable parameters
   unsigned block_size;
   unsigned associativity;
@@ -220,19 +490,77 @@ private:
   unsigned set_offset;
   unsigned tag_offset;
   unsigned set_mask;
-  // status
-  vector<uint32_t> tags;
-  vector<bitset<1>> dirty; // because span can't be used with bool, so use bitset
-  vector<bitset<1>> valid;
-  vector<uint8_t> priority;
-  // statistics info
-  uint64_t writes_ = 0;
-  uint64_t mem_refs_ = 0;
-  uint64_t misses_ = 0;
-  uint64_t dirty_wb_ = 0;
-  uint64_t inst_nums_ = 0;
+  /*
+   * status: one record per set, padded to whole 64-byte host lines so a
+   * probe of an up-to-4-way set touches a single line
+   *
+   *  | tag[0] .. tag[assoc-1] | valid mask | dirty mask | priority[0..assoc-1] |
+   */
+  struct alignas(64) HostLine
+  {
+    uint64_t w[8];
+  };
+  struct SetRef
+  {
+    uint64_t *tags;
+    uint64_t *valid;
+    uint64_t *dirty;
+    uint8_t *priority;
+  };
+  // tags, valid mask, dirty mask, then one priority byte per way padded to
+  // 16 bytes for the vector set operations, rounded up to whole host lines
+  static constexpr unsigned record_words(unsigned ways)
+  {
+    return (ways + 2 + (ways + 15) / 16 * 2 + 7) / 8 * 8;
+  }
+  SetRef set_at(unsigned set, unsigned ways, unsigned words)
+  {
+    auto base = reinterpret_cast<uint64_t *>(layout.data()) + (size_t)set * words;
+    return {base, base + ways, base + ways + 1,
+            reinterpret_cast<uint8_t *>(base + ways + 2)};
+  }
+  // the geometry a checkpoint has to match, the penalties only scale the
+  // cycle count
+  struct CheckpointKey
+  {
+    uint32_t block_size;
+    uint32_t associativity;
+    uint32_t capacity;
+    uint32_t set_words;
+  };
+  CheckpointKey checkpoint_key() const
+  {
+    return {block_size, associativity, capacity, set_words};
+  }
+  vector<HostLine> layout;
+  unsigned set_words; // 64-bit words per set record
+  uint64_t way_mask;  // one bit per way
+  tuple<bool, bool> (CacheSim::*probe_fn)(bool, uint64_t);
+  const SetOps *ops;
+  Stats stats_;
+  uint64_t offset = 0; // trace accesses simulated
+  std::unique_ptr<IntervalWriter> intervals;
+  uint64_t interval_length = 0;
+  bool interval_cycles = false; // interval_length counts cycles, not accesses
 };
 
+void usage()
+{
+  std::cerr << "Usage: simple [--threads=n] [--simd=level] [--stack-distance[=max_sets:max_assoc]]\n";
+  std::cerr << "              [--checkpoint=file:offset] [--restore=file]\n";
+  std::cerr << "              [--interval=n[:accesses|cycles]] [--interval-format=csv|json]\n";
+  std::cerr << "              [--interval-file=file] <trace>\n";
+  std::cerr << "  --threads=n        split the sets across n worker threads\n";
+  std::cerr << "  --simd=level       scalar, sse4.2 or avx2 set operations (default: best supported)\n";
+  std::cerr << "  --stack-distance   one-pass LRU hit/miss counts for every power-of-two\n";
+  std::cerr << "                     set count and associativity (default 4096:32)\n";
+  std::cerr << "  --checkpoint=file:offset  stop after 'offset' accesses and save the cache\n";
+  std::cerr << "  --restore=file     start from a checkpoint, at the offset it was taken\n";
+  std::cerr << "  --interval=n[:accesses|cycles]  record the statistics of every n accesses\n";
+  std::cerr << "                     (default) or cycles, one CSV or JSON line each\n";
+  std::cerr << "  --interval-file=file  write the records to file (default stdout)\n";
+}
+
 int main(int argc, char *argv[])
 {
 
@@ -243,10 +571,102 @@ int main(int argc, char *argv[])
   unsigned miss_penalty = 30;
   unsigned dirty_wb_penalty = 5;
 
+  const char *input = nullptr;
+  bool stack_distance = false;
+  unsigned max_sets = 4096;
+  unsigned max_assoc = 32;
+  unsigned threads = 1;
+  SimdLevel simd = simd_detect();
+  std::string checkpoint;
+  uint64_t checkpoint_at = UINT64_MAX;
+  const char *restore = nullptr;
+  uint64_t interval = 0;
+  bool interval_cycles = false;
+  IntervalFormat interval_format = IntervalFormat::CSV;
+  const char *interval_file = "-";
+  for (int i = 1; i < argc; i++) {
+    std::string_view arg = argv[i];
+    if (arg.starts_with("--stack-distance")) {
+      stack_distance = true;
+      sscanf(argv[i], "--stack-distance=%u:%u", &max_sets, &max_assoc);
+    } else if (arg.starts_with("--checkpoint=")) {
+      auto colon = arg.rfind(':');
+      if (colon < 13 || sscanf(argv[i] + colon + 1, "%lu", &checkpoint_at) != 1 || !checkpoint_at) {
+        std::cerr << "--checkpoint needs file:offset, offset > 0\n";
+        return 1;
+      }
+      checkpoint = arg.substr(13, colon - 13);
+    } else if (arg.starts_with("--restore=")) {
+      restore = argv[i] + 10;
+    } else if (arg.starts_with("--interval=")) {
+      char unit[16] = "accesses";
+      if (sscanf(argv[i] + 11, "%lu:%15s", &interval, unit) < 1 || !interval ||
+          (std::string_view(unit) != "accesses" && std::string_view(unit) != "cycles")) {
+        std::cerr << "--interval needs n[:accesses|cycles], n > 0\n";
+        return 1;
+      }
+      interval_cycles = std::string_view(unit) == "cycles";
+    } else if (arg.starts_with("--interval-format=")) {
+      if (!parse_interval_format(argv[i] + 18, interval_format)) {
+        std::cerr << "--interval-format is csv or json\n";
+        return 1;
+      }
+    } else if (arg.starts_with("--interval-file=")) {
+      interval_file = argv[i] + 16;
+    } else if (arg.starts_with("--threads=")) {
+      sscanf(argv[i], "--threads=%u", &threads);
+    } else if (arg.starts_with("--simd=")) {
+      auto level = SimdLevel::SCALAR;
+      while (simd_name(level) != arg.substr(7) && level < simd_detect()) {
+        level = SimdLevel((int)level + 1);
+      }
+      if (simd_name(level) != arg.substr(7)) {
+        std::cerr << arg.substr(7) << " is not supported on this host\n";
+        return 1;
+      }
+      simd = level;
+    } else if (arg.starts_with("--")) {
+      usage();
+      return 1;
+    } else {
+      input = argv[i];
+    }
+  }
+  if (!input) {
+    usage();
+    return 1;
+  }
+
+  if (stack_distance) {
+    TraceReader trace(input);
+    StackDistanceSim sweep(block_size, max_sets, max_assoc);
+    MemAccess a;
+    while (trace.next(a)) sweep.access(a.addr);
+    sweep.dump_stats(std::cout);
+    return 0;
+  }
+
   // Create our simulator
-  CacheSim simulator(argv[1], block_size, associativity, capacity,
-                     miss_penalty, dirty_wb_penalty);
-  simulator.run();
+  CacheSim simulator(input, block_size, associativity, capacity,
+                     miss_penalty, dirty_wb_penalty, simd);
+  if (restore) {
+    simulator.restore(restore);
+    if (simulator.position() >= checkpoint_at) {
+      std::cerr << "checkpoint " << restore << " is already at access " << simulator.position() << '\n';
+      exit(1);
+    }
+  }
+  if (interval) {
+    simulator.record_intervals(interval_file, interval_format, interval, interval_cycles);
+  }
+  simulator.run(threads, checkpoint_at);
+  if (!checkpoint.empty()) {
+    if (simulator.position() < checkpoint_at) {
+      std::cerr << "the trace ends after " << simulator.position() << " accesses, before the checkpoint\n";
+      exit(1);
+    }
+    simulator.checkpoint(checkpoint.c_str());
+  }
 
   return 0;
 }
@@ -0,0 +1,111 @@
+#include "stack_distance.hpp"
+#include <algorithm>
+#include <bit>
+#include <iomanip>
+
+SetStacks::SetStacks(unsigned set_bits)
+    : set_bits(set_bits), set_mask((1ull << set_bits) - 1), stacks_(1u << set_bits)
+{
+}
+
+uint64_t SetStacks::access(uint64_t block)
+{
+  auto &s = stacks_[block & set_mask];
+  if (s.now + 1 >= s.tree.size()) compact(s);
+
+  refs_++;
+  uint64_t distance = COLD;
+  auto [it, first] = last_.try_emplace(block, s.now);
+  if (first) {
+    cold_++;
+    s.live++;
+  } else {
+    // every live block stamped after our previous access sits above us
+    auto prev = it->second;
+    distance = s.live - s.prefix(prev + 1);
+    s.add(prev, -1);
+    s.owner[prev] = COLD;
+    it->second = s.now;
+    if (distance >= hist_.size()) hist_.resize(distance + 1);
+    hist_[distance]++;
+  }
+
+  s.add(s.now, 1);
+  s.owner[s.now] = block;
+  s.now++;
+  return distance;
+}
+
+// Renumber the live blocks of a set to 0..live-1 and leave room for as many
+// new timestamps again
+void SetStacks::compact(Stack &s)
+{
+  auto cap = std::max<size_t>(64, std::bit_ceil(2 * (size_t)s.live + 1));
+  std::vector<uint64_t> owner(cap, COLD);
+  uint32_t next = 0;
+  for (uint32_t t = 0; t < s.now; t++) {
+    if (s.owner[t] == COLD) continue;
+    owner[next] = s.owner[t];
+    last_[s.owner[t]] = next;
+    next++;
+  }
+  s.owner = std::move(owner);
+  s.now = next;
+
+  // linear-time Fenwick build over 'next' leading ones
+  s.tree.assign(cap + 1, 0);
+  for (uint32_t i = 1; i <= cap; i++) {
+    s.tree[i] += i <= next;
+    auto j = i + (i & -i);
+    if (j <= cap) s.tree[j] += s.tree[i];
+  }
+}
+
+uint64_t SetStacks::hits(unsigned assoc) const
+{
+  uint64_t sum = 0;
+  for (size_t d = 0; d < assoc && d < hist_.size(); d++) sum += hist_[d];
+  return sum;
+}
+
+StackDistanceSim::StackDistanceSim(unsigned block_size, unsigned max_sets, unsigned max_assoc)
+    : block_size(block_size), block_bits(std::popcount(block_size - 1)), max_assoc(max_assoc)
+{
+  for (unsigned bits = 0; (1u << bits) <= max_sets; bits++) levels.emplace_back(bits);
+}
+
+void StackDistanceSim::dump_stats(std::ostream &os) const
+{
+  os << "STACK DISTANCE SETTINGS\n";
+  os << "       Block Size (Bytes): " << block_size << '\n';
+  os << "                 Max Sets: " << levels.back().sets() << '\n';
+  os << "        Max Associativity: " << max_assoc << '\n';
+  os << '\n';
+
+  for (auto &level : levels) {
+    auto &hist = level.histogram();
+    os << "SETS: " << level.sets() << '\n';
+    os << "  REUSE DISTANCE HISTOGRAM\n";
+    os << "  " << std::setw(10) << "COLD" << ": " << level.cold() << '\n';
+    uint64_t tail = 0;
+    for (size_t d = 0; d < hist.size(); d++) {
+      if (d < max_assoc) os << "  " << std::setw(10) << d << ": " << hist[d] << '\n';
+      else tail += hist[d];
+    }
+    os << "  " << std::setw(8) << ">=" << max_assoc << ": " << tail << '\n';
+
+    os << "  LRU HITS / MISSES\n";
+    os << "  " << std::setw(6) << "ASSOC" << std::setw(14) << "SIZE (Bytes)"
+       << std::setw(14) << "HITS" << std::setw(14) << "MISSES" << std::setw(12) << "MISS-RATE" << '\n';
+    for (unsigned assoc = 1; assoc <= max_assoc; assoc <<= 1) {
+      auto hits = level.hits(assoc);
+      auto misses = level.refs() - hits;
+      os << "  " << std::setw(6) << assoc
+         << std::setw(14) << (uint64_t)level.sets() * assoc * block_size
+         << std::setw(14) << hits << std::setw(14) << misses
+         << std::setw(11) << std::fixed << std::setprecision(2)
+         << (level.refs() ? 100.0 * misses / level.refs() : 0.0) << "%\n";
+    }
+    os << '\n';
+  }
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+#include <iostream>
+
+/**
+ * Mattson stack-distance analysis: one pass over the trace gives the LRU hit
+ * and miss counts of every associativity for a fixed set count, and running
+ * one SetStacks per set count covers every capacity with the same block size.
+ *
+ * The stack distance of an access is the number of distinct blocks touched in
+ * its set since the previous access to the same block. An access hits in an
+ * A-way LRU set exactly when its distance is below A.
+ */
+class SetStacks
+{
+public:
+  static constexpr uint64_t COLD = ~0ull;
+
+  explicit SetStacks(unsigned set_bits);
+
+  // Record an access to 'block' (address >> block offset bits) and return its
+  // stack distance, or COLD on the first touch
+  uint64_t access(uint64_t block);
+
+  unsigned sets() const { return 1u << set_bits; }
+  uint64_t cold() const { return cold_; }
+  uint64_t refs() const { return refs_; }
+  // histogram[d] = number of accesses with stack distance d
+  const std::vector<uint64_t> &histogram() const { return hist_; }
+  // Hits of an LRU cache with this set count and 'assoc' ways
+  uint64_t hits(unsigned assoc) const;
+
+private:
+  /*
+   * The LRU stack of one set. Every access takes the next timestamp and the
+   * Fenwick tree holds a one at the latest timestamp of each live block, so
+   * a distance is one prefix sum. Timestamps are renumbered when the tree is
+   * full, which keeps memory proportional to the set's footprint.
+   */
+  struct Stack
+  {
+    std::vector<uint32_t> tree;  // Fenwick tree, 1-indexed
+    std::vector<uint64_t> owner; // block holding each timestamp, or COLD
+    uint32_t now = 0;
+    uint32_t live = 0;
+
+    void add(uint32_t t, int v)
+    {
+      for (auto i = t + 1; i < tree.size(); i += i & -i) tree[i] += v;
+    }
+
+    // Number of live blocks with a timestamp below 't'
+    uint32_t prefix(uint32_t t) const
+    {
+      uint32_t sum = 0;
+      for (auto i = t; i > 0; i -= i & -i) sum += tree[i];
+      return sum;
+    }
+  };
+
+  void compact(Stack &s);
+
+  unsigned set_bits;
+  uint64_t set_mask;
+  std::vector<Stack> stacks_;
+  std::unordered_map<uint64_t, uint32_t> last_; // block -> timestamp in its set
+  std::vector<uint64_t> hist_;
+  uint64_t cold_ = 0;
+  uint64_t refs_ = 0;
+};
+
+/*
+ * Stack distances for every power-of-two set count up to 'max_sets' with a
+ * shared block size
+ */
+class StackDistanceSim
+{
+public:
+  StackDistanceSim(unsigned block_size, unsigned max_sets, unsigned max_assoc);
+
+  void access(uint64_t addr)
+  {
+    auto block = addr >> block_bits;
+    for (auto &level : levels) level.access(block);
+  }
+
+  void dump_stats(std::ostream &os) const;
+
+private:
+  unsigned block_size;
+  unsigned block_bits;
+  unsigned max_assoc;
+  std::vector<SetStacks> levels;
+};
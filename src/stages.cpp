@@ -0,0 +1,466 @@
+//========================================================//
+//  stages.cpp                                            //
+//  Stages between the L1s and the L2                     //
+//                                                        //
+//  Victim caches behind the L1s, the coalescing write    //
+//  buffer and the miss recorder in front of the L2       //
+//========================================================//
+
+#include "stages.hpp"
+#include "checkpoint.hpp"
+#include "miss_stream.hpp"
+#include <stdio.h>
+#include <bit>
+
+//------------------------------------//
+//            Cache Stage             //
+//------------------------------------//
+
+CacheStage::CacheStage(uint32_t blockSize, uint32_t hitTime, CacheType type, CacheBase *next)
+  : blockBits(countr_zero(blockSize)), next(next), up(NULL)
+{
+  if (!has_single_bit(blockSize)) {
+    fprintf(stderr,"Cache blocksize must be a power of two\n");
+    exit(1);
+  }
+  this->sets = 1;
+  this->assoc = 0;
+  this->blockSize = blockSize;
+  this->hitTime = hitTime;
+  this->type = type;
+
+  // statistics
+  refs = 0;
+  misses = 0;
+  penalties = 0;
+  compulsory_miss = 0;
+  other_miss = 0;
+  prefetches = 0;
+  prefetchHits = 0;
+  uselessPrefetches = 0;
+  pollution = 0;
+  fetches = 0;
+  writebacks = 0;
+  backInvalidations = 0;
+  handedDirty = false;
+  writeThrough = false;
+  coherent = false;
+}
+
+void
+CacheStage::set_inclusion(InclusionPolicy policy, const vector<CacheBase *> &above)
+{
+  up = above.empty() ? NULL : above[0];
+}
+
+uint32_t
+CacheStage::cache_prefetch_addr(uint32_t pc, uint32_t addr, bool rw)
+{
+  return addr + blockSize;
+}
+
+// Prefetches are installed into the L1s only
+void
+CacheStage::cache_install(uint32_t addr, bool dirty)
+{
+}
+
+uint8_t
+CacheStage::cache_replace(uint32_t addr)
+{
+  return 0;
+}
+
+//------------------------------------//
+//           Victim Cache             //
+//------------------------------------//
+
+VictimCache::VictimCache(uint32_t entries, uint32_t blockSize, uint32_t hitTime, CacheType type,
+                         CacheBase *next)
+  : CacheStage(blockSize, hitTime, type, next), lines(entries, Line{0, 0, false, false}), clock(0),
+    evictions(0)
+{
+  this->assoc = entries;
+}
+
+VictimCache::Line *
+VictimCache::find(uint32_t block)
+{
+  for (Line &l : lines) {
+    if (l.valid && l.block == block) {
+      return &l;
+    }
+  }
+  return NULL;
+}
+
+bool
+VictimCache::hand_up(uint32_t block)
+{
+  Line *l = find(block);
+  if (!l) {
+    return false;
+  }
+  handedDirty = l->dirty;
+  l->valid = false;
+  return true;
+}
+
+// An L1 miss: a hit swaps the line back up, the L1 victim it displaces
+// arrives through cache_writeback()
+//
+uint32_t
+VictimCache::cache_access(uint32_t addr, bool write)
+{
+  refs++;
+  if (hand_up(block_of(addr))) {
+    return hitTime;
+  }
+  misses++;
+  uint32_t latency = next->cache_access(addr, false);
+  handedDirty = next->take_dirty();
+  return latency;
+}
+
+uint32_t
+VictimCache::cache_access_nb(uint32_t addr, bool write, uint64_t now, bool wait, uint64_t &ready)
+{
+  refs++;
+  if (hand_up(block_of(addr))) {
+    ready = now + hitTime;
+    return hitTime;
+  }
+  misses++;
+  uint32_t latency = next->cache_access_nb(addr, false, now, wait, ready);
+  handedDirty = next->take_dirty();
+  return latency;
+}
+
+// Every L1 victim takes the least recently inserted line's place
+//
+void
+VictimCache::cache_writeback(uint32_t addr, bool dirty)
+{
+  uint32_t block = block_of(addr);
+  Line *l = find(block);
+  if (!l) {
+    l = &lines[0];
+    for (Line &c : lines) {
+      if (!c.valid || (l->valid && c.lru < l->lru)) {
+        l = &c;
+      }
+    }
+    if (l->valid) {
+      evictions++;
+      if (l->dirty) {
+        writebacks++;
+      }
+      if (l->dirty || next->takes_victims()) {
+        next->cache_writeback(l->block << blockBits, l->dirty);
+      }
+    }
+    *l = Line{block, 0, true, false};
+  }
+  l->lru = ++clock;
+  l->dirty |= dirty;
+}
+
+void
+VictimCache::cache_write(uint32_t addr)
+{
+  next->cache_write(addr);
+}
+
+uint32_t
+VictimCache::cache_invalidate(uint32_t addr, uint32_t bytes, bool &dirty)
+{
+  uint32_t count = bytes > blockSize ? bytes / blockSize : 1;
+  uint32_t n = up ? up->cache_invalidate(addr, bytes, dirty) : 0;
+  for (uint32_t i = 0; i < count; i++) {
+    if (Line *l = find(block_of(addr) + i)) {
+      dirty |= l->dirty;
+      l->valid = false;
+      n++;
+    }
+  }
+  return n;
+}
+
+void
+VictimCache::cache_prefetch(uint32_t addr, PrefetchPolicy policy)
+{
+  if (!hand_up(block_of(addr))) {
+    next->cache_prefetch(addr, policy);
+    handedDirty = next->take_dirty();
+  }
+}
+
+bool
+VictimCache::cache_probe(uint32_t addr) const
+{
+  uint32_t block = block_of(addr);
+  for (const Line &l : lines) {
+    if (l.valid && l.block == block) {
+      return true;
+    }
+  }
+  return next->cache_probe(addr);
+}
+
+void
+VictimCache::save_state(CheckpointWriter &out) const
+{
+  CacheStage::save_state(out);
+  out.put(lines);
+  out.put(clock);
+  out.put(evictions);
+}
+
+void
+VictimCache::load_state(CheckpointReader &in)
+{
+  CacheStage::load_state(in);
+  in.get(lines);
+  in.get(clock);
+  in.get(evictions);
+}
+
+VictimStats
+VictimCache::stats() const
+{
+  return VictimStats{refs, refs - misses, evictions, writebacks};
+}
+
+//------------------------------------//
+//           Write Buffer             //
+//------------------------------------//
+
+WriteBuffer::WriteBuffer(uint32_t entries, uint32_t blockSize, uint32_t drainTime, CacheBase *next)
+  : CacheStage(blockSize, 0, CacheType::L1_DCACHE, next), size(entries), drainTime(drainTime), now(0),
+    portFree(0), stall(0), counts{}
+{
+  this->assoc = entries;
+}
+
+uint64_t
+WriteBuffer::drain_done() const
+{
+  const Entry &e = entries.front();
+  return (e.arrived > portFree ? e.arrived : portFree) + drainTime;
+}
+
+void
+WriteBuffer::drain(size_t pos)
+{
+  Entry e = entries[pos];
+  entries.erase(entries.begin() + pos);
+  counts.drains++;
+  writebacks++;
+  if (e.victim) {
+    next->cache_writeback(e.block << blockBits, true);
+  } else {
+    next->cache_write(e.block << blockBits);
+  }
+}
+
+void
+WriteBuffer::advance(uint64_t now)
+{
+  this->now = now;
+  while (!entries.empty() && drain_done() <= now) {
+    portFree = drain_done();
+    drain(0);
+  }
+}
+
+void
+WriteBuffer::write(uint32_t block, bool victim)
+{
+  for (Entry &e : entries) {
+    if (e.block == block) {
+      e.victim |= victim;
+      counts.merges++;
+      return;
+    }
+  }
+  if (entries.size() == size) {
+    uint64_t done = drain_done();
+    counts.fullStalls++;
+    if (done > now) {
+      counts.stallCycles += done - now;
+      stall += done - now;
+      now = done;
+    }
+    portFree = done;
+    drain(0);
+  }
+  entries.push_back(Entry{block, now, victim});
+  counts.writes++;
+}
+
+void
+WriteBuffer::flush(uint32_t block)
+{
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (entries[i].block == block) {
+      counts.readFlushes++;
+      drain(i);
+      return;
+    }
+  }
+}
+
+uint32_t
+WriteBuffer::cache_access(uint32_t addr, bool write)
+{
+  flush(block_of(addr));
+  uint32_t latency = next->cache_access(addr, write);
+  handedDirty = next->take_dirty();
+  return latency;
+}
+
+uint32_t
+WriteBuffer::cache_access_nb(uint32_t addr, bool write, uint64_t now, bool wait, uint64_t &ready)
+{
+  flush(block_of(addr));
+  uint32_t latency = next->cache_access_nb(addr, write, now, wait, ready);
+  handedDirty = next->take_dirty();
+  return latency;
+}
+
+// Clean victims carry no data for the L2 and pass straight through
+//
+void
+WriteBuffer::cache_writeback(uint32_t addr, bool dirty)
+{
+  if (dirty) {
+    write(block_of(addr), true);
+  } else {
+    next->cache_writeback(addr, false);
+  }
+}
+
+void
+WriteBuffer::cache_write(uint32_t addr)
+{
+  write(block_of(addr), false);
+}
+
+// A buffered block the L2 drops goes to memory with the L2's copy
+//
+uint32_t
+WriteBuffer::cache_invalidate(uint32_t addr, uint32_t bytes, bool &dirty)
+{
+  uint32_t count = bytes > blockSize ? bytes / blockSize : 1;
+  uint32_t n = up ? up->cache_invalidate(addr, bytes, dirty) : 0;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t block = block_of(addr) + i;
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+      if (it->block == block) {
+        entries.erase(it);
+        dirty = true;
+        break;
+      }
+    }
+  }
+  return n;
+}
+
+void
+WriteBuffer::cache_prefetch(uint32_t addr, PrefetchPolicy policy)
+{
+  flush(block_of(addr));
+  next->cache_prefetch(addr, policy);
+  handedDirty = next->take_dirty();
+}
+
+bool
+WriteBuffer::cache_probe(uint32_t addr) const
+{
+  return next->cache_probe(addr);
+}
+
+void
+WriteBuffer::save_state(CheckpointWriter &out) const
+{
+  CacheStage::save_state(out);
+  out.put(entries);
+  out.put(now);
+  out.put(portFree);
+  out.put(stall);
+  out.put(counts);
+}
+
+void
+WriteBuffer::load_state(CheckpointReader &in)
+{
+  CacheStage::load_state(in);
+  in.get(entries);
+  in.get(now);
+  in.get(portFree);
+  in.get(stall);
+  in.get(counts);
+}
+
+//------------------------------------//
+//           Miss Recorder            //
+//------------------------------------//
+
+MissRecorder::MissRecorder(uint32_t blockSize, CacheType type, CacheBase *next, MissStreamWriter *log)
+  : CacheStage(blockSize, 0, type, next), log(log), l2Latency(0)
+{
+}
+
+uint32_t
+MissRecorder::cache_access(uint32_t addr, bool write)
+{
+  log->put(type == CacheType::L1_ICACHE ? MissEvent::IREAD : MissEvent::DREAD, addr);
+  uint32_t latency = next->cache_access(addr, write);
+  handedDirty = next->take_dirty();
+  l2Latency += latency;
+  return latency;
+}
+
+uint32_t
+MissRecorder::cache_access_nb(uint32_t addr, bool write, uint64_t now, bool wait, uint64_t &ready)
+{
+  log->put(type == CacheType::L1_ICACHE ? MissEvent::IREAD : MissEvent::DREAD, addr);
+  uint32_t latency = next->cache_access_nb(addr, write, now, wait, ready);
+  handedDirty = next->take_dirty();
+  l2Latency += latency;
+  return latency;
+}
+
+void
+MissRecorder::cache_writeback(uint32_t addr, bool dirty)
+{
+  log->put(dirty ? MissEvent::DIRTY_WRITEBACK : MissEvent::WRITEBACK, addr);
+  next->cache_writeback(addr, dirty);
+}
+
+void
+MissRecorder::cache_write(uint32_t addr)
+{
+  log->put(MissEvent::WRITE, addr);
+  next->cache_write(addr);
+}
+
+uint32_t
+MissRecorder::cache_invalidate(uint32_t addr, uint32_t bytes, bool &dirty)
+{
+  return up ? up->cache_invalidate(addr, bytes, dirty) : 0;
+}
+
+void
+MissRecorder::cache_prefetch(uint32_t addr, PrefetchPolicy policy)
+{
+  log->put(MissEvent::PREFETCH, addr);
+  next->cache_prefetch(addr, policy);
+  handedDirty = next->take_dirty();
+}
+
+bool
+MissRecorder::cache_probe(uint32_t addr) const
+{
+  return next->cache_probe(addr);
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include "cache.hpp"
+
+using namespace std;
+
+//------------------------------------//
+//     Stages between L1 and L2       //
+//------------------------------------//
+
+// A level of the hierarchy that holds a few lines of its own in front of
+// 'next', the L2 or another stage. It takes the place of the L2 as the
+// 'next' of an L1 and forwards what it does not hold; back-invalidations
+// from an inclusive L2 are passed on to 'up', the level above.
+class CacheStage : public CacheBase
+{
+public:
+    CacheStage(uint32_t blockSize, uint32_t hitTime, CacheType type, CacheBase *next);
+
+    void set_inclusion(InclusionPolicy policy, const vector<CacheBase *> &above) override;
+    uint32_t cache_prefetch_addr(uint32_t pc, uint32_t addr, bool rw) override;
+    void cache_install(uint32_t addr, bool dirty) override;
+    uint8_t cache_replace(uint32_t addr) override;
+
+protected:
+    uint32_t block_of(uint32_t addr) const { return addr >> blockBits; }
+
+    uint32_t blockBits;
+    CacheBase *next;
+    CacheBase *up;             // level above, NULL until set_inclusion()
+};
+
+// Fully-associative LRU victim cache behind one L1. It catches every line
+// the L1 evicts; an L1 miss that finds its line here swaps it back in after
+// 'hitTime' cycles, the L1's own victim taking its place. Misses go to
+// 'next' in parallel with the probe, so they cost nothing extra. Lines
+// pushed out of here are written back when dirty, and passed to an
+// exclusive L2 in any case.
+class VictimCache final : public CacheStage
+{
+public:
+    VictimCache(uint32_t entries, uint32_t blockSize, uint32_t hitTime, CacheType type, CacheBase *next);
+
+    uint32_t cache_access(uint32_t addr, bool write) override;
+    uint32_t cache_access_nb(uint32_t addr, bool write, uint64_t now, bool wait, uint64_t &ready) override;
+    void cache_writeback(uint32_t addr, bool dirty) override;
+    void cache_write(uint32_t addr) override;
+    uint32_t cache_invalidate(uint32_t addr, uint32_t bytes, bool &dirty) override;
+    bool takes_victims() const override { return true; }
+    void cache_prefetch(uint32_t addr, PrefetchPolicy policy) override;
+    bool cache_probe(uint32_t addr) const override;
+    void save_state(CheckpointWriter &out) const override;
+    void load_state(CheckpointReader &in) override;
+
+    VictimStats stats() const;
+
+private:
+    struct Line
+    {
+        uint32_t block;
+        uint64_t lru;      // last insertion, larger is more recent
+        bool valid;
+        bool dirty;
+    };
+
+    // The line holding 'block', or NULL
+    Line *find(uint32_t block);
+    // Move the line out of here and up into the L1, returns false if absent
+    bool hand_up(uint32_t block);
+
+    vector<Line> lines;
+    uint64_t clock;
+    uint64_t evictions;
+};
+
+// Coalescing write buffer in front of the L2. Dirty victims and the stores
+// of a write-through L1 wait in 'entries' block-sized entries, and a write
+// to a block already buffered merges into its entry. Entries drain to
+// 'next' in FIFO order, one every 'drainTime' cycles of the hierarchy
+// clock; a write that finds the buffer full stalls until the oldest entry
+// is out. A read or prefetch of a buffered block drains that entry first so
+// it sees the data.
+class WriteBuffer final : public CacheStage
+{
+public:
+    WriteBuffer(uint32_t entries, uint32_t blockSize, uint32_t drainTime, CacheBase *next);
+
+    uint32_t cache_access(uint32_t addr, bool write) override;
+    uint32_t cache_access_nb(uint32_t addr, bool write, uint64_t now, bool wait, uint64_t &ready) override;
+    void cache_writeback(uint32_t addr, bool dirty) override;
+    void cache_write(uint32_t addr) override;
+    uint32_t cache_invalidate(uint32_t addr, uint32_t bytes, bool &dirty) override;
+    bool takes_victims() const override { return next->takes_victims(); }
+    void cache_prefetch(uint32_t addr, PrefetchPolicy policy) override;
+    bool cache_probe(uint32_t addr) const override;
+    void save_state(CheckpointWriter &out) const override;
+    void load_state(CheckpointReader &in) override;
+
+    // Drain the entries written to the L2 by cycle 'now'
+    void advance(uint64_t now);
+    // Cycles the writes since the last call stalled on a full buffer
+    uint32_t take_stall() { uint32_t s = stall; stall = 0; return s; }
+
+    const WriteBufferStats &stats() const { return counts; }
+
+private:
+    struct Entry
+    {
+        uint32_t block;
+        uint64_t arrived;  // cycle the first write came in
+        bool victim;       // holds an evicted line, which an exclusive L2 places
+    };
+
+    // Buffer a write to 'block', coalescing it when possible
+    void write(uint32_t block, bool victim);
+    // Cycle the oldest entry is written by
+    uint64_t drain_done() const;
+    // Write the entry at 'pos' to the L2
+    void drain(size_t pos);
+    // Drain the entry for 'block' ahead of a read, if there is one
+    void flush(uint32_t block);
+
+    deque<Entry> entries;
+    uint32_t size;
+    uint32_t drainTime;
+    uint64_t now;              // hierarchy clock at the last advance()
+    uint64_t portFree;         // cycle the L2 takes the next write
+    uint32_t stall;
+    WriteBufferStats counts;
+};
+
+class MissStreamWriter;
+
+// Takes the place of the L2 under one L1 and its stages while a miss stream
+// is recorded: everything goes on to 'next', the L2, and is logged to 'log'
+// on the way. The latencies the L2 answers the demand reads with are
+// summed, so the statistics saved with the stream can leave them out.
+class MissRecorder final : public CacheStage
+{
+public:
+    MissRecorder(uint32_t blockSize, CacheType type, CacheBase *next, MissStreamWriter *log);
+
+    uint32_t cache_access(uint32_t addr, bool write) override;
+    uint32_t cache_access_nb(uint32_t addr, bool write, uint64_t now, bool wait, uint64_t &ready) override;
+    void cache_writeback(uint32_t addr, bool dirty) override;
+    void cache_write(uint32_t addr) override;
+    uint32_t cache_invalidate(uint32_t addr, uint32_t bytes, bool &dirty) override;
+    bool takes_victims() const override { return next->takes_victims(); }
+    void cache_prefetch(uint32_t addr, PrefetchPolicy policy) override;
+    bool cache_probe(uint32_t addr) const override;
+
+    // Cycles the L2 took over the demand reads logged so far
+    uint64_t latency() const { return l2Latency; }
+
+private:
+    MissStreamWriter *log;
+    uint64_t l2Latency;
+};
@@ -0,0 +1,385 @@
+//========================================================//
+//  stream.cpp                                            //
+//  Threaded decompression of text traces                 //
+//                                                        //
+//  A producer thread decompresses the trace into a ring  //
+//  of buffers that the simulation thread consumes        //
+//========================================================//
+
+#include "stream.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <bzlib.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+//------------------------------------//
+//             Raw Input              //
+//------------------------------------//
+
+// Compressed bytes from the trace file. The magic bytes consumed for format
+// detection are replayed before the rest of the file.
+class RawInput
+{
+public:
+  RawInput(int fd) : fd(fd)
+  {
+    while (headLen < sizeof(head)) {
+      ssize_t r = ::read(fd, head + headLen, sizeof(head) - headLen);
+      if (r <= 0) {
+        break;
+      }
+      headLen += r;
+    }
+  }
+  ~RawInput()
+  {
+    if (fd != STDIN_FILENO) {
+      close(fd);
+    }
+  }
+
+  bool starts_with(const char *magic, size_t n) const
+  {
+    return headLen >= n && !memcmp(head, magic, n);
+  }
+
+  size_t read(char *dst, size_t n)
+  {
+    if (headPos < headLen) {
+      size_t c = headLen - headPos < n ? headLen - headPos : n;
+      memcpy(dst, head + headPos, c);
+      headPos += c;
+      return c;
+    }
+    for (;;) {
+      ssize_t r = ::read(fd, dst, n);
+      if (r >= 0) {
+        return r;
+      }
+      if (errno != EINTR) {
+        fprintf(stderr, "Error reading trace: %s\n", strerror(errno));
+        exit(1);
+      }
+    }
+  }
+
+private:
+  int fd;
+  char head[4];
+  size_t headLen = 0;
+  size_t headPos = 0;
+};
+
+//------------------------------------//
+//              Decoders              //
+//------------------------------------//
+
+static constexpr size_t INPUT_SIZE = 1 << 20;
+
+class PlainDecoder : public TraceDecoder
+{
+public:
+  PlainDecoder(std::unique_ptr<RawInput> in) : in(std::move(in)) {}
+  size_t read(char *dst, size_t n) override { return in->read(dst, n); }
+
+private:
+  std::unique_ptr<RawInput> in;
+};
+
+class Bz2Decoder : public TraceDecoder
+{
+public:
+  Bz2Decoder(std::unique_ptr<RawInput> in) : in(std::move(in)), buf(new char[INPUT_SIZE])
+  {
+    start();
+  }
+  ~Bz2Decoder() override { BZ2_bzDecompressEnd(&bz); }
+
+  size_t read(char *dst, size_t n) override
+  {
+    bz.next_out = dst;
+    bz.avail_out = n;
+    while (bz.avail_out == n) {
+      if (bz.avail_in == 0) {
+        bz.next_in = buf.get();
+        bz.avail_in = in->read(buf.get(), INPUT_SIZE);
+        if (bz.avail_in == 0) {
+          if (!ended) {
+            fprintf(stderr, "Trace ends in the middle of a bzip2 stream\n");
+            exit(1);
+          }
+          return 0;
+        }
+      }
+      if (ended) {
+        // Concatenated streams, as written by pbzip2
+        BZ2_bzDecompressEnd(&bz);
+        char *next = bz.next_in;
+        unsigned avail = bz.avail_in;
+        start();
+        bz.next_in = next;
+        bz.avail_in = avail;
+        bz.next_out = dst;
+        bz.avail_out = n;
+      }
+      int ret = BZ2_bzDecompress(&bz);
+      if (ret == BZ_STREAM_END) {
+        ended = true;
+      } else if (ret != BZ_OK) {
+        fprintf(stderr, "Corrupt bzip2 trace (error %d)\n", ret);
+        exit(1);
+      }
+    }
+    return n - bz.avail_out;
+  }
+
+private:
+  void start()
+  {
+    memset(&bz, 0, sizeof(bz));
+    BZ2_bzDecompressInit(&bz, 0, 0);
+    ended = false;
+  }
+
+  std::unique_ptr<RawInput> in;
+  std::unique_ptr<char[]> buf;
+  bz_stream bz;
+  bool ended;
+};
+
+class GzDecoder : public TraceDecoder
+{
+public:
+  GzDecoder(std::unique_ptr<RawInput> in) : in(std::move(in)), buf(new char[INPUT_SIZE])
+  {
+    memset(&zs, 0, sizeof(zs));
+    inflateInit2(&zs, 15 + 32); // accept gzip and zlib headers
+  }
+  ~GzDecoder() override { inflateEnd(&zs); }
+
+  size_t read(char *dst, size_t n) override
+  {
+    zs.next_out = (Bytef *)dst;
+    zs.avail_out = n;
+    while (zs.avail_out == n) {
+      if (zs.avail_in == 0) {
+        zs.next_in = (Bytef *)buf.get();
+        zs.avail_in = in->read(buf.get(), INPUT_SIZE);
+        if (zs.avail_in == 0) {
+          if (!ended) {
+            fprintf(stderr, "Trace ends in the middle of a gzip stream\n");
+            exit(1);
+          }
+          return 0;
+        }
+      }
+      if (ended) {
+        // Concatenated gzip members
+        inflateReset(&zs);
+        ended = false;
+      }
+      int ret = inflate(&zs, Z_NO_FLUSH);
+      if (ret == Z_STREAM_END) {
+        ended = true;
+      } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+        fprintf(stderr, "Corrupt gzip trace (error %d)\n", ret);
+        exit(1);
+      }
+    }
+    return n - zs.avail_out;
+  }
+
+private:
+  std::unique_ptr<RawInput> in;
+  std::unique_ptr<char[]> buf;
+  z_stream zs;
+  bool ended = false;
+};
+
+#ifdef HAVE_ZSTD
+class ZstdDecoder : public TraceDecoder
+{
+public:
+  ZstdDecoder(std::unique_ptr<RawInput> in) : in(std::move(in)), buf(new char[INPUT_SIZE])
+  {
+    zs = ZSTD_createDStream();
+    ZSTD_initDStream(zs);
+    zin = {buf.get(), 0, 0};
+  }
+  ~ZstdDecoder() override { ZSTD_freeDStream(zs); }
+
+  size_t read(char *dst, size_t n) override
+  {
+    ZSTD_outBuffer zout = {dst, n, 0};
+    while (zout.pos == 0) {
+      if (zin.pos == zin.size) {
+        zin.size = in->read(buf.get(), INPUT_SIZE);
+        zin.pos = 0;
+        if (zin.size == 0) {
+          if (pending) {
+            fprintf(stderr, "Trace ends in the middle of a zstd frame\n");
+            exit(1);
+          }
+          return 0;
+        }
+      }
+      size_t ret = ZSTD_decompressStream(zs, &zout, &zin);
+      if (ZSTD_isError(ret)) {
+        fprintf(stderr, "Corrupt zstd trace (%s)\n", ZSTD_getErrorName(ret));
+        exit(1);
+      }
+      pending = ret != 0;
+    }
+    return zout.pos;
+  }
+
+private:
+  std::unique_ptr<RawInput> in;
+  std::unique_ptr<char[]> buf;
+  ZSTD_DStream *zs;
+  ZSTD_inBuffer zin;
+  bool pending = false;
+};
+#endif
+
+static std::unique_ptr<TraceDecoder>
+open_decoder(const char *path)
+{
+  int fd = STDIN_FILENO;
+  if (path && strcmp(path, "-")) {
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      fprintf(stderr, "Cannot open trace '%s'\n", path);
+      exit(1);
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+
+  auto in = std::make_unique<RawInput>(fd);
+  if (in->starts_with("BZh", 3)) {
+    return std::make_unique<Bz2Decoder>(std::move(in));
+  }
+  if (in->starts_with("\x1f\x8b", 2)) {
+    return std::make_unique<GzDecoder>(std::move(in));
+  }
+  if (in->starts_with("\x28\xb5\x2f\xfd", 4)) {
+#ifdef HAVE_ZSTD
+    return std::make_unique<ZstdDecoder>(std::move(in));
+#else
+    fprintf(stderr, "This build has no zstd support, decompress the trace first\n");
+    exit(1);
+#endif
+  }
+  return std::make_unique<PlainDecoder>(std::move(in));
+}
+
+//------------------------------------//
+//            Buffer Ring             //
+//------------------------------------//
+
+TraceStream::TraceStream(const char *path)
+  : decoder(open_decoder(path))
+{
+  for (auto &s : ring) {
+    s.data.reset(new char[SLOT_SIZE + 1]);
+  }
+  producer = std::thread(&TraceStream::produce, this);
+}
+
+TraceStream::~TraceStream()
+{
+  {
+    std::lock_guard<std::mutex> l(lock);
+    stop = true;
+  }
+  cond.notify_all();
+  producer.join();
+}
+
+// Producer thread: decompress into free slots, cut each slot at its last
+// newline and carry the partial line over into the next slot
+void
+TraceStream::produce()
+{
+  std::unique_ptr<char[]> carry(new char[SLOT_SIZE]);
+  size_t carryLen = 0;
+  bool done = false;
+
+  for (size_t i = 0; !done; i = (i + 1) % RING_SLOTS) {
+    Slot &s = ring[i];
+    {
+      std::unique_lock<std::mutex> l(lock);
+      cond.wait(l, [&] { return !s.full || stop; });
+      if (stop) {
+        return;
+      }
+    }
+
+    char *d = s.data.get();
+    memcpy(d, carry.get(), carryLen);
+    size_t n = carryLen;
+    while (n < SLOT_SIZE) {
+      size_t r = decoder->read(d + n, SLOT_SIZE - n);
+      if (r == 0) {
+        done = true;
+        break;
+      }
+      n += r;
+    }
+
+    size_t keep = n;
+    if (!done) {
+      char *nl = (char *)memrchr(d, '\n', n);
+      if (nl) {
+        keep = nl - d + 1;
+      }
+    }
+    carryLen = n - keep;
+    memcpy(carry.get(), d + keep, carryLen);
+
+    {
+      std::lock_guard<std::mutex> l(lock);
+      s.len = keep;
+      s.full = true;
+      eof = done;
+    }
+    cond.notify_all();
+  }
+}
+
+// Consumer side: hand the current slot back to the producer and wait for the
+// next one in ring order
+bool
+TraceStream::next_buffer()
+{
+  std::unique_lock<std::mutex> l(lock);
+  if (held) {
+    held->full = false;
+    held = NULL;
+    cond.notify_all();
+  }
+  for (;;) {
+    Slot &s = ring[next];
+    cond.wait(l, [&] { return s.full || eof; });
+    if (!s.full) {
+      return false;
+    }
+    next = (next + 1) % RING_SLOTS;
+    if (s.len == 0) {
+      s.full = false;
+      cond.notify_all();
+      continue;
+    }
+    held = &s;
+    cur = s.data.get();
+    len = s.len;
+    return true;
+  }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//------------------------------------//
+//        Text Trace Streaming        //
+//------------------------------------//
+//
+// Reads a text trace (plain, .bz2, .gz or .zst) on a producer thread that
+// decompresses into a ring of large buffers. Every buffer handed to the
+// consumer ends on a line boundary, so whole lines are parsed in place without
+// copying or further syscalls on the simulation thread.
+//
+
+// Source of decompressed trace bytes, one per compression format
+class TraceDecoder
+{
+public:
+  virtual ~TraceDecoder() = default;
+  // Fill up to 'n' bytes of 'dst', returns 0 at the end of input
+  virtual size_t read(char *dst, size_t n) = 0;
+};
+
+class TraceStream
+{
+public:
+  // Open 'path' ("-" or NULL for stdin), the format is detected from the
+  // leading magic bytes
+  explicit TraceStream(const char *path);
+  ~TraceStream();
+  TraceStream(const TraceStream &) = delete;
+  TraceStream &operator=(const TraceStream &) = delete;
+
+  // Returns the next block of whole lines, or false at the end of the trace.
+  // The block is followed by a NUL sentinel and stays valid until the next
+  // call.
+  bool next_block(const char *&data, size_t &size)
+  {
+    if (!next_buffer()) {
+      return false;
+    }
+    cur[len] = '\0';
+    data = cur;
+    size = len;
+    return true;
+  }
+
+private:
+  static constexpr size_t RING_SLOTS = 4;
+  static constexpr size_t SLOT_SIZE = 4 << 20;
+
+  struct Slot
+  {
+    std::unique_ptr<char[]> data; // SLOT_SIZE bytes plus a NUL terminator
+    size_t len = 0;
+    bool full = false;
+  };
+
+  bool next_buffer();
+  void produce();
+
+  std::unique_ptr<TraceDecoder> decoder;
+  Slot ring[RING_SLOTS];
+  std::mutex lock;
+  std::condition_variable cond;
+  bool eof = false;   // producer has published its last buffer
+  bool stop = false;  // consumer is going away
+  std::thread producer;
+
+  // consumer side
+  size_t next = 0;     // ring index of the next buffer to consume
+  Slot *held = NULL;   // buffer currently being consumed
+  char *cur = NULL;
+  size_t len = 0;
+};
@@ -0,0 +1,259 @@
+//========================================================//
+//  trace.cpp                                             //
+//  Binary trace reader and writer                        //
+//                                                        //
+//  See trace.hpp for the on-disk layout                  //
+//========================================================//
+
+#include "trace.hpp"
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+static_assert(sizeof(TraceHeader) == 32, "binary trace header must stay 32 bytes");
+
+static uint64_t
+zigzag(int64_t v)
+{
+  return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+bool
+is_binary_trace(const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return false;
+  }
+  char magic[4];
+  bool binary = fread(magic, 1, 4, f) == 4 && !memcmp(magic, TRACE_MAGIC, 4);
+  fclose(f);
+  return binary;
+}
+
+//------------------------------------//
+//            Trace Reader            //
+//------------------------------------//
+
+BinaryTrace::BinaryTrace(const char *path)
+  : path(path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Cannot open trace '%s'\n", path);
+    exit(1);
+  }
+  struct stat st;
+  fstat(fd, &st);
+  mapLen = st.st_size;
+  if (mapLen < sizeof(TraceHeader)) {
+    fprintf(stderr, "Trace '%s' is too short for a binary trace header\n", path);
+    exit(1);
+  }
+  map = mmap(NULL, mapLen, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "Cannot map trace '%s'\n", path);
+    exit(1);
+  }
+  madvise(map, mapLen, MADV_SEQUENTIAL);
+
+  hdr = (const TraceHeader *)map;
+  if (memcmp(hdr->magic, TRACE_MAGIC, 4) || hdr->version != TRACE_VERSION) {
+    fprintf(stderr, "Trace '%s' is not a version %u binary trace\n", path, TRACE_VERSION);
+    exit(1);
+  }
+  if (sizeof(TraceHeader) + hdr->words * sizeof(uint64_t) > mapLen) {
+    truncated();
+  }
+  begin = (const uint64_t *)(hdr + 1);
+  end = begin + hdr->words;
+  index = NULL;
+  if (hdr->index) {
+    if (hdr->index != (hdr->records + TRACE_INDEX_STRIDE - 1) / TRACE_INDEX_STRIDE ||
+        sizeof(TraceHeader) + hdr->words * sizeof(uint64_t) + hdr->index * sizeof(TraceIndexEntry) > mapLen) {
+      bad_index();
+    }
+    index = (const TraceIndexEntry *)end;
+    // skip() and seek() jump straight to these words
+    for (uint64_t k = 0; k < hdr->index; k++) {
+      if (index[k].word > hdr->words ||
+          (k && (index[k].word < index[k - 1].word || index[k].data < index[k - 1].data))) {
+        bad_index();
+      }
+    }
+  }
+  id = fnv1a(hdr, sizeof(TraceHeader));
+  id = fnv1a(begin, std::min<uint64_t>(hdr->words * sizeof(uint64_t), TRACE_IDENTITY_BYTES), id);
+  rewind();
+}
+
+BinaryTrace::~BinaryTrace()
+{
+  munmap(map, mapLen);
+}
+
+void
+BinaryTrace::truncated() const
+{
+  fprintf(stderr, "Trace '%s' is truncated\n", path);
+  exit(1);
+}
+
+void
+BinaryTrace::bad_index() const
+{
+  fprintf(stderr, "Trace '%s' has a truncated seek index\n", path);
+  exit(1);
+}
+
+uint64_t
+BinaryTrace::skip(uint64_t n, uint64_t &data)
+{
+  uint64_t start = done;
+  uint64_t to = done + std::min(n, hdr->records - done);
+  if (index) {
+    uint64_t first = (done + TRACE_INDEX_STRIDE - 1) / TRACE_INDEX_STRIDE;
+    uint64_t last = std::min(to / TRACE_INDEX_STRIDE, hdr->index - 1);
+    if (first < last) {
+      scan(first * TRACE_INDEX_STRIDE - done, data);
+      data += index[last].data - index[first].data;
+      cur = begin + index[last].word;
+      pc = index[last].pc;
+      addr = index[last].addr;
+      done = last * TRACE_INDEX_STRIDE;
+    }
+  }
+  scan(to - done, data);
+  return done - start;
+}
+
+uint64_t
+BinaryTrace::scan(uint64_t n, uint64_t &data)
+{
+  // only the running pc and addr are needed to go on from here
+  uint64_t i = 0;
+  for (; i < n && cur != end; i++) {
+    uint64_t w = *cur++;
+    data += w & TRACE_DATA;
+    if (w & TRACE_ESCAPE) {
+      if (end - cur < 2) {
+        truncated();
+      }
+      pc = cur[0];
+      addr = cur[1];
+      cur += 2;
+    } else {
+      pc += unzigzag((w >> TRACE_PC_SHIFT) & ((1ull << TRACE_PC_BITS) - 1));
+      addr += unzigzag(w >> TRACE_ADDR_SHIFT);
+    }
+  }
+  done += i;
+  return i;
+}
+
+void
+BinaryTrace::rewind()
+{
+  cur = begin;
+  done = 0;
+  pc = 0;
+  addr = 0;
+}
+
+bool
+BinaryTrace::seek(const TracePosition &pos)
+{
+  if (pos.records != hdr->records || pos.word > hdr->words) {
+    return false;
+  }
+  cur = begin + pos.word;
+  pc = pos.pc;
+  addr = pos.addr;
+  // count the accesses up to 'pos' from the indexed one before it, without
+  // an index skip() has no use for the count
+  done = 0;
+  if (index) {
+    uint64_t k = std::upper_bound(index, index + hdr->index, pos.word,
+                                  [](uint64_t word, const TraceIndexEntry &e) { return word < e.word; })
+                 - index - 1;
+    const uint64_t *w = begin + index[k].word;
+    done = k * TRACE_INDEX_STRIDE;
+    while (w < cur) {
+      w += *w & TRACE_ESCAPE ? 3 : 1;
+      done++;
+    }
+  }
+  return true;
+}
+
+//------------------------------------//
+//            Trace Writer            //
+//------------------------------------//
+
+BinaryTraceWriter::BinaryTraceWriter(const char *path, TraceDialect dialect)
+  : hdr{}, pc(0), addr(0), data(0)
+{
+  out = fopen(path, "wb");
+  if (!out) {
+    fprintf(stderr, "Cannot create trace '%s'\n", path);
+    exit(1);
+  }
+  setvbuf(out, NULL, _IOFBF, 1 << 20);
+  memcpy(hdr.magic, TRACE_MAGIC, 4);
+  hdr.version = TRACE_VERSION;
+  hdr.dialect = dialect;
+  fwrite(&hdr, sizeof(hdr), 1, out);
+}
+
+BinaryTraceWriter::~BinaryTraceWriter()
+{
+  if (out) {
+    finish();
+  }
+}
+
+void
+BinaryTraceWriter::put(uint64_t w)
+{
+  fwrite(&w, sizeof(w), 1, out);
+  hdr.words++;
+}
+
+void
+BinaryTraceWriter::append(const MemAccess &a)
+{
+  uint64_t dpc = zigzag((int64_t)(a.pc - pc));
+  uint64_t daddr = zigzag((int64_t)(a.addr - addr));
+  uint64_t w = (a.data ? TRACE_DATA : 0) | (a.write ? TRACE_WRITE : 0);
+
+  if (hdr.records % TRACE_INDEX_STRIDE == 0) {
+    index.push_back(TraceIndexEntry{hdr.words, pc, addr, data});
+  }
+  if (dpc >> TRACE_PC_BITS || daddr >> TRACE_ADDR_BITS) {
+    put(w | TRACE_ESCAPE);
+    put(a.pc);
+    put(a.addr);
+  } else {
+    put(w | dpc << TRACE_PC_SHIFT | daddr << TRACE_ADDR_SHIFT);
+  }
+  pc = a.pc;
+  addr = a.addr;
+  data += a.data;
+  hdr.records++;
+}
+
+void
+BinaryTraceWriter::finish()
+{
+  fwrite(index.data(), sizeof(TraceIndexEntry), index.size(), out);
+  hdr.index = index.size();
+  fseek(out, 0, SEEK_SET);
+  fwrite(&hdr, sizeof(hdr), 1, out);
+  fclose(out);
+  out = NULL;
+}
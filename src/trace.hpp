@@ -0,0 +1,198 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+//------------------------------------//
+//        Binary Trace Format         //
+//------------------------------------//
+//
+// A binary trace is a 32-byte header followed by a stream of little-endian
+// 64-bit words, one word per access:
+//
+//   bit  0     : 1 = D-side access, 0 = I-side access
+//   bit  1     : 1 = write, 0 = read
+//   bit  2     : escape, the next two words hold the absolute pc and addr
+//   bits 3-26  : zigzag delta of pc against the previous access
+//   bits 27-63 : zigzag delta of addr against the previous access
+//
+// For the simple dialect ('# <rw> <addr> <insts>') the pc slot carries the
+// instruction count and every access is D-side.
+//
+// The payload may be followed by a seek index of TraceIndexEntry, one for
+// every TRACE_INDEX_STRIDE accesses, so a reader can jump ahead without
+// decoding. Readers that do not know it stop at the end of the payload.
+//
+
+enum class TraceDialect : uint16_t
+{
+  CSE240 = 0, // 0x<pc>\t0x<addr>\t<I|D>\t<R|W>
+  SIMPLE = 1  // # <rw> <hexaddr> <insts>
+};
+
+struct TraceHeader
+{
+  char     magic[4];  // "CTRC"
+  uint16_t version;
+  TraceDialect dialect;
+  uint64_t records;   // number of accesses in the trace
+  uint64_t words;     // payload length in 64-bit words
+  uint64_t index;     // seek index entries after the payload, 0 if none
+};
+
+// Where decoding stands before access k * TRACE_INDEX_STRIDE
+struct TraceIndexEntry
+{
+  uint64_t word;      // payload word of the access
+  uint64_t pc;        // the access before it, the base of its deltas
+  uint64_t addr;
+  uint64_t data;      // D-side accesses before it
+};
+
+// A decoded access, shared by both simulators
+struct MemAccess
+{
+  uint64_t pc;    // pc, or instruction count for the simple dialect
+  uint64_t addr;
+  bool     data;  // D-side access
+  bool     write;
+};
+
+constexpr char     TRACE_MAGIC[4] = {'C', 'T', 'R', 'C'};
+constexpr uint16_t TRACE_VERSION  = 1;
+
+constexpr uint64_t TRACE_DATA     = 1ull << 0;
+constexpr uint64_t TRACE_WRITE    = 1ull << 1;
+constexpr uint64_t TRACE_ESCAPE   = 1ull << 2;
+constexpr unsigned TRACE_PC_SHIFT   = 3;
+constexpr unsigned TRACE_PC_BITS    = 24;
+constexpr unsigned TRACE_ADDR_SHIFT = TRACE_PC_SHIFT + TRACE_PC_BITS;
+constexpr unsigned TRACE_ADDR_BITS  = 64 - TRACE_ADDR_SHIFT;
+constexpr uint64_t TRACE_INDEX_STRIDE = 1 << 16;
+
+// Where decoding stands in a binary trace, enough to resume from there
+struct TracePosition
+{
+  uint64_t records;   // accesses in the whole trace, 0 for a text trace
+  uint64_t word;      // next payload word
+  uint64_t pc;        // last decoded access, the base of the next delta
+  uint64_t addr;
+};
+
+// Bytes of a trace its identity is taken over, see TraceReader::identity()
+constexpr size_t TRACE_IDENTITY_BYTES = 4096;
+
+// Returns true if the file at 'path' starts with the binary trace magic
+bool is_binary_trace(const char *path);
+
+// FNV-1a of the 'bytes' at 'data', going on from 'h'
+inline uint64_t
+fnv1a(const void *data, size_t bytes, uint64_t h = 0xcbf29ce484222325ull)
+{
+  const uint8_t *p = (const uint8_t *)data;
+  for (size_t i = 0; i < bytes; i++) {
+    h = (h ^ p[i]) * 0x100000001b3ull;
+  }
+  return h;
+}
+
+// Read-only view of a binary trace mapped into memory. Accesses are decoded
+// straight out of the mapping, nothing is copied.
+class BinaryTrace
+{
+public:
+  explicit BinaryTrace(const char *path);
+  ~BinaryTrace();
+  BinaryTrace(const BinaryTrace &) = delete;
+  BinaryTrace &operator=(const BinaryTrace &) = delete;
+
+  const TraceHeader &header() const { return *hdr; }
+  // Hash of the header and the first payload words
+  uint64_t identity() const { return id; }
+
+  // Decode the next access into 'a', returns false at the end of the trace
+  bool next(MemAccess &a)
+  {
+    if (cur == end) {
+      return false;
+    }
+    uint64_t w = *cur++;
+    if (w & TRACE_ESCAPE) {
+      if (end - cur < 2) {
+        truncated();
+      }
+      pc = cur[0];
+      addr = cur[1];
+      cur += 2;
+    } else {
+      pc += unzigzag((w >> TRACE_PC_SHIFT) & ((1ull << TRACE_PC_BITS) - 1));
+      addr += unzigzag(w >> TRACE_ADDR_SHIFT);
+    }
+    a.pc = pc;
+    a.addr = addr;
+    a.data = w & TRACE_DATA;
+    a.write = w & TRACE_WRITE;
+    done++;
+    return true;
+  }
+
+  // Move past the next 'n' accesses without decoding them into a MemAccess,
+  // adding the D-side ones to 'data'. Returns how many there were. With a
+  // seek index only the accesses up to the first and from the last indexed
+  // one are read.
+  uint64_t skip(uint64_t n, uint64_t &data);
+
+  // Restart decoding from the first access
+  void rewind();
+
+  TracePosition position() const { return {hdr->records, (uint64_t)(cur - begin), pc, addr}; }
+  // Resume decoding at 'pos', returns false if it is not a position of
+  // this trace
+  bool seek(const TracePosition &pos);
+
+private:
+  static uint64_t unzigzag(uint64_t v) { return (v >> 1) ^ (0 - (v & 1)); }
+
+  // skip() one access at a time
+  uint64_t scan(uint64_t n, uint64_t &data);
+  [[noreturn]] void truncated() const;
+  [[noreturn]] void bad_index() const;
+
+  const char *path;
+  void *map;
+  size_t mapLen;
+  const TraceHeader *hdr;
+  const TraceIndexEntry *index;  // NULL without a seek index
+  const uint64_t *begin;
+  const uint64_t *cur;
+  const uint64_t *end;
+  uint64_t done;                 // accesses decoded so far
+  uint64_t pc;
+  uint64_t addr;
+  uint64_t id;
+};
+
+// Streams accesses into a binary trace file, the header is patched with the
+// final counts by finish()
+class BinaryTraceWriter
+{
+public:
+  BinaryTraceWriter(const char *path, TraceDialect dialect);
+  ~BinaryTraceWriter();
+  BinaryTraceWriter(const BinaryTraceWriter &) = delete;
+  BinaryTraceWriter &operator=(const BinaryTraceWriter &) = delete;
+
+  void append(const MemAccess &a);
+  void finish();
+
+private:
+  void put(uint64_t w);
+
+  FILE *out;
+  TraceHeader hdr;
+  uint64_t pc;
+  uint64_t addr;
+  uint64_t data;                 // D-side accesses so far
+  std::vector<TraceIndexEntry> index;
+};
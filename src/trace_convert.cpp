@@ -0,0 +1,72 @@
+//========================================================//
+//  trace_convert.cpp                                     //
+//  Convert text traces into the binary trace format      //
+//                                                        //
+//  Both text dialects are accepted, the dialect is       //
+//  detected from the first line of the input. Any        //
+//  trace, generated ones included, can also be written   //
+//  out as text.                                          //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.hpp"
+#include "parser.hpp"
+
+void
+usage()
+{
+  fprintf(stderr,"Usage: convert [--text] <in.txt[.bz2|.gz|.zst]|in.bin|gen:spec|-> <out>\n");
+  fprintf(stderr,"       convert trace.bz2 trace.bin\n");
+  fprintf(stderr,"       convert --text gen:zipf,records=100M trace.txt\n");
+  fprintf(stderr," --text    Write a text trace of the input's dialect instead of a binary one\n");
+}
+
+// Write every access of 'in' to 'path' as a text trace
+//
+void
+write_text(TraceReader &in, const char *path)
+{
+  FILE *out = fopen(path, "w");
+  if (!out) {
+    fprintf(stderr,"Cannot create trace '%s'\n", path);
+    exit(1);
+  }
+  setvbuf(out, NULL, _IOFBF, 1 << 20);
+  MemAccess a;
+  if (in.dialect() == TraceDialect::CSE240) {
+    while (in.next(a)) {
+      fprintf(out, "0x%lx\t0x%lx\t%c\t%c\n", a.pc, a.addr, a.data ? 'D' : 'I', a.write ? 'W' : 'R');
+    }
+  } else {
+    while (in.next(a)) {
+      fprintf(out, "# %d %lx %lu\n", a.write, a.addr, a.pc);
+    }
+  }
+  fclose(out);
+}
+
+int
+main(int argc, char *argv[])
+{
+  bool text = argc == 4 && !strcmp(argv[1],"--text");
+  if (argc != 3 + text) {
+    usage();
+    exit(1);
+  }
+
+  TraceReader in(argv[1 + text]);
+  if (text) {
+    write_text(in, argv[2 + text]);
+    return 0;
+  }
+  BinaryTraceWriter out(argv[2], in.dialect());
+  MemAccess a;
+  while (in.next(a)) {
+    out.append(a);
+  }
+  out.finish();
+
+  return 0;
+}